@@ -8,7 +8,7 @@
 #include "nrutil.h"
 
 /* Do 1D Fourier transform */
-void do_1DFFT(t_non *non,char fname[256],float *re_S_1,float *im_S_1,int samples){
+void do_1DFFT(t_non *non,const char *fname,float *re_S_1,float *im_S_1,int samples){
 
   /* Floats */
   float shift1;
@@ -60,7 +60,7 @@ void do_1DFFT(t_non *non,char fname[256],float *re_S_1,float *im_S_1,int samples
 }
 
 /* Do 1D Fourier transform */
-void do_1DFFTold(t_non *non,char fname[256],float *re_S_1,float *im_S_1,int samples){
+void do_1DFFTold(t_non *non,const char *fname,float *re_S_1,float *im_S_1,int samples){
 
   /* Floats */
   float shift1;
@@ -107,3 +107,67 @@ void do_1DFFTold(t_non *non,char fname[256],float *re_S_1,float *im_S_1,int samp
     
   fclose(outone);
 }
+
+/* Pump probe spectrum from the t1=0 response */
+/* The rephasing and nonrephasing response at t1=0 are added and Fourier */
+/* transformed over t3. The imaginary part is the broadband pump probe */
+/* signal, the projection of the 2D spectrum on the probe axis. For a t2 */
+/* series one file is written for each waiting time as e.g. PP_t1=0.par_T2=100.dat */
+/* With a TimeIncrement of t3 only the calculated t3 points are transformed. */
+void do_PPFFT(t_non *non,const char *fname,float **rrI,float **riI,float **rrII,float **riII,int samples){
+
+  /* Floats */
+  float w3,dt;
+  fftw_complex *fftIn,*fftOut;
+  fftw_plan fftPlan;
+  /* Integers */
+  int i,j,t3,w,r0,nw,n3,fft;
+  /* Files */
+  FILE *outone;
+  char name[256];
+
+  n3=(non->tmax3+non->dt3-1)/non->dt3;
+  dt=non->deltat*non->dt3;
+  fft=non->fft/non->dt3;
+  if (fft<n3) fft=n3;
+
+  fftIn = fftw_malloc(sizeof(fftw_complex) * fft);
+  fftOut = fftw_malloc(sizeof(fftw_complex) * fft);
+  fftPlan = fftw_plan_dft_1d(fft,fftIn,fftOut,FFTW_FORWARD,FFTW_ESTIMATE);
+
+  nw=non->nt2>0 ? non->nt2 : 1;
+  for (w=0;w<nw;w++){
+    r0=w*non->tmax3;
+    for (i=0;i<fft;i++){
+      fftIn[i][0]=0;
+      fftIn[i][1]=0;
+    }
+    for (t3=0;t3<non->tmax3;t3+=non->dt3){
+      // Each calculated point stands for dt3 time steps
+      fftIn[t3/non->dt3][0]=(rrI[r0+t3][0]+rrII[r0+t3][0])*non->dt3/samples;
+      fftIn[t3/non->dt3][1]=(riI[r0+t3][0]+riII[r0+t3][0])*non->dt3/samples;
+    }
+    /* Scale first point as the t3=0 points of the 2D response */
+    fftIn[0][0]=fftIn[0][0]*0.5;
+    fftIn[0][1]=fftIn[0][1]*0.5;
+
+    fftw_execute(fftPlan);
+    if (non->nt2>0){
+      snprintf(name,sizeof(name),"%.*s_T2=%g.dat",(int)strlen(fname)-4,fname,non->t2list[w]*non->deltat);
+    } else {
+      snprintf(name,sizeof(name),"%s",fname);
+    }
+    outone=fopen(name,"w");
+    fprintf(outone,"### Broadband pump probe spectrum\n");
+    for (i=fft/2;i<fft+fft/2;i++){
+      j=i%fft;
+      w3=(i-fft)/dt/c_v/fft+non->shifte;
+      if (w3>non->min3 && w3<non->max3){
+	fprintf(outone,"%f %e\n",w3,fftOut[j][1]);
+      }
+    }
+    fclose(outone);
+  }
+  fftw_destroy_plan(fftPlan);
+  fftw_free(fftIn),fftw_free(fftOut);
+}
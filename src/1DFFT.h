@@ -1,5 +1,6 @@
 #ifndef _1DFFT_
 #define _1DFFT_
-void do_1DFFT(t_non *non,char fname[256],float *re_S_1,float *im_S_1,int samples);
-void do_1DFFTold(t_non *non,char fname[256],float *re_S_1,float *im_S_1,int samples);
+void do_1DFFT(t_non *non,const char *fname,float *re_S_1,float *im_S_1,int samples);
+void do_1DFFTold(t_non *non,const char *fname,float *re_S_1,float *im_S_1,int samples);
+void do_PPFFT(t_non *non,const char *fname,float **rrI,float **riI,float **rrII,float **riII,int samples);
 #endif // _1DFFT_
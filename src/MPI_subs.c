@@ -11,16 +11,22 @@
 #include "omp.h"
 #include "types.h"
 #include "NISE_subs.h"
+#include "trajectory.h"
 #include "polar.h"
 #include "MPI_subs.h"
+#include "1DFFT.h"
 #include <stdarg.h>
 #include "mpi.h"
 
 // Print results to the corresponding files
 void print2D(char* filename, float** arrR, float** arrI, t_non* non, int sampleCount) {
+    print2Dt2(filename, arrR, arrI, non, sampleCount, non->tmax2);
+}
+
+// Print the results of the waiting time t2
+void print2Dt2(char* filename, float** arrR, float** arrI, t_non* non, int sampleCount, int t2) {
     FILE* out = fopen(filename, "w");
     for (int t1 = 0; t1 < non->tmax1; t1 += non->dt1) {
-        const int t2 = non->tmax2;
         for (int t3 = 0; t3 < non->tmax3; t3 += non->dt3) {
             arrR[t3][t1] /= sampleCount;
             arrI[t3][t1] /= sampleCount;
@@ -33,7 +39,58 @@ void print2D(char* filename, float** arrR, float** arrI, t_non* non, int sampleC
     fclose(out);
 }
 
-void calculateWorkset(t_non* non, int** workset, int* sampleCount, int* clusterCount) {
+// Print the results of all waiting times. The rows of each waiting time of a
+// t2 series follow each other and go to files named e.g. RparI_T2=100.dat,
+// with the waiting time in fs.
+void print2Dseries(char* filename, float** arrR, float** arrI, t_non* non, int sampleCount) {
+    char name[256];
+    int len = strlen(filename) - 4; // Without .dat
+
+    if (non->nt2 == 0) {
+        print2D(filename, arrR, arrI, non, sampleCount);
+        return;
+    }
+    for (int w = 0; w < non->nt2; w++) {
+        snprintf(name, sizeof(name), "%.*s_T2=%g.dat", len, filename, non->t2list[w] * non->deltat);
+        print2Dt2(name, arrR + w * non->tmax3, arrI + w * non->tmax3, non, sampleCount, non->t2list[w]);
+    }
+}
+
+// Reduce the linear response accumulated during a 2D calculation and let the
+// master write TD_Absorption.dat and Absorption.dat as the Absorption technique.
+// Must be called by all processes.
+void printAbsorption(t_non* non, float* re_S_1, float* im_S_1, int sampleCount, int parentRank, int subRank,
+                     MPI_Comm subComm, MPI_Comm rootComm) {
+    // Reduce at small scope and then over the nodes
+    MPI_Reduce(subRank == 0 ? MPI_IN_PLACE : re_S_1, re_S_1, non->tmax1, MPI_FLOAT, MPI_SUM, 0, subComm);
+    MPI_Reduce(subRank == 0 ? MPI_IN_PLACE : im_S_1, im_S_1, non->tmax1, MPI_FLOAT, MPI_SUM, 0, subComm);
+    if (subRank == 0) {
+        MPI_Reduce(parentRank == 0 ? MPI_IN_PLACE : re_S_1, re_S_1, non->tmax1, MPI_FLOAT, MPI_SUM, 0, rootComm);
+        MPI_Reduce(parentRank == 0 ? MPI_IN_PLACE : im_S_1, im_S_1, non->tmax1, MPI_FLOAT, MPI_SUM, 0, rootComm);
+    }
+    if (parentRank != 0) return;
+
+    // The checkpoints only hold the 2D response
+    if (non->restart) {
+        printf("The linear absorption is not written for a restarted calculation.\n");
+        return;
+    }
+
+    FILE* out = fopen("TD_Absorption.dat", "w");
+    for (int t1 = 0; t1 < non->tmax1; t1 += non->dt1) {
+        fprintf(out, "%f %e %e\n", t1 * non->deltat, re_S_1[t1] / sampleCount, im_S_1[t1] / sampleCount);
+    }
+    fclose(out);
+
+    // The Fourier transform needs every time step of t1
+    if (non->dt1 > 1) {
+        printf("Absorption.dat is not written when the TimeIncrement of t1 is larger than one.\n");
+        return;
+    }
+    do_1DFFT(non, "Absorption.dat", re_S_1, im_S_1, sampleCount);
+}
+
+void calculateWorkset(t_non* non, int** workset, int* sampleCount, int* clusterCount, int polItems) {
     // Open clustering file if necessary
     FILE* Cfile;
     if (non->cluster != -1) {
@@ -67,7 +124,7 @@ void calculateWorkset(t_non* non, int** workset, int* sampleCount, int* clusterC
     }
 
     // Allocate workset array
-    *workset = calloc(2 * 21 * *sampleCount, sizeof(int)); // two integers per work item (sample + polDir), 21 polDirs per sample
+    *workset = calloc(2 * polItems * *sampleCount, sizeof(int)); // two integers per work item (sample + polDir), polItems polDirs per sample
 
     // Loop over samples, fill work set array of things to do
     int currentWorkItem = 0;
@@ -94,7 +151,7 @@ void calculateWorkset(t_non* non, int** workset, int* sampleCount, int* clusterC
         }
 
         // Set work items
-        for(int molPol = 0; molPol < 21; molPol++) {
+        for(int molPol = 0; molPol < polItems; molPol++) {
             (*workset)[currentWorkItem * 2] = currentSample;
             (*workset)[currentWorkItem * 2 + 1] = molPol;
             currentWorkItem++;
@@ -105,7 +162,7 @@ void calculateWorkset(t_non* non, int** workset, int* sampleCount, int* clusterC
     // Furthermore, sampleCount is adjusted to reflect the actual number of samples to consider when clustering
 
     if (non->cluster != -1) {
-        fclose(Cfile);
+        traj_fclose(Cfile);
     }
 }
 
@@ -127,3 +184,290 @@ void asyncWaitForMPI(MPI_Request requests[], int requestCount, int initialWaitin
     }
 }
 
+
+// Read frames first to first+count-1 of a trajectory file with the given frame size
+// once per node into a shared memory window, which the file readers of all processes
+// on the node then use instead of the file
+MPI_Win shareFrames(FILE* FH, size_t frame, int first, int count, int subRank, MPI_Comm subComm) {
+    MPI_Win win;
+    MPI_Aint size;
+    int dispUnit;
+    char* base;
+    long bytes = 0;
+
+    if (first < 0) {
+        count += first;
+        first = 0;
+    }
+    if (subRank == 0) {
+        fseek(FH, 0, SEEK_END);
+        bytes = ftell(FH) - (long) first * frame;
+        if (bytes > (long) count * frame) bytes = (long) count * frame;
+        if (bytes < 0) bytes = 0;
+    }
+    MPI_Bcast(&bytes, 1, MPI_LONG, 0, subComm);
+
+    MPI_Win_allocate_shared(subRank == 0 ? bytes : 0, 1, MPI_INFO_NULL, subComm, &base, &win);
+    if (subRank != 0) MPI_Win_shared_query(win, 0, &size, &dispUnit, &base);
+
+    MPI_Win_fence(0, win);
+    if (subRank == 0 && bytes > 0) {
+        fseek(FH, (long) first * frame, SEEK_SET);
+        if (fread(base, 1, bytes, FH) != (size_t) bytes) {
+            printf("Could not read trajectory frames into shared memory!\n");
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+    }
+    MPI_Win_fence(0, win);
+
+    traj_attach(FH, base, (size_t) first * frame, bytes);
+    return win;
+}
+
+// Let the readers use the file again and free the shared window
+void unshareFrames(FILE* FH, MPI_Win* win) {
+    traj_unmap(FH);
+    MPI_Win_free(win);
+}
+
+// Set up the distribution of work items 0 to total-1 over the processes. With static
+// scheduling each process gets a fixed block, with dynamic scheduling the processes
+// take items from a counter on the master process until all are taken.
+void initWorkQueue(t_workqueue* queue, int total, int dynamic, int parentRank, int parentSize) {
+    queue->dynamic = dynamic;
+    queue->total = total;
+    queue->done = 0;
+    queue->stopped = 0;
+    queue->next = queue->end = 0;
+    if (!dynamic) {
+        int base = total / parentSize, remainder = total % parentSize;
+        queue->next = parentRank * base + (parentRank < remainder ? parentRank : remainder);
+        queue->end = queue->next + base + (parentRank < remainder ? 1 : 0);
+        return;
+    }
+
+    MPI_Win_allocate(parentRank == 0 ? sizeof(int) : 0, sizeof(int), MPI_INFO_NULL, MPI_COMM_WORLD,
+                     &queue->counter, &queue->win);
+    if (parentRank == 0) {
+        MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, queue->win);
+        *queue->counter = 0;
+        MPI_Win_unlock(0, queue->win);
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+    MPI_Win_lock_all(0, queue->win);
+}
+
+// Take the next work item, returns -1 when no items are left
+int nextWorkItem(t_workqueue* queue) {
+    int item;
+    if (!queue->dynamic) {
+        if (queue->next == queue->end) return -1;
+        item = queue->next++;
+    }
+    else if (queue->next < queue->end) {
+        item = queue->next++;
+    }
+    else {
+        const int one = 1;
+        MPI_Fetch_and_op(&one, &item, MPI_INT, 0, 0, MPI_SUM, queue->win);
+        MPI_Win_flush(0, queue->win);
+        if (item >= queue->total) return -1;
+    }
+    queue->done++;
+    return item;
+}
+
+// Stop handing out work items with dynamic scheduling. The items not yet handed out
+// of the last sample started are then done by the calling process. Returns the number
+// of work items that will be completed, which all belong to complete samples.
+int stopWorkQueue(t_workqueue* queue, int polItems) {
+    int old, total = queue->total;
+    if (!queue->dynamic || queue->stopped) return total;
+    MPI_Fetch_and_op(&total, &old, MPI_INT, 0, 0, MPI_REPLACE, queue->win);
+    MPI_Win_flush(0, queue->win);
+    if (old > total) old = total;
+    queue->next = old;
+    queue->end = (old + polItems - 1) / polItems * polItems;
+    if (queue->end > total) queue->end = total;
+    queue->stopped = 1;
+    return queue->end;
+}
+
+// Free the work queue and write the number of items done by each process to the log
+void freeWorkQueue(t_workqueue* queue, int parentRank, int parentSize) {
+    int* done = parentRank == 0 ? calloc(parentSize, sizeof(int)) : NULL;
+
+    if (queue->dynamic) {
+        MPI_Win_unlock_all(queue->win);
+        MPI_Win_free(&queue->win);
+    }
+
+    MPI_Gather(&queue->done, 1, MPI_INT, done, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (parentRank == 0) {
+        FILE* log = fopen("NISE.log", "a");
+        fprintf(log, "Work items done by each process (%s scheduling):", queue->dynamic ? "dynamic" : "static");
+        for (int i = 0; i < parentSize; i++) fprintf(log, " %d", done[i]);
+        fprintf(log, "\n");
+        fclose(log);
+        free(done);
+    }
+}
+
+// Name of the checkpoint file of a process
+static void checkpointName(char* name, int rank) {
+    sprintf(name, "Checkpoint_%d.bin", rank);
+}
+
+// Write the accumulated response and the completed work items of this process.
+// The file is written under a temporary name first, so an interrupted write
+// leaves the previous checkpoint intact. Returns 1 when the checkpoint was
+// written completely and replaced the previous one, otherwise 0.
+int writeCheckpoint(t_checkpoint* cp, int parentRank, int parentSize) {
+    char name[256], tmpName[sizeof(name) + 4];
+    int head[4] = { CHECKPOINT_MAGIC, cp->generation, parentRank, parentSize };
+    int ok;
+    FILE* out;
+
+    cp->last = MPI_Wtime();
+    checkpointName(name, parentRank);
+    snprintf(tmpName, sizeof(tmpName), "%s.tmp", name);
+    out = fopen(tmpName, "wb");
+    if (out == NULL) {
+        printf("Could not write checkpoint file %s!\n", tmpName);
+        return 0;
+    }
+    ok = fwrite(head, sizeof(int), 4, out) == 4;
+    ok = ok && fwrite(cp->header, sizeof(int), 6, out) == 6;
+    ok = ok && fwrite(&cp->nDone, sizeof(int), 1, out) == 1;
+    for (int i = 0; i < cp->nArrays && ok; i++) {
+        ok = fwrite(cp->arrays[i][0], sizeof(float), cp->size, out) == (size_t)cp->size;
+    }
+    ok = ok && fwrite(cp->done, sizeof(int), cp->nDone, out) == (size_t)cp->nDone;
+    if (fclose(out) != 0) ok = 0;
+    // Only a complete file replaces the previous checkpoint
+    if (ok && rename(tmpName, name) == 0) return 1;
+    printf("Could not write checkpoint file %s!\n", tmpName);
+    remove(tmpName);
+    return 0;
+}
+
+// Stop when a checkpoint file can not be used for the present calculation
+static void checkpointMismatch(char* name) {
+    printf("Checkpoint file %s does not match the present input!\n", name);
+    printf("Restart with the same input as the interrupted calculation.\n");
+    MPI_Abort(MPI_COMM_WORLD, 1);
+}
+
+// Add the checkpoint of process rank to the accumulators, returns 0 if the file
+// does not belong to the given generation
+static int readCheckpoint(t_checkpoint* cp, int rank, int generation, char* skip) {
+    char name[256];
+    int head[4], header[6], nDone, item;
+    float* buffer;
+    FILE* in;
+
+    checkpointName(name, rank);
+    in = fopen(name, "rb");
+    if (in == NULL) return 0;
+    if (fread(head, sizeof(int), 4, in) != 4 || head[0] != CHECKPOINT_MAGIC || head[1] != generation ||
+        head[2] != rank) {
+        fclose(in);
+        return 0;
+    }
+    if (fread(header, sizeof(int), 6, in) != 6 || memcmp(header, cp->header, sizeof(header)) != 0) {
+        checkpointMismatch(name);
+    }
+    if (fread(&nDone, sizeof(int), 1, in) != 1 || nDone < 0 || nDone > cp->header[3]) checkpointMismatch(name);
+    buffer = calloc(cp->size, sizeof(float));
+    for (int i = 0; i < cp->nArrays; i++) {
+        if (fread(buffer, sizeof(float), cp->size, in) != (size_t)cp->size) checkpointMismatch(name);
+        for (int j = 0; j < cp->size; j++) cp->arrays[i][0][j] += buffer[j];
+    }
+    // The accumulators hold the response of all listed items, so all must be read
+    for (int i = 0; i < nDone; i++) {
+        if (fread(&item, sizeof(int), 1, in) != 1 || item < 0 || item >= cp->header[3]) checkpointMismatch(name);
+        if (!skip[item]) cp->done[cp->nDone++] = item;
+        skip[item] = 1;
+    }
+    free(buffer);
+    fclose(in);
+    return 1;
+}
+
+// Set up checkpointing of the given accumulators of size tmax3 x tmax1 for every
+// waiting time. When restarting
+// the master adds all checkpoints of the interrupted calculation to its accumulators.
+// Returns an array marking the work items that were already completed.
+char* initCheckpoint(t_checkpoint* cp, t_non* non, float*** arrays, int nArrays, int totalWorkItems,
+                     int parentRank, int parentSize) {
+    char name[256];
+    char* skip = calloc(totalWorkItems > 0 ? totalWorkItems : 1, sizeof(char));
+    int head[4], previousSize = 0, written = 1;
+
+    cp->arrays = arrays;
+    cp->nArrays = nArrays;
+    cp->size = waitingTimes(non) * non->tmax3 * non->tmax1;
+    cp->header[0] = non->tmax1, cp->header[1] = waitingTimes(non) * non->tmax3, cp->header[2] = nArrays;
+    cp->header[3] = totalWorkItems, cp->header[4] = non->begin, cp->header[5] = non->end;
+    cp->interval = non->checkpoint * 60.0;
+    cp->last = MPI_Wtime();
+    cp->nDone = 0;
+    cp->done = calloc(totalWorkItems > 0 ? totalWorkItems : 1, sizeof(int));
+    cp->generation = 0;
+    cp->active = non->checkpoint > 0 || non->restart;
+
+    if (non->restart && parentRank == 0) {
+        checkpointName(name, 0);
+        FILE* in = fopen(name, "rb");
+        if (in != NULL && fread(head, sizeof(int), 4, in) == 4 && head[0] == CHECKPOINT_MAGIC) {
+            previousSize = head[3];
+            for (int rank = 0; rank < previousSize; rank++) readCheckpoint(cp, rank, head[1], skip);
+            cp->generation = head[1] + 1;
+            printf("Restarting with %d of %d work items completed.\n", cp->nDone, totalWorkItems);
+            log_item("Restarted from checkpoint with %d of %d work items completed.\n", cp->nDone, totalWorkItems);
+        }
+        else {
+            printf("No checkpoint found, starting from the beginning.\n");
+        }
+        if (in != NULL) fclose(in);
+        // The master checkpoint now holds everything, older files of a newer generation are ignored
+        written = writeCheckpoint(cp, 0, parentSize);
+        for (int rank = parentSize; rank < previousSize && written; rank++) {
+            checkpointName(name, rank);
+            remove(name);
+        }
+    }
+    // The checkpoints of the interrupted calculation are only removed once they are merged
+    MPI_Bcast(&written, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (!written) {
+        if (parentRank == 0) printf("Could not merge the checkpoints, the old checkpoint files are kept.\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    MPI_Bcast(&cp->generation, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(skip, totalWorkItems, MPI_CHAR, 0, MPI_COMM_WORLD);
+
+    // Old checkpoints of the other processes are included in the master checkpoint or stale
+    if (cp->active && (parentRank != 0 || !non->restart)) {
+        checkpointName(name, parentRank);
+        remove(name);
+    }
+    return skip;
+}
+
+// Register a completed work item and write a checkpoint when it is time
+void markCheckpoint(t_checkpoint* cp, int item, int parentRank, int parentSize) {
+    cp->done[cp->nDone++] = item;
+    if (cp->interval > 0 && MPI_Wtime() - cp->last > cp->interval) {
+        writeCheckpoint(cp, parentRank, parentSize);
+    }
+}
+
+// Remove the checkpoint of this process after a completed calculation
+void freeCheckpoint(t_checkpoint* cp, int parentRank) {
+    char name[256];
+    if (cp->active) {
+        checkpointName(name, parentRank);
+        remove(name);
+    }
+    free(cp->done);
+}
@@ -2,8 +2,51 @@
 #define _MPI_SUBS_
 
 #include <mpi.h>
+
+// Work items handed out to the processes, either as fixed blocks or one at a
+// time from a counter on the master process
+typedef struct {
+  int dynamic;
+  int total; // Number of work items
+  int next,end; // Block of this process with static scheduling, remaining items after a stop
+  int done; // Number of items taken by this process
+  int stopped; // No more items are handed out
+  int *counter;
+  MPI_Win win;
+} t_workqueue;
+
+#define CHECKPOINT_MAGIC 0x4E495345
+
+// Checkpoint of the partial 2D response accumulated by one process
+typedef struct {
+  int active; // Checkpoints are written or read
+  int generation; // Increased on every restart, older files are ignored
+  double interval; // Seconds between checkpoints, 0 for none
+  double last; // Time of the last checkpoint
+  float ***arrays; // Accumulators, each tmax3 x tmax1
+  int nArrays,size;
+  int header[6]; // tmax1, tmax3, nArrays, work items, begin and end sample
+  int nDone; // Number of completed work items in done
+  int *done;
+} t_checkpoint;
+
 void print2D(char* filename, float** arrR, float** arrI, t_non* non, int sampleCount);
-void calculateWorkset(t_non* non, int** workset, int* sampleCount, int* clusterCount);
+void print2Dt2(char* filename, float** arrR, float** arrI, t_non* non, int sampleCount, int t2);
+void print2Dseries(char* filename, float** arrR, float** arrI, t_non* non, int sampleCount);
+void printAbsorption(t_non* non, float* re_S_1, float* im_S_1, int sampleCount, int parentRank, int subRank,
+                     MPI_Comm subComm, MPI_Comm rootComm);
+void calculateWorkset(t_non* non, int** workset, int* sampleCount, int* clusterCount, int polItems);
 void asyncWaitForMPI(MPI_Request requests[], int requestCount, int initialWaitingTime, int maxWaitingTime);
+MPI_Win shareFrames(FILE* FH, size_t frame, int first, int count, int subRank, MPI_Comm subComm);
+void unshareFrames(FILE* FH, MPI_Win* win);
+void initWorkQueue(t_workqueue* queue, int total, int dynamic, int parentRank, int parentSize);
+int nextWorkItem(t_workqueue* queue);
+int stopWorkQueue(t_workqueue* queue, int polItems);
+void freeWorkQueue(t_workqueue* queue, int parentRank, int parentSize);
+char* initCheckpoint(t_checkpoint* cp, t_non* non, float*** arrays, int nArrays, int totalWorkItems,
+                     int parentRank, int parentSize);
+int writeCheckpoint(t_checkpoint* cp, int parentRank, int parentSize);
+void markCheckpoint(t_checkpoint* cp, int item, int parentRank, int parentSize);
+void freeCheckpoint(t_checkpoint* cp, int parentRank);
 
 #endif // _MPI_SUBS_
@@ -5,6 +5,7 @@
 #include "types.h"
 #include "types_MPI.h"
 #include "NISE_subs.h"
+#include "workspace.h"
 #include "readinput.h"
 #include "NISE.h"
 #include "absorption.h"
@@ -14,6 +15,8 @@
 #include "calc_2DES.h"
 #include "analyse.h"
 #include "calc_CD.h"
+#include "calc_LD.h"
+#include "linear_multi.h"
 #include "population.h"
 #include <mpi.h>
 
@@ -115,6 +118,18 @@ int main(int argc, char* argv[]) {
         MPI_Bcast(non->psites, non->singles, MPI_INT, 0, MPI_COMM_WORLD);
     }
 
+    // Synchronize the waiting times of a t2 series
+    if (non->nt2 > 0) {
+        if (parentRank != 0) {
+            non->t2list = calloc(non->nt2, sizeof(int));
+        }
+
+        MPI_Bcast(non->t2list, non->nt2, MPI_INT, 0, MPI_COMM_WORLD);
+    }
+
+    // Size the per-thread workspace of the propagation routines
+    ws_init(non);
+
     // Delegate to different subroutines depending on the technique
 
     // Call the Hamiltonian Analysis routine
@@ -126,9 +141,8 @@ int main(int argc, char* argv[]) {
 
     // Call the Population Transfer routine
     if (!strcmp(non->technique, "Pop")) {
-        // Does not support MPI
-        if (parentRank == 0)
-            population(non);
+        // Does support MPI
+        population(non, parentRank, parentSize, subRank, subSize, subComm, rootComm);
     }
 
     // Call the Exciton Diffusion routine
@@ -139,32 +153,32 @@ int main(int argc, char* argv[]) {
 
     // Call the Linear Absorption Routine
     if (!strcmp(non->technique, "Absorption")) {
-        // Does not support MPI
-        if (parentRank == 0) {
-            if (!strcmp(non->hamiltonian, "Coupling")) {
-                c_absorption(non);
-            }
-            else {
-                absorption(non);
-            }
+        if (!strcmp(non->hamiltonian, "Coupling")) {
+            c_absorption(non, parentRank, parentSize, subRank, subSize, subComm, rootComm);
+        }
+        else {
+            absorption(non, parentRank, parentSize, subRank, subSize, subComm, rootComm);
         }
     }
 
     // Call the Luminescence Routine
     if (!strcmp(non->technique, "Luminescence")) {
-        // Does not support MPI
-        if (parentRank == 0)
-            luminescence(non);
+        luminescence(non, parentRank, parentSize, subRank, subSize, subComm, rootComm);
     }
 
     // Call the Linear Dichroism Routine
-    if (!strcmp(non->technique, "LD")) { }
+    if (!strcmp(non->technique, "LD")) {
+        LD(non, parentRank, parentSize, subRank, subSize, subComm, rootComm);
+    }
 
     // Call the Circular Dichroism Routine
     if (!strcmp(non->technique, "CD")) {
-        // Does not support MPI
-        if (parentRank == 0)
-            calc_CD(non);
+        calc_CD(non, parentRank, parentSize, subRank, subSize, subComm, rootComm);
+    }
+
+    // Call the combined linear routine for a list like Absorption,LD,CD
+    if (strchr(non->technique, ',') != NULL) {
+        linear_multi(non, parentRank, parentSize, subRank, subSize, subComm, rootComm);
     }
 
     // Call the Raman Routine
@@ -175,7 +189,7 @@ int main(int argc, char* argv[]) {
 
     // Call the 2DIR calculation routine
     if (!strcmp(non->technique, "2DIR") || (!strcmp(non->technique, "GB")) || (!strcmp(non->technique, "SE")) || (!
-        strcmp(non->technique, "EA")) || (!strcmp(non->technique, "noEA"))) {
+        strcmp(non->technique, "EA")) || (!strcmp(non->technique, "noEA")) || (!strcmp(non->technique, "PumpProbe"))) {
         // Does support MPI
         calc_2DIR(non,parentRank, parentSize, subRank, subSize, subComm, rootComm);
     }
@@ -211,6 +225,7 @@ int main(int argc, char* argv[]) {
 
     // Clean up
     free(non->psites);
+    free(non->t2list);
     free(non);
 
     MPI_Comm_free(&subComm);
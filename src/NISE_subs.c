@@ -6,6 +6,9 @@
 #include <omp.h>
 #include "types.h"
 #include "NISE_subs.h"
+#include "workspace.h"
+#include "trajectory.h"
+#include "prefetch.h"
 #include "randomlib.h"
 #include "util/asprintf.h"
 
@@ -57,8 +60,9 @@ void matrix_on_vector(float *c,float *vr,float *vi,int N){
     float *xr;
     float *xi;
     int a,b;
-    xr = (float *)calloc(N * N, sizeof(float));
-    xi = (float *)calloc(N * N, sizeof(float));
+    t_wsmark mark = ws_mark();
+    xr = ws_calloc(N, sizeof(float));
+    xi = ws_calloc(N, sizeof(float));
     // Multiply
     for (a=0;a<N;a++){
         for (b=0;b<N;b++){
@@ -69,8 +73,7 @@ void matrix_on_vector(float *c,float *vr,float *vi,int N){
     // Copy back
     copyvec(xr,vr,N);
     copyvec(xi,vi,N);
-    free(xr);
-    free(xi);
+    ws_release(mark);
 }
 
 // Multiply transpose of a real matrix on a complex vector (vr,vi)
@@ -78,8 +81,9 @@ void trans_matrix_on_vector(float *c,float *vr,float *vi,int N){
     float *xr;
     float *xi;
     int a,b;
-    xr = (float *)calloc(N * N, sizeof(float));
-    xi = (float *)calloc(N * N, sizeof(float));
+    t_wsmark mark = ws_mark();
+    xr = ws_calloc(N, sizeof(float));
+    xi = ws_calloc(N, sizeof(float));
     // Multiply
     for (a=0;a<N;a++){
         for (b=0;b<N;b++){
@@ -90,8 +94,33 @@ void trans_matrix_on_vector(float *c,float *vr,float *vi,int N){
     // Copy back
     copyvec(xr,vr,N);
     copyvec(xi,vi,N);
-    free(xr);
-    free(xi);
+    ws_release(mark);
+}
+
+// Multiply a real matrix, or its transpose if trans="T", on a complex block of
+// n vectors stored as the columns of the N x n matrices (Xr,Xi)
+void matrix_on_block(char *trans,float *c,float *Xr,float *Xi,int n,int N){
+    float one=1,zero=0;
+    float *Y;
+    t_wsmark mark = ws_mark();
+    Y = ws_alloc(N * n, sizeof(float));
+    sgemm_(trans,"N",&N,&n,&N,&one,c,&N,Xr,&N,&zero,Y,&N);
+    copyvec(Y,Xr,N*n);
+    sgemm_(trans,"N",&N,&n,&N,&one,c,&N,Xi,&N,&zero,Y,&N);
+    copyvec(Y,Xi,N*n);
+    ws_release(mark);
+}
+
+// Copy n vectors of length N into the columns of the matrix X
+void pack_vecs(float **v,float *X,int n,int N){
+    int i;
+    for (i=0;i<n;i++) copyvec(v[i],X+i*N,N);
+}
+
+// Copy the columns of the matrix X back into n vectors of length N
+void unpack_vecs(float **v,float *X,int n,int N){
+    int i;
+    for (i=0;i<n;i++) copyvec(X+i*N,v[i],N);
 }
 
 /**
@@ -171,6 +200,21 @@ int Eindex(int a, int b, int N) {
     return ind;
 }
 
+// Number of waiting times of a 2D calculation, more than one for a t2 series
+int waitingTimes(t_non* non) {
+    return non->nt2 > 0 ? non->nt2 : 1;
+}
+
+// Waiting time number w in time steps
+int waitingTime(t_non* non, int w) {
+    return non->nt2 > 0 ? non->t2list[w] : non->tmax2;
+}
+
+// Number of t1 times of a 2D calculation on the grid of TimeIncrement
+int t1Points(t_non* non) {
+    return (non->tmax1 + non->dt1 - 1) / non->dt1;
+}
+
 /* Read Hamiltonian */
 int read_He(t_non* non, float* He, FILE* FH, int pos) {
     int i, N, control, t;
@@ -178,12 +222,11 @@ int read_He(t_non* non, float* He, FILE* FH, int pos) {
 
     /* Read only diagonal part */
     if (!strcmp(non->hamiltonian, "Coupling") && pos >= 0) {
-        H = (float *)calloc(non->singles, sizeof(float));
-        /* Find position */
-        fseek(FH, pos * (sizeof(int) + sizeof(float) * (non->singles)),SEEK_SET);
-
-        /* Read time */
-        control = fread(&t, sizeof(int), 1, FH); /* control=1; */
+        t_wsmark mark = ws_mark();
+        H = ws_alloc(non->singles, sizeof(float));
+        /* Read time and single excitation Hamiltonian */
+        control = traj_read(FH, pos * (sizeof(int) + sizeof(float) * (non->singles)), &t, H, sizeof(float),
+                            non->singles);
         if (control > non->length + non->begin * non->sample) {
             printf("Control character error in Hamiltonian file!\n");
             printf("Control character is '%d'.\n", control);
@@ -192,24 +235,21 @@ int read_He(t_non* non, float* He, FILE* FH, int pos) {
             exit(-1);
         }
 
-        /* Read single excitation Hamiltonian */
-        fread(H, sizeof(float), non->singles, FH);
-
         /* Shift center and update full Hamiltonian */
         for (i = 0; i < non->singles; i++) {
             He[i * non->singles + i - (i * (i + 1)) / 2] = H[i] - non->shifte;
         }
-        free(H);
+        ws_release(mark);
     }
     else {
         /* Read Full Hamiltonian */
         if (pos == -1) { pos = 0; }
+        /* Take the frame from the prefetch thread if it was read ahead */
+        if (prefetch_He(FH, pos, He)) return 1;
         N = non->singles * (non->singles + 1) / 2;
-        /* Find position */
-        fseek(FH, pos * (sizeof(int) + sizeof(float) * (non->singles * (non->singles + 1) / 2 +
-                  non->doubles * (non->doubles + 1) / 2)),SEEK_SET);
-        /* Read time */
-        control = fread(&t, sizeof(int), 1, FH); /* control=1; */
+        /* Read time and single excitation Hamiltonian */
+        control = traj_read(FH, pos * (sizeof(int) + sizeof(float) * (non->singles * (non->singles + 1) / 2 +
+                            non->doubles * (non->doubles + 1) / 2)), &t, He, sizeof(float), N);
         if (control > non->length + non->begin * non->sample) {
             printf("Control character error in Hamiltonian file!\n");
             printf("Control character is '%d'.\n", control);
@@ -217,8 +257,6 @@ int read_He(t_non* non, float* He, FILE* FH, int pos) {
             printf("Check that the numbers of singles and doubles is correct!\n");
             exit(-1);
         }
-        /* Read single excitation Hamiltonian */
-        fread(He, sizeof(float), N, FH);
         /* Shift center */
         for (i = 0; i < non->singles; i++) {
             He[i * non->singles + i - (i * (i + 1)) / 2] -= non->shifte;
@@ -233,10 +271,9 @@ int read_Dia(t_non* non, float* He, FILE* FH, int pos) {
     float* H;
     H = (float *)calloc(non->singles, sizeof(float));
     /* N=non->singles*(non->singles+1)/2; */
-    /* Find position */
-    fseek(FH, pos * (sizeof(int) + sizeof(float) * (non->singles)),SEEK_SET);
-    /* Read time */
-    control = fread(&t, sizeof(int), 1, FH); /* control=1; */
+    /* Read time and single excitation Hamiltonian */
+    control = traj_read(FH, pos * (sizeof(int) + sizeof(float) * (non->singles)), &t, H, sizeof(float),
+                        non->singles);
     if (control > non->length + non->begin * non->sample) {
         printf("Control character error in Hamiltonian file!\n");
         printf("Control character is '%d'.\n", control);
@@ -244,8 +281,6 @@ int read_Dia(t_non* non, float* He, FILE* FH, int pos) {
         printf("Check that the numbers of singles and doubles is correct!\n");
         exit(-1);
     }
-    /* Read single excitation Hamiltonian */
-    fread(H, sizeof(float), non->singles, FH);
     /* Shift center and update full Hamiltonian */
     for (i = 0; i < non->singles; i++) {
         He[i * non->singles + i - (i * (i + 1)) / 2] = H[i] - non->shifte;
@@ -258,12 +293,8 @@ int read_Dia(t_non* non, float* He, FILE* FH, int pos) {
 int read_A(t_non* non, float* Anh, FILE* FH, int pos) {
     int i, N, control, t;
     N = non->singles;
-    /* Find Position */
-    fseek(FH, pos * (sizeof(int) + sizeof(float) * non->singles),SEEK_SET);
-    /* Read time */
-    control = fread(&t, sizeof(int), 1, FH); // control=1;
-    /* Read single excitation Hamiltonian */
-    fread(Anh, sizeof(float), N, FH);
+    /* Read time and anharmonicities */
+    control = traj_read(FH, pos * (sizeof(int) + sizeof(float) * non->singles), &t, Anh, sizeof(float), N);
     return control;
 }
 
@@ -273,13 +304,11 @@ int read_mue(t_non* non, float* mue, FILE* FH, int pos, int x) {
     int t;
     int N;
     control = 0;
-    // Find position
-    fseek(FH, pos * (sizeof(int) + sizeof(float) * (3 * non->singles + 3 * non->singles * non->doubles)) + sizeof(float)
-          * x * non->singles,SEEK_SET);
-    /* Read time */
-    if (fread(&t, sizeof(int), 1, FH)) control = 1;
-    // Read single excitation Dipoles
-    fread(mue, sizeof(float), non->singles, FH);
+    // Take the frame from the prefetch thread if it was read ahead
+    if (prefetch_mue(FH, pos, x, mue)) return 1;
+    // Read time and single excitation Dipoles
+    if (traj_read(FH, pos * (sizeof(int) + sizeof(float) * (3 * non->singles + 3 * non->singles * non->doubles)) +
+                  sizeof(float) * x * non->singles, &t, mue, sizeof(float), non->singles)) control = 1;
     return control;
 }
 
@@ -289,15 +318,38 @@ int read_over(t_non* non, float* over, FILE* FH, int pos, int x) {
     int t;
     int N;
     control = 0;
-    // Find position
-    fseek(FH, pos * (sizeof(int) + sizeof(float) * (3 * non->singles)) + sizeof(float) * x * non->singles,SEEK_SET);
-    /* Read time */
-    if (fread(&t, sizeof(int), 1, FH)) control = 1;
-    // Read single excitation Dipoles
-    fread(over, sizeof(float), non->singles, FH);
+    // Read time and single excitation Dipoles
+    if (traj_read(FH, pos * (sizeof(int) + sizeof(float) * (3 * non->singles)) + sizeof(float) * x * non->singles,
+                  &t, over, sizeof(float), non->singles)) control = 1;
     return control;
 }
 
+// Size in bytes of one frame of the Hamiltonian trajectory
+size_t He_frame_bytes(t_non* non) {
+    if (!strcmp(non->hamiltonian, "Coupling")) {
+        return sizeof(int) + sizeof(float) * non->singles;
+    }
+    return sizeof(int) + sizeof(float) * (non->singles * (non->singles + 1) / 2 +
+           non->doubles * (non->doubles + 1) / 2);
+}
+
+// Size in bytes of one frame of the dipole trajectory
+size_t mue_frame_bytes(t_non* non) {
+    return sizeof(int) + sizeof(float) * (3 * non->singles + 3 * non->singles * non->doubles);
+}
+
+// Hint that frames pos to pos+count-1 of the Hamiltonian and dipole
+// trajectories will be read soon
+void read_ahead(t_non* non, FILE* H_traj, FILE* mu_traj, int pos, int count) {
+    if (pos < 0) {
+        count += pos;
+        pos = 0;
+    }
+    if (count <= 0) return;
+    if (H_traj != NULL) traj_advise(H_traj, pos * He_frame_bytes(non), count * He_frame_bytes(non));
+    if (mu_traj != NULL) traj_advise(mu_traj, pos * mue_frame_bytes(non), count * mue_frame_bytes(non));
+}
+
 // Read transition dipole 
 void muread(t_non* non, float* leftnr, int ti, int x, FILE* mu_traj) {
     /* Read mu(ti) */
@@ -331,12 +383,8 @@ int read_cluster(t_non* non, int pos, int* cl, FILE* FH) {
     int t;
     int N;
     control = 0;
-    // Find position
-    fseek(FH, pos * (sizeof(int) + sizeof(int)),SEEK_SET);
-    /* Read time */
-    if (fread(&t, sizeof(int), 1, FH)) control = 1;
-    // Read single excitation Dipoles
-    fread(cl, sizeof(int), 1, FH);
+    // Read time and cluster
+    if (traj_read(FH, pos * (sizeof(int) + sizeof(int)), &t, cl, sizeof(int), 1)) control = 1;
     //  printf("%d %d %d\n",pos,t,cl);
     return control;
 }
@@ -353,14 +401,15 @@ void propagate_vec_DIA(t_non* non, float* Hamiltonian_i, float* cr, float* ci, i
     int a, b, c;
     N = non->singles;
     f = non->deltat * icm2ifs * twoPi * sign;
-    H = (float *)calloc(N * N, sizeof(float));
-    re_U = (float *)calloc(N, sizeof(float));
-    im_U = (float *)calloc(N, sizeof(float));
-    e = (float *)calloc(N, sizeof(float));
-    cnr = (float *)calloc(N * N, sizeof(float));
-    cni = (float *)calloc(N * N, sizeof(float));
-    crr = (float *)calloc(N * N, sizeof(float));
-    cri = (float *)calloc(N * N, sizeof(float));
+    t_wsmark mark = ws_mark();
+    H = ws_alloc(N * N, sizeof(float));
+    re_U = ws_alloc(N, sizeof(float));
+    im_U = ws_alloc(N, sizeof(float));
+    e = ws_alloc(N, sizeof(float));
+    cnr = ws_calloc(N * N, sizeof(float));
+    cni = ws_calloc(N * N, sizeof(float));
+    crr = ws_calloc(N * N, sizeof(float));
+    cri = ws_calloc(N * N, sizeof(float));
     // Build Hamiltonian
     for (a = 0; a < N; a++) {
         H[a + N * a] = Hamiltonian_i[a + N * a - (a * (a + 1)) / 2]; // Diagonal
@@ -409,27 +458,51 @@ void propagate_vec_DIA(t_non* non, float* Hamiltonian_i, float* cr, float* ci, i
     }
 
 
-    free(cnr), free(cni), free(re_U), free(im_U), free(H), free(e);
-    free(crr), free(cri);
+    ws_release(mark);
     return;
 }
 
 // Do the propagation for t2 using the matrix exponent and using a single diagonalization
 // for all vectors
 void propagate_t2_DIA(t_non *non,float *Hamiltonian_i,float *cr,float *ci,float **vr,float **vi,int sign){
+    int N, n;
+    float *Xr, *Xi;
+    N = non->singles;
+    n = t1Points(non) + 1;
+    t_wsmark mark = ws_mark();
+    Xr = ws_alloc(N * n, sizeof(float));
+    Xi = ws_alloc(N * n, sizeof(float));
+
+    // Collect the single t1 independent vector and all the t1 dependent vectors
+    copyvec(cr, Xr, N), copyvec(ci, Xi, N);
+    pack_vecs(vr, Xr + N, n - 1, N);
+    pack_vecs(vi, Xi + N, n - 1, N);
+
+    propagate_block_DIA(non, Hamiltonian_i, Xr, Xi, n, sign);
+
+    copyvec(Xr, cr, N), copyvec(Xi, ci, N);
+    unpack_vecs(vr, Xr + N, n - 1, N);
+    unpack_vecs(vi, Xi + N, n - 1, N);
+    ws_release(mark);
+    return;
+}
+
+// Propagate a block of n vectors stored as the columns of the N x n matrix (Xr,Xi)
+// with the matrix exponent using a single diagonalization. The transformations to
+// and from the eigen basis are done as matrix-matrix multiplications
+void propagate_block_DIA(t_non *non,float *Hamiltonian_i,float *Xr,float *Xi,int n,int sign){
     float f;
-    int index, N;
+    int N, v;
     float *H, *re_U, *im_U, *e;
-    float re, im;
-    int a, b, c;
-    int t1;
+    int a, b;
     N = non->singles;
     f = non->deltat * icm2ifs * twoPi * sign;
-    H = (float *)calloc(N * N, sizeof(float));
-    re_U = (float *)calloc(N, sizeof(float));
-    im_U = (float *)calloc(N, sizeof(float));
-    e = (float *)calloc(N, sizeof(float));
-   
+    t_wsmark mark = ws_mark();
+    H = ws_alloc(N * N, sizeof(float));
+    re_U = ws_alloc(N, sizeof(float));
+    im_U = ws_alloc(N, sizeof(float));
+    e = ws_alloc(N, sizeof(float));
+
     // Build Hamiltonian
     for (a = 0; a < N; a++) {
         H[a + N * a] = Hamiltonian_i[a + N * a - (a * (a + 1)) / 2]; // Diagonal
@@ -446,51 +519,59 @@ void propagate_t2_DIA(t_non *non,float *Hamiltonian_i,float *cr,float *ci,float
         im_U[a] = -sin(e[a] * f);
     }
 
-    // Do the single t1 independent vector
     // Transfer to eigen basis
-    matrix_on_vector(H,cr,ci,N);
+    matrix_on_block("N", H, Xr, Xi, n, N);
     // Multiply with matrix exponent
-    vector_on_vector(re_U,im_U,cr,ci,N);
-    // Transfer back to site basis
-    trans_matrix_on_vector(H,cr,ci,N);
-
-    // Do all the t1 dependent vectors
-#pragma omp parallel for shared(non,re_U,im_U,H,vr,vi) schedule(static,1)
-    for (t1=0;t1<non->tmax1;t1++){
-        // Transfer to eigen basis
-        matrix_on_vector(H,vr[t1],vi[t1],N);
-        // Multiply with matrix exponent
-        vector_on_vector(re_U,im_U,vr[t1],vi[t1],N);
-        // Transfer back to site basis
-        trans_matrix_on_vector(H,vr[t1],vi[t1],N);
+    for (v = 0; v < n; v++) {
+        vector_on_vector(re_U, im_U, Xr + v * N, Xi + v * N, N);
     }
+    // Transfer back to site basis
+    matrix_on_block("T", H, Xr, Xi, n, N);
 
-    free(re_U), free(im_U), free(H), free(e);
+    ws_release(mark);
     return;
 }
 
 // Propagate using matrix exponential sparce
 int propagate_vec_DIA_S(t_non* non, float* Hamiltonian_i, float* cr, float* ci, int sign) {
+    return propagate_vecs_DIA_S(non, Hamiltonian_i, &cr, &ci, 1, sign);
+}
+
+// Propagate n vectors using matrix exponential sparce, the propagator is
+// constructed once and applied to all vectors
+int propagate_vecs_DIA_S(t_non* non, float* Hamiltonian_i, float** vr, float** vi, int n, int sign) {
     int elements;
+    int N2 = non->singles * non->singles;
+    t_wsmark mark = ws_mark();
+    float* Ur = ws_alloc(N2, sizeof(float));
+    float* Ui = ws_alloc(N2, sizeof(float));
+
+    elements = propagator_DIA_S(non, Hamiltonian_i, Ur, Ui, sign);
+    propagate_vecs_U(non, Ur, Ui, vr, vi, n, 1);
+
+    ws_release(mark);
+    return elements;
+}
+
+// Construct the one exciton propagator U=exp(-i/h H dt) with the matrix exponential
+void propagator_DIA(t_non* non, float* Hamiltonian_i, float* crr, float* cri, int sign) {
     float f;
-    int index, N, N2;
+    int N, N2;
     float *H, *re_U, *im_U, *e;
     float *cnr, *cni;
-    float *crr, *cri;
-    float re, im;
-    int a, b, c;
+    float one = 1, zero = 0;
+    int a, b;
 
     N = non->singles;
     N2 = N * N;
     f = non->deltat * icm2ifs * twoPi * sign;
-    H = (float *)calloc(N2, sizeof(float));
-    re_U = (float *)calloc(N, sizeof(float));
-    im_U = (float *)calloc(N, sizeof(float));
-    e = (float *)calloc(N, sizeof(float));
-    cnr = (float *)calloc(N2, sizeof(float));
-    cni = (float *)calloc(N2, sizeof(float));
-    crr = (float *)calloc(N2, sizeof(float));
-    cri = (float *)calloc(N2, sizeof(float));
+    t_wsmark mark = ws_mark();
+    H = ws_alloc(N2, sizeof(float));
+    re_U = ws_alloc(N, sizeof(float));
+    im_U = ws_alloc(N, sizeof(float));
+    e = ws_alloc(N, sizeof(float));
+    cnr = ws_alloc(N2, sizeof(float));
+    cni = ws_alloc(N2, sizeof(float));
 
     // Build Hamiltonian
     for (a = 0; a < N; a++) {
@@ -507,41 +588,89 @@ int propagate_vec_DIA_S(t_non* non, float* Hamiltonian_i, float* cr, float* ci,
         im_U[a] = -sin(e[a] * f);
     }
 
-    // Transform to site basis
+    // Transform to site basis, the eigenvectors are the rows of H
     for (a = 0; a < N; a++) {
         for (b = 0; b < N; b++) {
             cnr[b + a * N] = H[b + a * N] * re_U[b], cni[b + a * N] = H[b + a * N] * im_U[b];
         }
     }
-    for (a = 0; a < N; a++) {
-        for (c = 0; c < N; c++) {
-            crr[a + c * N] = 0, cri[a + c * N] = 0;
-            for (b = 0; b < N; b++) {
-                crr[a + c * N] += H[b + a * N] * cnr[b + c * N], cri[a + c * N] += H[b + a * N] * cni[b + c * N];
-            }
-        }
-    }
+    sgemm_("T", "N", &N, &N, &N, &one, H, &N, cnr, &N, &zero, crr, &N);
+    sgemm_("T", "N", &N, &N, &N, &one, H, &N, cni, &N, &zero, cri, &N);
     // The one exciton propagator has been calculated
 
+    ws_release(mark);
+}
+
+// Construct the one exciton propagator U=exp(-i/h H dt) with the matrix exponential.
+// Elements with a squared norm below the threshold are set to zero.
+// Returns the number of elements kept
+int propagator_DIA_S(t_non* non, float* Hamiltonian_i, float* crr, float* cri, int sign) {
+    int elements, a;
+    int N2 = non->singles * non->singles;
+
+    propagator_DIA(non, Hamiltonian_i, crr, cri, sign);
+    // Truncate
     elements = 0;
-    for (a = 0; a < N; a++) {
-        cnr[a] = 0, cni[a] = 0;
-        for (b = 0; b < N; b++) {
-            if ((crr[a + b * N] * crr[a + b * N] + cri[a + b * N] * cri[a + b * N]) > non->thres) {
-                elements++;
-                cnr[a] += crr[a + b * N] * cr[b] - cri[a + b * N] * ci[b];
-                cni[a] += crr[a + b * N] * ci[b] + cri[a + b * N] * cr[b];
-            }
+    for (a = 0; a < N2; a++) {
+        if ((crr[a] * crr[a] + cri[a] * cri[a]) > non->thres) {
+            elements++;
+        } else {
+            crr[a] = 0, cri[a] = 0;
         }
     }
+    return elements;
+}
 
-    for (a = 0; a < N; a++) {
-        cr[a] = cnr[a], ci[a] = cni[a];
-    }
+// Apply a one exciton propagator to n vectors. With sign=-1 the complex
+// conjugate of the propagator is applied, which for a real symmetric
+// Hamiltonian is the propagator backward in time
+void propagate_vecs_U(t_non* non, float* Ur, float* Ui, float** vr, float** vi, int n, int sign) {
+    int N = non->singles;
+    t_wsmark mark = ws_mark();
+    float* Xr = ws_alloc(N * n, sizeof(float));
+    float* Xi = ws_alloc(N * n, sizeof(float));
+
+    pack_vecs(vr, Xr, n, N), pack_vecs(vi, Xi, n, N);
+    propagate_block_U(non, Ur, Ui, Xr, Xi, n, sign);
+    unpack_vecs(vr, Xr, n, N), unpack_vecs(vi, Xi, n, N);
+    ws_release(mark);
+}
+
+// Apply a one exciton propagator to the columns of the N x n matrix (Xr,Xi)
+// as matrix-matrix multiplications. With sign=-1 the complex conjugate of the
+// propagator is applied
+void propagate_block_U(t_non* non, float* Ur, float* Ui, float* Xr, float* Xi, int n, int sign) {
+    int N = non->singles;
+    float one = 1, zero = 0, s = sign;
+    float mins = -s;
+    t_wsmark mark = ws_mark();
+    float* Yr = ws_alloc(N * n, sizeof(float));
+    float* Yi = ws_alloc(N * n, sizeof(float));
+
+    // Yr = Ur Xr - sign Ui Xi
+    sgemm_("N", "N", &N, &n, &N, &one, Ur, &N, Xr, &N, &zero, Yr, &N);
+    sgemm_("N", "N", &N, &n, &N, &mins, Ui, &N, Xi, &N, &one, Yr, &N);
+    // Yi = Ur Xi + sign Ui Xr
+    sgemm_("N", "N", &N, &n, &N, &one, Ur, &N, Xi, &N, &zero, Yi, &N);
+    sgemm_("N", "N", &N, &n, &N, &s, Ui, &N, Xr, &N, &one, Yi, &N);
+
+    copyvec(Yr, Xr, N * n), copyvec(Yi, Xi, N * n);
+    ws_release(mark);
+}
+
+// Propagate the columns of the N x n matrix (Xr,Xi) using the truncated matrix
+// exponential with one diagonalization for all columns
+int propagate_block_DIA_S(t_non* non, float* Hamiltonian_i, float* Xr, float* Xi, int n, int sign) {
+    int elements;
+    int N2 = non->singles * non->singles;
+    t_wsmark mark = ws_mark();
+    float* Ur = ws_alloc(N2, sizeof(float));
+    float* Ui = ws_alloc(N2, sizeof(float));
 
-    free(crr), free(cri);
-    free(cnr), free(cni), free(re_U), free(im_U), free(H), free(e);
+    elements = propagator_DIA_S(non, Hamiltonian_i, Ur, Ui, sign);
+    propagate_block_U(non, Ur, Ui, Xr, Xi, n, 1);
 
+    ws_release(mark);
     return elements;
 }
 
@@ -561,14 +690,15 @@ void propagate_vec_coupling_S(t_non* non, float* Hamiltonian_i, float* cr, float
 
     N = non->singles;
     f = non->deltat * icm2ifs * twoPi * sign / m;
-    H0 = (float *)calloc(N, sizeof(float));
-    H1 = (float *)calloc(N * N, sizeof(float));
-    col = (int *)calloc(N * N / 2, sizeof(int));
-    row = (int *)calloc(N * N / 2, sizeof(int));
-    re_U = (float *)calloc(N, sizeof(float));
-    im_U = (float *)calloc(N, sizeof(float));
-    ocr = (float *)calloc(N, sizeof(float));
-    oci = (float *)calloc(N, sizeof(float));
+    t_wsmark mark = ws_mark();
+    H0 = ws_alloc(N, sizeof(float));
+    H1 = ws_alloc(N * N, sizeof(float));
+    col = ws_alloc(N * N / 2, sizeof(int));
+    row = ws_alloc(N * N / 2, sizeof(int));
+    re_U = ws_alloc(N, sizeof(float));
+    im_U = ws_alloc(N, sizeof(float));
+    ocr = ws_alloc(N, sizeof(float));
+    oci = ws_alloc(N, sizeof(float));
     //  Norm=(float *)calloc(N,sizeof(float));
 
     // Build Hamiltonians H0 (diagonal) and H1 (coupling)
@@ -629,8 +759,7 @@ void propagate_vec_coupling_S(t_non* non, float* Hamiltonian_i, float* cr, float
     //}
     //  printf("N3 %f\n",nm);
 
-    free(ocr), free(oci), free(re_U), free(im_U), free(H1), free(H0);
-    free(col), free(row);
+    ws_release(mark);
 }
 
 /* Propagate doubles using diagonal vs. coupling sparce algorithm */
@@ -638,14 +767,15 @@ void propagate_vec_coupling_S_doubles(t_non* non, float* Hamiltonian_i, float* c
     int N = non->singles;
     int N2 = N * (N + 1) / 2;
     const float f = non->deltat * icm2ifs * twoPi / m;
-    float* H0 = calloc(N2, sizeof(float));
-    float* H1 = calloc(N * N / 2, sizeof(float));
-    int* col = calloc(N * N / 2, sizeof(int));
-    int* row = calloc(N * N / 2, sizeof(int));
-    float* re_U = calloc(N2, sizeof(float));
-    float* im_U = calloc(N2, sizeof(float));
-    float* ocr = calloc(N2, sizeof(float));
-    float* oci = calloc(N2, sizeof(float));
+    t_wsmark mark = ws_mark();
+    float* H0 = ws_alloc(N2, sizeof(float));
+    float* H1 = ws_alloc(N * N / 2, sizeof(float));
+    int* col = ws_alloc(N * N / 2, sizeof(int));
+    int* row = ws_alloc(N * N / 2, sizeof(int));
+    float* re_U = ws_alloc(N2, sizeof(float));
+    float* im_U = ws_alloc(N2, sizeof(float));
+    float* ocr = ws_alloc(N2, sizeof(float));
+    float* oci = ws_alloc(N2, sizeof(float));
 
     /* Build Hamiltonians H0 (diagonal) and H1 (coupling) */
     for (int a = 0; a < N; a++) {
@@ -720,8 +850,7 @@ void propagate_vec_coupling_S_doubles(t_non* non, float* Hamiltonian_i, float* c
             ci[a] = ocr[a] * im_U[a] + oci[a] * re_U[a];
         }
     }
-    free(ocr), free(oci), free(re_U), free(im_U), free(H1), free(H0);
-    free(col), free(row);
+    ws_release(mark);
 }
 
 /* Propagate doubles using diagonal vs. coupling sparce algorithm */
@@ -730,14 +859,15 @@ void propagate_vec_coupling_S_doubles_ES(t_non* non, float* Hamiltonian_i, float
     int N2 = N * (N + 1) / 2;
     int N2old= N * ( N + 1 ) / 2;
     const float f = non->deltat * icm2ifs * twoPi / m;
-    float* H0 = calloc(N2, sizeof(float));
-    float* H1 = calloc(N * N / 2, sizeof(float));
-    int* col = calloc(N * N / 2, sizeof(int));
-    int* row = calloc(N * N / 2, sizeof(int));
-    float* re_U = calloc(N2, sizeof(float));
-    float* im_U = calloc(N2, sizeof(float));
-    float* ocr = calloc(N2, sizeof(float));
-    float* oci = calloc(N2, sizeof(float));
+    t_wsmark mark = ws_mark();
+    float* H0 = ws_alloc(N2, sizeof(float));
+    float* H1 = ws_alloc(N * N / 2, sizeof(float));
+    int* col = ws_alloc(N * N / 2, sizeof(int));
+    int* row = ws_alloc(N * N / 2, sizeof(int));
+    float* re_U = ws_alloc(N2, sizeof(float));
+    float* im_U = ws_alloc(N2, sizeof(float));
+    float* ocr = ws_alloc(N2, sizeof(float));
+    float* oci = ws_alloc(N2, sizeof(float));
 
     /* Build Hamiltonians H0 (diagonal) and H1 (coupling) */
     for (int a = 0; a < N; a++) {
@@ -810,8 +940,7 @@ void propagate_vec_coupling_S_doubles_ES(t_non* non, float* Hamiltonian_i, float
         }
     }
     
-    free(ocr), free(oci), free(re_U), free(im_U), free(H1), free(H0);
-    free(col), free(row);
+    ws_release(mark);
 }
 
 
@@ -821,16 +950,16 @@ void diagonalizeLPD(float* H, float* v, int N) {
     int INFO, lwork;
     float *work, *Hcopy;
     int i, j;
+    float query;
+    t_wsmark mark = ws_mark();
     // Find lwork;
     lwork = -1;
-    work = (float *)calloc(1, sizeof(float));
-    ssyev_("V", "U", &N, Hcopy, &N, v, work, &lwork, &INFO);
-    lwork = work[0];
+    Hcopy = ws_alloc(N * N, sizeof(float));
+    ssyev_("V", "U", &N, Hcopy, &N, v, &query, &lwork, &INFO);
+    lwork = query;
     //  printf("LAPACK work dimension %d\n",lwork);
     //  lwork=8*N;
-    free(work);
-    work = (float *)calloc(lwork, sizeof(float));
-    Hcopy = (float *)calloc(N * N, sizeof(float));
+    work = ws_alloc(lwork, sizeof(float));
     // Copy Hamiltonian
     for (i = 0; i < N; i++) {
         for (j = 0; j < N; j++) {
@@ -853,7 +982,7 @@ void diagonalizeLPD(float* H, float* v, int N) {
         }
     }
     // Free space
-    free(Hcopy), free(work);
+    ws_release(mark);
     return;
 }
 
@@ -989,7 +1118,7 @@ int control(t_non* non) {
     }
     free(mu_eg);
     free(Hamil_i_e);
-    fclose(mu_traj), fclose(H_traj);
+    traj_fclose(mu_traj), traj_fclose(H_traj);
     return 0;
 }
 
@@ -1094,14 +1223,15 @@ int time_evolution_mat(t_non* non, float* Hamiltonian_i, float* Ur, float* Ui, i
     int elements;
     N = non->singles;
     f = non->deltat * icm2ifs * twoPi / m;
-    H = (float *)calloc(N * N, sizeof(float));
-    cr = (float *)calloc(N * N, sizeof(float));
-    ci = (float *)calloc(N * N, sizeof(float));
-    re_U = (float *)calloc(N, sizeof(float));
-    im_U = (float *)calloc(N, sizeof(float));
-    e = (float *)calloc(N, sizeof(float));
-    cnr = (float *)calloc(N * N, sizeof(float));
-    cni = (float *)calloc(N * N, sizeof(float));
+    t_wsmark mark = ws_mark();
+    H = ws_alloc(N * N, sizeof(float));
+    cr = ws_calloc(N * N, sizeof(float));
+    ci = ws_calloc(N * N, sizeof(float));
+    re_U = ws_alloc(N, sizeof(float));
+    im_U = ws_alloc(N, sizeof(float));
+    e = ws_alloc(N, sizeof(float));
+    cnr = ws_calloc(N * N, sizeof(float));
+    cni = ws_calloc(N * N, sizeof(float));
     /* Build Hamiltonian */
     for (a = 0; a < N; a++) {
         H[a + N * a] = Hamiltonian_i[a + N * a - (a * (a + 1)) / 2]; // Diagonal
@@ -1141,7 +1271,7 @@ int time_evolution_mat(t_non* non, float* Hamiltonian_i, float* Ur, float* Ui, i
             }
         }
     }
-    free(H), free(cr), free(ci), free(re_U), free(im_U), free(e), free(cnr), free(cni);
+    ws_release(mark);
     return elements;
 }
 
@@ -1163,10 +1293,11 @@ void propagate_double_sparce(t_non* non, float* Ur, float* Ui, int* R, int* C, f
     fm = f * 0.5 / m;
     N = non->singles;
     Nf = non->singles * (non->singles + 1) / 2;
-    vr = (float *)calloc(Nf, sizeof(float));
-    vi = (float *)calloc(Nf, sizeof(float));
-    co = (float *)calloc(N, sizeof(float));
-    si = (float *)calloc(N, sizeof(float));
+    t_wsmark mark = ws_mark();
+    vr = ws_alloc(Nf, sizeof(float));
+    vi = ws_alloc(Nf, sizeof(float));
+    co = ws_alloc(N, sizeof(float));
+    si = ws_alloc(N, sizeof(float));
 
     if (non->anharmonicity != 0) {
         for (i = 0; i < N; i++) {
@@ -1231,10 +1362,7 @@ void propagate_double_sparce(t_non* non, float* Ur, float* Ui, int* R, int* C, f
             fi[indexA] = co[a] * vi[indexA] + si[a] * vr[indexA];
         }
     }
-    free(si);
-    free(co);
-    free(vr);
-    free(vi);
+    ws_release(mark);
 }
 
 void propagate_double_sparce_ES(t_non* non, float* Ur, float* Ui, int* R, int* C, float* fr, float* fi, int elements,int m) {
@@ -1253,8 +1381,9 @@ void propagate_double_sparce_ES(t_non* non, float* Ur, float* Ui, int* R, int* C
     fm = f * 0.5 / m;
     N = non->singles;
     Nf = non->singles * (non->singles + 1) / 2;
-    vr = (float *)calloc(Nf, sizeof(float));
-    vi = (float *)calloc(Nf, sizeof(float));
+    t_wsmark mark = ws_mark();
+    vr = ws_alloc(Nf, sizeof(float));
+    vi = ws_alloc(Nf, sizeof(float));
 
         /* Repeat m times */
     for (i = 0; i < m; i++) {
@@ -1309,6 +1438,129 @@ void propagate_double_sparce_ES(t_non* non, float* Ur, float* Ui, int* R, int* C
             fi[indexA] = vi[indexA] ;
         }
     }
-    free(vr);
-    free(vi);
+    ws_release(mark);
+}
+
+// Expand the sparse one exciton propagator from time_evolution_mat to the full
+// N x N matrices (Udr,Udi)
+void propagator_dense(t_non* non, float* Ur, float* Ui, int* R, int* C, int elements, float* Udr, float* Udi) {
+    int N = non->singles;
+    int k;
+    clearvec(Udr, N * N), clearvec(Udi, N * N);
+    for (k = 0; k < elements; k++) {
+        Udr[R[k] + C[k] * N] = Ur[k];
+        Udi[R[k] + C[k] * N] = Ui[k];
+    }
+}
+
+// Propagate n two exciton vectors m times with the one exciton propagator
+// (Ur,Ui) of the time step dt/m. A two exciton vector is the symmetric matrix F
+// with F_ab=f_ab/sqrt2 for a!=b and F_aa=f_aa, which evolves as U F U^T. This
+// needs four matrix products for a block of vectors instead of the double loop
+// over the elements in propagate_double_sparce. The anharmonic phases of the
+// doubly excited sites are split around the harmonic step in the same way.
+// Without Anh the states are hard-core bosons as in propagate_double_sparce_ES,
+// only the pairs of different sites are kept and the diagonal stays empty.
+void propagate_doubles_U(t_non* non, float* Ur, float* Ui, float** fr, float** fi, int n, int m, float* Anh) {
+    int N = non->singles;
+    int N2 = N * N;
+    int chunk, nchunks, k;
+    float fm = non->deltat * icm2ifs * twoPi * 0.5 / m;
+    float *co, *si;
+    t_wsmark mark;
+
+    if (n <= 0) return;
+    // Anharmonic phases
+    mark = ws_mark();
+    co = ws_calloc(N, sizeof(float));
+    si = ws_calloc(N, sizeof(float));
+    if (Anh != NULL) {
+        for (k = 0; k < N; k++) {
+            float A = non->anharmonicity != 0 ? non->anharmonicity : Anh[k];
+            co[k] = cos(fm * A), si[k] = sin(fm * A);
+        }
+    }
+
+    // Blocks of vectors of at most WS_DOUBLES_BLOCK floats, at least one for every thread
+    chunk = WS_DOUBLES_BLOCK / (2 * N2);
+    if (chunk < 1) chunk = 1;
+    if (chunk * omp_get_max_threads() > n) chunk = (n + omp_get_max_threads() - 1) / omp_get_max_threads();
+    nchunks = (n + chunk - 1) / chunk;
+
+    #pragma omp parallel for schedule(dynamic)
+    for (k = 0; k < nchunks; k++) {
+        int first = k * chunk;
+        int c = first + chunk < n ? chunk : n - first;
+        int w = 2 * c * N; // Real parts of the vectors followed by the imaginary parts
+        int i, v, a, b, index;
+        float one = 1, zero = 0, r, s;
+        t_wsmark block = ws_mark();
+        float* X = ws_alloc((size_t) N * w, sizeof(float));
+        float* P = ws_alloc((size_t) N * w, sizeof(float));
+        float* Q = ws_alloc((size_t) N * w, sizeof(float));
+
+        for (i = 0; i < m; i++) {
+            for (v = first; v < first + c; v++) {
+                float* Fr = X + (v - first) * N2;
+                float* Fi = X + (c + v - first) * N2;
+                // Anharmonicity
+                for (a = 0; a < N && Anh != NULL; a++) {
+                    index = Sindex(a, a, N);
+                    r = fr[v][index], s = fi[v][index];
+                    fr[v][index] = co[a] * r - si[a] * s;
+                    fi[v][index] = co[a] * s + si[a] * r;
+                }
+                // Matrix form
+                for (a = 0; a < N; a++) {
+                    Fr[a + a * N] = Anh != NULL ? fr[v][Sindex(a, a, N)] : 0;
+                    Fi[a + a * N] = Anh != NULL ? fi[v][Sindex(a, a, N)] : 0;
+                    for (b = a + 1; b < N; b++) {
+                        index = Sindex(a, b, N);
+                        Fr[a + b * N] = Fr[b + a * N] = fr[v][index] / sqrt2;
+                        Fi[a + b * N] = Fi[b + a * N] = fi[v][index] / sqrt2;
+                    }
+                }
+            }
+
+            // T=U F stored transposed in X, then U T^T = U F U^T
+            for (int pass = 0; pass < 2; pass++) {
+                sgemm_("N", "N", &N, &w, &N, &one, Ur, &N, X, &N, &zero, P, &N);
+                sgemm_("N", "N", &N, &w, &N, &one, Ui, &N, X, &N, &zero, Q, &N);
+                for (v = 0; v < c; v++) {
+                    float *Pr = P + v * N2, *Pi = P + (c + v) * N2;
+                    float *Qr = Q + v * N2, *Qi = Q + (c + v) * N2;
+                    for (a = 0; a < N; a++) {
+                        for (b = 0; b < N; b++) {
+                            X[b + a * N + v * N2] = Pr[a + b * N] - Qi[a + b * N];
+                            X[b + a * N + (c + v) * N2] = Pi[a + b * N] + Qr[a + b * N];
+                        }
+                    }
+                }
+            }
+
+            for (v = first; v < first + c; v++) {
+                float* Fr = X + (v - first) * N2;
+                float* Fi = X + (c + v - first) * N2;
+                for (a = 0; a < N; a++) {
+                    index = Sindex(a, a, N);
+                    fr[v][index] = Anh != NULL ? Fr[a + a * N] : 0;
+                    fi[v][index] = Anh != NULL ? Fi[a + a * N] : 0;
+                    for (b = a + 1; b < N; b++) {
+                        index = Sindex(a, b, N);
+                        fr[v][index] = Fr[b + a * N] * sqrt2;
+                        fi[v][index] = Fi[b + a * N] * sqrt2;
+                    }
+                }
+                // Anharmonicity
+                for (a = 0; a < N && Anh != NULL; a++) {
+                    index = Sindex(a, a, N);
+                    r = fr[v][index], s = fi[v][index];
+                    fr[v][index] = co[a] * r - si[a] * s;
+                    fi[v][index] = co[a] * s + si[a] * r;
+                }
+            }
+        }
+        ws_release(block);
+    }
+    ws_release(mark);
 }
@@ -9,23 +9,39 @@ void clearvec(float *a,int N);
 void vector_on_vector(float *rr,float *ir,float *vr,float *vi,int N);
 void matrix_on_vector(float *c,float *vr,float *vi,int N);
 void trans_matrix_on_vector(float *c,float *vr,float *vi,int N);
+void matrix_on_block(char *trans,float *c,float *Xr,float *Xi,int n,int N);
+void pack_vecs(float **v,float *X,int n,int N);
+void unpack_vecs(float **v,float *X,int n,int N);
 void log_item(char* msgFormat, ...);
 time_t set_time(time_t t0);
 time_t log_time(time_t t0,FILE *log);
 char* time_diff(time_t t0, time_t t1);
 char* MPI_time(double t0);
 int Eindex(int a,int b,int N);
+int waitingTimes(t_non *non);
+int waitingTime(t_non *non,int w);
+int t1Points(t_non *non);
 int read_He(t_non *non,float *He,FILE *FH,int pos);
 int read_Dia(t_non *non,float *He,FILE *FE,int pos);
 int read_A(t_non *non,float *Anh,FILE *FH,int pos);
 int read_mue(t_non *non,float *mue,FILE *FH,int pos,int x);
 int read_over(t_non *non,float *over,FILE *FH,int pos,int x);
+size_t He_frame_bytes(t_non *non);
+size_t mue_frame_bytes(t_non *non);
+void read_ahead(t_non *non,FILE *H_traj,FILE *mu_traj,int pos,int count);
 void muread(t_non *non,float *leftnr,int ti,int x,FILE *mu_traj);
 void mureadE(t_non *non,float *leftnr,int ti,int x,FILE *mu_traj,float *mu,float *pol);
 int read_cluster(t_non *non,int pos,int *cl,FILE *FH);
 void propagate_vec_DIA(t_non *non,float *Hamiltonian_i,float *cr,float *ci,int sign);
 void propagate_t2_DIA(t_non *non,float *Hamiltonian_i,float *cr,float *ci,float **vr,float **vi,int sign);
+void propagate_block_DIA(t_non *non,float *Hamiltonian_i,float *Xr,float *Xi,int n,int sign);
 int propagate_vec_DIA_S(t_non *non,float *Hamiltonian_i,float *cr,float *ci,int sign);
+int propagate_vecs_DIA_S(t_non *non,float *Hamiltonian_i,float **vr,float **vi,int n,int sign);
+void propagator_DIA(t_non *non,float *Hamiltonian_i,float *Ur,float *Ui,int sign);
+int propagator_DIA_S(t_non *non,float *Hamiltonian_i,float *Ur,float *Ui,int sign);
+void propagate_vecs_U(t_non *non,float *Ur,float *Ui,float **vr,float **vi,int n,int sign);
+void propagate_block_U(t_non *non,float *Ur,float *Ui,float *Xr,float *Xi,int n,int sign);
+int propagate_block_DIA_S(t_non *non,float *Hamiltonian_i,float *Xr,float *Xi,int n,int sign);
 void propagate_vec_coupling_S(t_non *non,float *Hamiltonian_i,float *cr,float *ci,int m,int sign);
 void propagate_vec_coupling_S_doubles(t_non *non,float *Hamiltonian_i,float *cr,float 
 *ci,int m,float *Anh);
@@ -42,6 +58,8 @@ void dipole_double_last_ES(t_non *non,float *dipole,float *cr,float *ci,float *f
 int time_evolution_mat(t_non *non,float *Hamiltonian_i,float *Ur,float *Ui,int *R,int *C,int m);
 void propagate_double_sparce(t_non *non,float *Ur,float *Ui,int *R,int *C,float *fr,float *fi,int elements,int m,float *Anh);
 void propagate_double_sparce_ES(t_non *non,float *Ur,float *Ui,int *R,int *C,float *fr,float *fi,int elements,int m);
+void propagator_dense(t_non *non,float *Ur,float *Ui,int *R,int *C,int elements,float *Udr,float *Udi);
+void propagate_doubles_U(t_non *non,float *Ur,float *Ui,float **fr,float **fi,int n,int m,float *Anh);
 
 // Index triangular matrix
 // Put in the .h file to allow external referencing
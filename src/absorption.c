@@ -4,19 +4,39 @@
 #include <string.h>
 #include <time.h>
 #include <fftw3.h>
+#include <mpi.h>
 #include "omp.h"
 #include "types.h"
 #include "NISE_subs.h"
+#include "trajectory.h"
+#include "linear.h"
 #include "absorption.h"
 #include "1DFFT.h"
 
-void absorption(t_non *non){
+// Frame data for the linear absorption: the transition dipoles are both the
+// initial vectors and, projected on the selected sites, the final vectors
+void absorption_frame(t_non *non,void *data,int frame,float *Hamil_i_e,float *L,float *X0){
+  FILE *mu_traj=data;
+  int x,N=non->singles;
+  for (x=0;x<3;x++){
+    if (read_mue(non,X0+x*N,mu_traj,frame,x)!=1){
+      printf("Dipole trajectory file to short, could not fill buffer!!!\n");
+      printf("JTIME %d %d\n",frame,x);
+      exit(1);
+    }
+    copyvec(X0+x*N,L+x*N,N);
+    // Do projection on selected sites if asked
+    if (non->Npsites>0){
+      projection(L+x*N,non);
+    }
+  }
+}
+
+void absorption(t_non *non,int parentRank,int parentSize,int subRank,int subSize,MPI_Comm subComm,MPI_Comm rootComm){
   // Initialize variables
   float *re_S_1,*im_S_1; // The first-order response function
-  float *mu_eg,*Hamil_i_e;
-
-  // Aid arrays
-  float *vecr,*veci,*vecr_old,*veci_old;
+  t_lintech tech;
+  float *Hamil_i_e;
 
   /* Floats */
   float shift1;
@@ -27,16 +47,14 @@ void absorption(t_non *non){
   /* File handles */
   FILE *H_traj,*mu_traj;
   FILE *outone,*log;
-  FILE *Cfile;
+  FILE *Cfile=NULL;
 
   /* Integers */
   int nn2;
   int itime,N_samples;
   int samples;
-  int x,ti,tj,i;
   int t1,fft;
-  int elements;
-  int cl,Ncl;
+  int Ncl;
 
   /* Time parameters */
   time_t time_now,time_old,time_0;
@@ -44,7 +62,7 @@ void absorption(t_non *non){
   time(&time_now);
   time(&time_0);
   shift1=(non->max1+non->min1)/2;
-  printf("Frequency shift %f.\n",shift1);
+  if (parentRank==0) printf("Frequency shift %f.\n",shift1);
   non->shifte=shift1;
 
   // Allocate memory
@@ -85,7 +103,7 @@ void absorption(t_non *non){
   // Do calculation
   N_samples=(non->length-non->tmax1-1)/non->sample+1;
   if (N_samples>0) {
-    printf("Making %d samples!\n",N_samples);
+    if (parentRank==0) printf("Making %d samples!\n",N_samples);
   } else {
     printf("Insufficient data to calculate spectrum.\n");
     printf("Please, lower max times or provide longer\n");
@@ -95,106 +113,34 @@ void absorption(t_non *non){
 
   if (non->end==0) non->end=N_samples;
 
-  log=fopen("NISE.log","a");
-  fprintf(log,"Begin sample: %d, End sample: %d.\n",non->begin,non->end);
-  fclose(log);
-
-  vecr=(float *)calloc(non->singles,sizeof(float));	
-  veci=(float *)calloc(non->singles,sizeof(float));
-  vecr_old=(float *)calloc(non->singles,sizeof(float));
-  veci_old=(float *)calloc(non->singles,sizeof(float));
-  mu_eg=(float *)calloc(non->singles,sizeof(float));
-
-  // Loop over samples
-  for (samples=non->begin;samples<non->end;samples++){
-
-    // Calculate linear response    
-    ti=samples*non->sample;
-    if (non->cluster!=-1){
-      if (read_cluster(non,ti,&cl,Cfile)!=1){
-	printf("Cluster trajectory file to short, could not fill buffer!!!\n");
-	printf("ITIME %d\n",ti);
-	exit(1);
-      }
-      //      printf("%d\n",cl);
-      // Configuration belong to cluster
-      if (non->cluster==cl){
-	Ncl++;
-      }
-    }
-    if (non->cluster==-1 || non->cluster==cl){
-      
-    for (x=0;x<3;x++){
-      // Read mu(ti)
-      if (read_mue(non,vecr,mu_traj,ti,x)!=1){
-	printf("Dipole trajectory file to short, could not fill buffer!!!\n");
-	printf("ITIME %d %d\n",ti,x);
-	exit(1);
-      }
-      clearvec(veci,non->singles);
-      copyvec(vecr,vecr_old,non->singles);
-      copyvec(vecr,mu_eg,non->singles);
-      // Loop over delay
-      for (t1=0;t1<non->tmax;t1++){
-	tj=ti+t1;
-	// Read Hamiltonian
-	if (read_He(non,Hamil_i_e,H_traj,tj)!=1){
-	  printf("Hamiltonian trajectory file to short, could not fill buffer!!!\n");
-	  exit(1);
-	}
-	
-	// Read mu(tj)
-	if (read_mue(non,mu_eg,mu_traj,tj,x)!=1){
-	  printf("Dipole trajectory file to short, could not fill buffer!!!\n");
-	  printf("JTIME %d %d\n",tj,x);
-	  exit(1);
-	}
-
-	// Do projection on selected sites if asked
-	if (non->Npsites>0){
-	  projection(mu_eg,non);
-	}
-	
-	// Find response
-	calc_S1(re_S_1,im_S_1,t1,non,vecr,veci,mu_eg);
-
-	// Probagate vector
-	if (non->propagation==1) propagate_vec_coupling_S(non,Hamil_i_e,vecr,veci,non->ts,1);
-	if (non->propagation==0){
-	  if (non->thres==0 || non->thres>1){
-	    propagate_vec_DIA(non,Hamil_i_e,vecr,veci,1);
-	  } else {
-	    elements=propagate_vec_DIA_S(non,Hamil_i_e,vecr,veci,1);
-	    if (samples==non->begin){
-	      if (t1==0){
-		if (x==0){
-		  printf("Sparce matrix efficiency: %f pct.\n",(1-(1.0*elements/(non->singles*non->singles)))*100);
-		  printf("Pressent tuncation %f.\n",non->thres/((non->deltat*icm2ifs*twoPi/non->ts)*(non->deltat*icm2ifs*twoPi/non->ts)));
-		  printf("Suggested truncation %f.\n",0.001);
-		}
-	      }
-	    }
-	  }
-	}
-      }
-    }
-    } // Cluster loop
-  
-    // Log time
+  if (parentRank==0){
     log=fopen("NISE.log","a");
-    fprintf(log,"Finished sample %d\n",samples);
-          
-    time_now=log_time(time_now,log);
+    fprintf(log,"Begin sample: %d, End sample: %d.\n",non->begin,non->end);
     fclose(log);
   }
 
-  free(vecr);
-  free(veci);
-  free(vecr_old);
-  free(veci_old);
-  free(mu_eg);
+  // Propagate all samples in one pass over the trajectory
+  tech.nv=3;
+  tech.exponential=0;
+  tech.frame=absorption_frame;
+  tech.response=NULL;
+  tech.data=mu_traj;
+  linear_response(non,Hamil_i_e,H_traj,mu_traj,Cfile,&Ncl,&tech,re_S_1,im_S_1,
+                  parentRank,parentSize,subRank,subComm,rootComm);
+  samples=non->end;
   free(Hamil_i_e);
 
+  traj_fclose(mu_traj),traj_fclose(H_traj);
+  if (non->cluster!=-1){
+    traj_fclose(Cfile);
+  }
+
+  // Only the master writes the results
+  if (parentRank!=0){
+    free(re_S_1),free(im_S_1);
+    return;
+  }
+
   // The calculation is finished, lets write output
   log=fopen("NISE.log","a");
   fprintf(log,"Finished Calculating Response!\n");
@@ -210,11 +156,6 @@ void absorption(t_non *non){
     }
   }
 
-  fclose(mu_traj),fclose(H_traj);
-  if (non->cluster!=-1){
-    fclose(Cfile);
-  }
-
   /* Save time domain response */
   outone=fopen("TD_Absorption.dat","w");
   for (t1=0;t1<non->tmax1;t1+=non->dt1){
@@ -1,6 +1,8 @@
 #ifndef _ABSORPTION_
 #define _ABSORPTION_
-void absorption(t_non *non);
+#include <mpi.h>
+void absorption(t_non *non,int parentRank,int parentSize,int subRank,int subSize,MPI_Comm subComm,MPI_Comm rootComm);
+void absorption_frame(t_non *non,void *data,int frame,float *Hamil_i_e,float *L,float *X0);
 void calc_S1(float *re_S_1,float *im_S_1,int t1,t_non *non,float *cr,float *ci,float *mu);
 
 #endif // _ABSORPTION_
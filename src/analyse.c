@@ -7,6 +7,7 @@
 #include "omp.h"
 #include "types.h"
 #include "NISE_subs.h"
+#include "trajectory.h"
 #include "analyse.h"
 
 void analyse(t_non *non){
@@ -278,10 +279,10 @@ void analyse(t_non *non){
   fprintf(log,"Writing to file!\n");  
   fclose(log);
 
-  fclose(mu_traj),fclose(H_traj);
+  traj_fclose(mu_traj),traj_fclose(H_traj);
   fclose(outone);
   if (non->cluster!=-1){
-    fclose(Cfile);
+    traj_fclose(Cfile);
   } 
  
 
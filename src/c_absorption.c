@@ -4,19 +4,51 @@
 #include <string.h>
 #include <time.h>
 #include <fftw3.h>
+#include <mpi.h>
 #include "omp.h"
 #include "types.h"
 #include "NISE_subs.h"
+#include "trajectory.h"
+#include "linear.h"
 #include "c_absorption.h"
 #include "1DFFT.h"
 
-void c_absorption(t_non *non){
+// Dipoles of the Coupling Hamiltonian are fixed and read once
+typedef struct {
+  FILE *mu_traj;
+  float *mu_xyz;
+} t_cabsdata;
+
+// Frame data for the linear absorption: the transition dipoles are both the
+// initial vectors and, projected on the selected sites, the final vectors
+static void c_absorption_frame(t_non *non,void *data,int frame,float *Hamil_i_e,float *L,float *X0){
+  t_cabsdata *d=data;
+  int x,N=non->singles;
+  for (x=0;x<3;x++){
+    if (!strcmp(non->hamiltonian,"Coupling")){
+      copyvec(d->mu_xyz+N*x,X0+x*N,N);
+    } else {
+      if (read_mue(non,X0+x*N,d->mu_traj,frame,x)!=1){
+	printf("Dipole trajectory file to short, could not fill buffer!!!\n");
+	printf("JTIME %d %d\n",frame,x);
+	exit(1);
+      }
+    }
+    copyvec(X0+x*N,L+x*N,N);
+    // Do projection on selected sites if asked
+    if (non->Npsites>0){
+      projection(L+x*N,non);
+    }
+  }
+}
+
+void c_absorption(t_non *non,int parentRank,int parentSize,int subRank,int subSize,MPI_Comm subComm,MPI_Comm rootComm){
   // Initialize variables
   float *re_S_1,*im_S_1; // The first-order response function
-  float *mu_eg,*Hamil_i_e;
+  t_lintech tech;
+  float *Hamil_i_e;
   float *mu_xyz;
-  // Aid arrays
-  float *vecr,*veci,*vecr_old,*veci_old;
+  t_cabsdata data;
 
   /* Floats */
   float shift1;
@@ -28,16 +60,15 @@ void c_absorption(t_non *non){
   FILE *H_traj,*mu_traj;
   FILE *C_traj;
   FILE *outone,*log;
-  FILE *Cfile;
+  FILE *Cfile=NULL;
 
   /* Integers */
   int nn2;
   int itime,N_samples;
   int samples;
-  int x,ti,tj,i;
+  int x;
   int t1,fft;
-  int elements;
-  int cl,Ncl;
+  int Ncl;
 
   /* Time parameters */
   time_t time_now,time_old,time_0;
@@ -45,7 +76,7 @@ void c_absorption(t_non *non){
   time(&time_now);
   time(&time_0);
   shift1=(non->max1+non->min1)/2;
-  printf("Frequency shift %f.\n",shift1);
+  if (parentRank==0) printf("Frequency shift %f.\n",shift1);
   non->shifte=shift1;
 
   // Allocate memory
@@ -86,7 +117,7 @@ void c_absorption(t_non *non){
   // Do calculation
   N_samples=(non->length-non->tmax1-1)/non->sample+1;
   if (N_samples>0) {
-    printf("Making %d samples!\n",N_samples);
+    if (parentRank==0) printf("Making %d samples!\n",N_samples);
   } else {
     printf("Insufficient data to calculate spectrum.\n");
     printf("Please, lower max times or provide longer\n");
@@ -96,15 +127,12 @@ void c_absorption(t_non *non){
 
   if (non->end==0) non->end=N_samples;
 
-  log=fopen("NISE.log","a");
-  fprintf(log,"Begin sample: %d, End sample: %d.\n",non->begin,non->end);
-  fclose(log);
+  if (parentRank==0){
+    log=fopen("NISE.log","a");
+    fprintf(log,"Begin sample: %d, End sample: %d.\n",non->begin,non->end);
+    fclose(log);
+  }
 
-  vecr=(float *)calloc(non->singles,sizeof(float));	
-  veci=(float *)calloc(non->singles,sizeof(float));
-  vecr_old=(float *)calloc(non->singles,sizeof(float));
-  veci_old=(float *)calloc(non->singles,sizeof(float));
-  mu_eg=(float *)calloc(non->singles,sizeof(float));
   mu_xyz=(float *)calloc(non->singles*3,sizeof(float));
 
   /* Read coupling */
@@ -118,7 +146,7 @@ void c_absorption(t_non *non){
       printf("Coupling trajectory file to short, could not fill buffer!!!\n");
       exit(1);
     }
-    fclose(C_traj);
+    traj_fclose(C_traj);
     for (x=0;x<3;x++){
       if (read_mue(non,mu_xyz+non->singles*x,mu_traj,0,x)!=1){
          printf("Dipole trajectory file to short, could not fill buffer!!!\n");
@@ -128,111 +156,31 @@ void c_absorption(t_non *non){
     }
   }
 
-  /* Loop over samples */
-  for (samples=non->begin;samples<non->end;samples++){
+  /* Propagate all samples in one pass over the trajectory */
+  data.mu_traj=mu_traj;
+  data.mu_xyz=mu_xyz;
+  tech.nv=3;
+  tech.exponential=0;
+  tech.frame=c_absorption_frame;
+  tech.response=NULL;
+  tech.data=&data;
+  linear_response(non,Hamil_i_e,H_traj,mu_traj,Cfile,&Ncl,&tech,re_S_1,im_S_1,
+                  parentRank,parentSize,subRank,subComm,rootComm);
+  samples=non->end;
 
-    /* Calculate linear response */   
-    ti=samples*non->sample;
-    if (non->cluster!=-1){
-      if (read_cluster(non,ti,&cl,Cfile)!=1){
-	printf("Cluster trajectory file to short, could not fill buffer!!!\n");
-	printf("ITIME %d\n",ti);
-	exit(1);
-      }
-      //      printf("%d\n",cl);
-      // Configuration belong to cluster
-      if (non->cluster==cl){
-	Ncl++;
-      }
-    }
-    if (non->cluster==-1 || non->cluster==cl){
-      
-    for (x=0;x<3;x++){
-      /* Read mu(ti) */
-      if (!strcmp(non->hamiltonian,"Coupling")){
-        copyvec(mu_xyz+non->singles*x,vecr,non->singles);
-      } else {
-        if (read_mue(non,vecr,mu_traj,ti,x)!=1){
-	  printf("Dipole trajectory file to short, could not fill buffer!!!\n");
-	  printf("ITIME %d %d\n",ti,x);
-	  exit(1);
-        }
-      }
-      clearvec(veci,non->singles);
-      copyvec(vecr,vecr_old,non->singles);
-      copyvec(vecr,mu_eg,non->singles);
-      // Loop over delay
-      for (t1=0;t1<non->tmax;t1++){
-	tj=ti+t1;
-	/* Read Hamiltonian */
-	if (!strcmp(non->hamiltonian,"Coupling")){
-          if (read_Dia(non,Hamil_i_e,H_traj,tj)!=1){
-            printf("Hamiltonian trajectory file to short, could not fill buffer!!!\n");
-            exit(1);
-          }
-        } else {
-	  if (read_He(non,Hamil_i_e,H_traj,tj)!=1){
-	    printf("Hamiltonian trajectory file to short, could not fill buffer!!!\n");
-	    exit(1);
-  	  }
-        }
-	
-	/* Read mu(tj) */
-        if (!strcmp(non->hamiltonian,"Coupling")){
-          copyvec(mu_xyz+non->singles*x,mu_eg,non->singles);
-        } else {
-	  if (read_mue(non,mu_eg,mu_traj,tj,x)!=1){
-	    printf("Dipole trajectory file to short, could not fill buffer!!!\n");
-	    printf("JTIME %d %d\n",tj,x);
-	    exit(1);
-	  }
-        }
-
-	// Do projection on selected sites if asked
-	if (non->Npsites>0){
-	  projection(mu_eg,non);
-	}
-	
-	// Find response
-	c_calc_S1(re_S_1,im_S_1,t1,non,vecr,veci,mu_eg);
+  free(mu_xyz);
+  free(Hamil_i_e);
 
-	// Probagate vector
-	if (non->propagation==1) propagate_vec_coupling_S(non,Hamil_i_e,vecr,veci,non->ts,1);
-	if (non->propagation==0){
-	  if (non->thres==0 || non->thres>1){
-	    propagate_vec_DIA(non,Hamil_i_e,vecr,veci,1);
-	  } else {
-	    elements=propagate_vec_DIA_S(non,Hamil_i_e,vecr,veci,1);
-	    if (samples==non->begin){
-	      if (t1==0){
-		if (x==0){
-		  printf("Sparce matrix efficiency: %f pct.\n",(1-(1.0*elements/(non->singles*non->singles)))*100);
-		  printf("Pressent tuncation %f.\n",non->thres/((non->deltat*icm2ifs*twoPi/non->ts)*(non->deltat*icm2ifs*twoPi/non->ts)));
-		  printf("Suggested truncation %f.\n",0.001);
-		}
-	      }
-	    }
-	  }
-	}
-      }
-    }
-    } // Cluster loop
-  
-    // Log time
-    log=fopen("NISE.log","a");
-    fprintf(log,"Finished sample %d\n",samples);
-          
-    time_now=log_time(time_now,log);
-    fclose(log);
+  traj_fclose(mu_traj),traj_fclose(H_traj);
+  if (non->cluster!=-1){
+    traj_fclose(Cfile);
   }
 
-  free(vecr);
-  free(veci);
-  free(vecr_old);
-  free(veci_old);
-  free(mu_eg);
-  free(mu_xyz);
-  free(Hamil_i_e);
+  // Only the master writes the results
+  if (parentRank!=0){
+    free(re_S_1),free(im_S_1);
+    return;
+  }
 
   // The calculation is finished, lets write output
   log=fopen("NISE.log","a");
@@ -249,11 +197,6 @@ void c_absorption(t_non *non){
     }
   }
 
-  fclose(mu_traj),fclose(H_traj);
-  if (non->cluster!=-1){
-    fclose(Cfile);
-  }
-
   /* Save time domain response */
   outone=fopen("TD_Absorption.dat","w");
   for (t1=0;t1<non->tmax1;t1+=non->dt1){
@@ -1,6 +1,7 @@
 #ifndef _C_ABSORPTION_
 #define _C_ABSORPTION_
-void c_absorption(t_non *non);
+#include <mpi.h>
+void c_absorption(t_non *non,int parentRank,int parentSize,int subRank,int subSize,MPI_Comm subComm,MPI_Comm rootComm);
 void c_calc_S1(float *re_S_1,float *im_S_1,int t1,t_non *non,float *cr,float *ci,float *mu);
 
 #endif // _C_ABSORPTION_
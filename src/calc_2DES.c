@@ -11,16 +11,24 @@
 #include "omp.h"
 #include "types.h"
 #include "NISE_subs.h"
+#include "trajectory.h"
 #include "polar.h"
 #include "calc_2DES.h"
 #include <stdarg.h>
 #include "mpi.h"
 #include "MPI_subs.h"
+#include "propagator_cache.h"
+#include "prefetch.h"
+#include "convergence.h"
+#include "sparse.h"
+#include "krylov.h"
+#include "chebyshev.h"
+#include "absorption.h"
 
 void calc_2DES(t_non* non, int parentRank, int parentSize, int subRank, int subSize, MPI_Comm subComm, MPI_Comm rootComm) {
     // Start by determining the work to be done, make an array of samples/poldir to simulate
-    // and distribute those statically over all processors
-    int clusterCount = 0, sampleCount = 0, * workset, * worksetSizes = calloc(parentSize, sizeof(int));;
+    // and send it to all processors, which take items from it through a work queue
+    int clusterCount = 0, sampleCount = 0, totalWorkItems = 0, * workset;
     int counter,counter_pass;
     float counter_current;
     double my_time,my_current_time;
@@ -28,30 +36,17 @@ void calc_2DES(t_non* non, int parentRank, int parentSize, int subRank, int subS
     if(parentRank == 0) {
         // Master process calculates the work items to be performed
         int* fullWorkset;
-        calculateWorkset(non, &fullWorkset, &sampleCount, &clusterCount);
+        calculateWorkset(non, &fullWorkset, &sampleCount, &clusterCount, 21);
         log_item("Begin sample: %d, End sample: %d.\n", non->begin, non->end);
 
-        // Distribute work, each process does as many items as the others (static decomposition)
+        // Send the work items to all processes
         MPI_Bcast(&clusterCount, 1, MPI_INT, 0, MPI_COMM_WORLD);
         MPI_Bcast(&sampleCount, 1, MPI_INT, 0, MPI_COMM_WORLD);
 
-        int totalWorkItems = 21 * sampleCount;
-        int baseWorksetSize = totalWorkItems / parentSize;
-        int remainder = totalWorkItems % parentSize;
-
-        // Make array of worksetsizes, since each process might have a different workset size, distribute that array to the other processes
-        int* worksetOffsets = calloc(parentSize, sizeof(int));
-        for(int i = 0; i < parentSize; i++) {
-            worksetSizes[i] = i < remainder ? (baseWorksetSize + 1) * 2 : baseWorksetSize * 2;
-            worksetOffsets[i] = i == 0 ? 0 : worksetOffsets[i - 1] + worksetSizes[i];
-        }
-
-        MPI_Bcast(worksetSizes, parentSize, MPI_INT, 0, MPI_COMM_WORLD);
-        workset = malloc(worksetSizes[0] * sizeof(int));
-        MPI_Scatterv(fullWorkset, worksetSizes, worksetOffsets, MPI_INT, workset, worksetSizes[0], MPI_INT, 0, MPI_COMM_WORLD);
-
-        free(fullWorkset);
-        free(worksetOffsets);
+        totalWorkItems = 21 * sampleCount;
+        MPI_Bcast(&totalWorkItems, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        workset = fullWorkset;
+        MPI_Bcast(workset, 2 * totalWorkItems, MPI_INT, 0, MPI_COMM_WORLD);
     } else {
         // Fix non settings
         const int totalSampleCount = (non->length - non->tmax1 - non->tmax2 - non->tmax3 - 1) / non->sample + 1;
@@ -61,9 +56,9 @@ void calc_2DES(t_non* non, int parentRank, int parentSize, int subRank, int subS
         MPI_Bcast(&clusterCount, 1, MPI_INT, 0, MPI_COMM_WORLD);
         MPI_Bcast(&sampleCount, 1, MPI_INT, 0, MPI_COMM_WORLD);
 
-        MPI_Bcast(worksetSizes, parentSize, MPI_INT, 0, MPI_COMM_WORLD);
-        workset = malloc(worksetSizes[parentRank] * sizeof(int));
-        MPI_Scatterv(NULL, NULL, NULL, MPI_INT, workset, worksetSizes[parentRank], MPI_INT, 0, MPI_COMM_WORLD);
+        MPI_Bcast(&totalWorkItems, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        workset = malloc(2 * totalWorkItems * sizeof(int));
+        MPI_Bcast(workset, 2 * totalWorkItems, MPI_INT, 0, MPI_COMM_WORLD);
     }
 
     // Initialize each process base variables
@@ -79,23 +74,29 @@ void calc_2DES(t_non* non, int parentRank, int parentSize, int subRank, int subS
     non->shiftf = 2 * shift1;
 
     // Arrays where the result is stored, these will be reduced (summed) at the end!
+    // For a t2 series the tmax3 rows of each waiting time follow each other
+    const int nT2 = waitingTimes(non);
 
     // 2D response function parallel
-    float** rrIpar = (float**) calloc2D(non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
-    float** riIpar = (float**)calloc2D(non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
-    float** rrIIpar = (float**)calloc2D(non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
-    float** riIIpar = (float**)calloc2D(non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
+    float** rrIpar = (float**) calloc2D(nT2 * non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
+    float** riIpar = (float**)calloc2D(nT2 * non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
+    float** rrIIpar = (float**)calloc2D(nT2 * non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
+    float** riIIpar = (float**)calloc2D(nT2 * non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
     // 2D response function perpendicular
-    float** rrIper = (float**)calloc2D(non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
-    float** riIper = (float**)calloc2D(non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
-    float** rrIIper = (float**)calloc2D(non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
-    float** riIIper = (float**)calloc2D(non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
+    float** rrIper = (float**)calloc2D(nT2 * non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
+    float** riIper = (float**)calloc2D(nT2 * non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
+    float** rrIIper = (float**)calloc2D(nT2 * non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
+    float** riIIper = (float**)calloc2D(nT2 * non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
     // 2D response function cross
-    float** rrIcro = (float**)calloc2D(non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
-    float** riIcro = (float**)calloc2D(non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
-    float** rrIIcro = (float**)calloc2D(non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
-    float** riIIcro = (float**)calloc2D(non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
+    float** rrIcro = (float**)calloc2D(nT2 * non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
+    float** riIcro = (float**)calloc2D(nT2 * non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
+    float** rrIIcro = (float**)calloc2D(nT2 * non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
+    float** riIIcro = (float**)calloc2D(nT2 * non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
+
 
+    // Linear response from the t1 vectors, written as the absorption spectrum
+    float* re_S_1 = calloc(non->tmax1, sizeof(float)); // REDUCE
+    float* im_S_1 = calloc(non->tmax1, sizeof(float)); // REDUCE
 
     // These arrays are initialized here and only read in the loops
     float** lt_gb_se = (float**)calloc2D(non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // RO
@@ -133,7 +134,7 @@ void calc_2DES(t_non* non, int parentRank, int parentSize, int subRank, int subS
             if (parentRank == 0) printf("Coupling trajectory file to short, could not fill buffer!!!\n");
             MPI_Abort(MPI_COMM_WORLD, 1);
         }
-        fclose(C_traj);
+        traj_fclose(C_traj);
 
         for (int x = 0; x < 3; x++) {
             if (read_mue(non, mu_xyz + non->singles * x, mu_traj, 0, x) != 1) {
@@ -144,320 +145,360 @@ void calc_2DES(t_non* non, int parentRank, int parentSize, int subRank, int subS
         }
     }
 
+    // Cache of the one exciton propagators for the Sparse propagation scheme
+    t_propcache* cache = non->propagation == 0 ? propcache_init(non) : NULL;
+    // Sparse Hamiltonian of the frame for the other propagation schemes
+    t_csr* Hs = csr_init(non->singles);
+
+    // Read the frames of all samples once per node into shared memory if requested
+    MPI_Win H_win, mu_win;
+    const int firstFrame = non->begin * non->sample;
+    const int frameCount = (non->end - non->begin - 1) * non->sample + non->tmax1 + non->tmax2 + non->tmax3 + 1;
+    if (non->sharedtraj) {
+        H_win = shareFrames(H_traj, He_frame_bytes(non), firstFrame, frameCount, subRank, subComm);
+        mu_win = shareFrames(mu_traj, mue_frame_bytes(non), firstFrame, frameCount, subRank, subComm);
+    }
+
+    // Reader thread for the frames of the coming samples, not needed with shared frames
+    t_prefetch* pf = non->sharedtraj ? NULL : prefetch_init(non, H_traj, mu_traj);
+
+    // Only the t1 times on the grid of TimeIncrement get a vector
+    const int n1 = t1Points(non);
+
+    // Allocate the work item arrays once, they are reused for all work items
+    //float* Anh = calloc(non->singles, sizeof(float));
+    //float* over = calloc(non->singles, sizeof(float));
+
+    float* leftrr = calloc(non->singles, sizeof(float));
+    float* leftri = calloc(non->singles, sizeof(float));
+    float** leftnr = (float**)calloc2D(n1, non->singles, sizeof(float), sizeof(float*));
+    float** leftni = (float**)calloc2D(n1, non->singles, sizeof(float), sizeof(float*));
+    float** rightrr = (float**)calloc2D(n1, non->singles, sizeof(float), sizeof(float*));
+    float** rightri = (float**)calloc2D(n1, non->singles, sizeof(float), sizeof(float*));
+    float* rightnr = calloc(non->singles, sizeof(float));
+    float* rightni = calloc(non->singles, sizeof(float));
+
+    float* mut2 = calloc(non->singles, sizeof(float));
+    float* mut3r = calloc(non->singles, sizeof(float));
+    float* mut3i = calloc(non->singles, sizeof(float));
+    float* mut4 = calloc(non->singles, sizeof(float));
+    float* muabs = calloc(non->singles, sizeof(float));
+
+    float* fr = calloc(nn2e, sizeof(float));
+    float* fi = calloc(nn2e, sizeof(float));
+    float** ft1r = (float**)calloc2D(n1, nn2e, sizeof(float), sizeof(float*));
+    float** ft1i = (float**)calloc2D(n1, nn2e, sizeof(float), sizeof(float*));
+
+    float* t1nr = calloc(n1, sizeof(float));
+    float* t1ni = calloc(n1, sizeof(float));
+    float* t1rr = calloc(n1, sizeof(float));
+    float* t1ri = calloc(n1, sizeof(float));
+    float* t1gr = calloc(n1, sizeof(float));
+    float* t1gi = calloc(n1, sizeof(float));
+
+    // Vectors at the waiting time reached, kept for the next waiting time of a t2 series
+    float* t2rr = calloc(non->singles, sizeof(float));
+    float* t2ri = calloc(non->singles, sizeof(float));
+    float** t2nr = (float**)calloc2D(n1, non->singles, sizeof(float), sizeof(float*));
+    float** t2ni = (float**)calloc2D(n1, non->singles, sizeof(float), sizeof(float*));
+
+    // Sparse time evolution operator for the two exciton propagation
+    float* Urs = calloc(non->singles * non->singles, sizeof(float));
+    float* Uis = calloc(non->singles * non->singles, sizeof(float));
+    int* Rs = calloc(non->singles * non->singles, sizeof(int));
+    int* Cs = calloc(non->singles * non->singles, sizeof(int));
+    float* Udr = calloc(non->singles * non->singles, sizeof(float));
+    float* Udi = calloc(non->singles * non->singles, sizeof(float));
+
     // Start clock
     if (parentRank==0){
 	my_time=MPI_Wtime();
     }
 
-    // From now on we'll do the calculations
-    for (int currentWorkItem = 0; currentWorkItem < worksetSizes[parentRank]; currentWorkItem += 2) {
-        int currentSample = workset[currentWorkItem];
-        int molPol = workset[currentWorkItem + 1];
+    // Checkpoints of the accumulated response, completed items are skipped on restart
+    float** reductionArrays[12] = {
+        rrIpar, riIpar, rrIIpar, riIIpar, rrIper, riIper, rrIIper, riIIper, rrIcro, riIcro, rrIIcro, riIIcro
+    };
+    t_checkpoint cp;
+    char* completed = initCheckpoint(&cp, non, reductionArrays, 12, totalWorkItems, parentRank, parentSize);
+
+    // Intermediate spectra and convergence monitoring
+    char* streamNames[6] = { "RparI.dat", "RparII.dat", "RperI.dat", "RperII.dat", "RcroI.dat", "RcroII.dat" };
+    t_stream stream;
+    initStream(&stream, non, reductionArrays, streamNames, 12, 21, completed, totalWorkItems, parentRank);
 
-        if (currentSample == -1 || molPol == -1) continue;
+    // From now on we'll do the calculations, taking work items until none are left
+    t_workqueue queue;
+    initWorkQueue(&queue, totalWorkItems, non->scheduling, parentRank, parentSize);
+    for (int item = nextWorkItem(&queue); item >= 0; item = nextWorkItem(&queue)) {
+        int currentSample = workset[2 * item];
+        int molPol = workset[2 * item + 1];
+
+        if (currentSample == -1 || molPol == -1 || completed[item]) continue;
 
         /* Calculate 2DIR response */
         int tj = currentSample * non->sample + non->tmax1;
-        int tk = tj + non->tmax2;
+        read_ahead(non, H_traj, mu_traj, tj - non->tmax1, non->tmax1 + non->tmax2 + non->tmax3 + 1);
+        prefetch_window(pf, tj - non->tmax1, non->tmax1 + non->tmax2 + non->tmax3 + 1);
         int px[4];
         polar(px, molPol);
 
-        // Allocate arrays
-        //float* Anh = calloc(non->singles, sizeof(float));
-        //float* over = calloc(non->singles, sizeof(float));
-
-        float* leftrr = calloc(non->singles, sizeof(float));
-        float* leftri = calloc(non->singles, sizeof(float));
-        float** leftnr = (float**)calloc2D(non->tmax1, non->singles, sizeof(float), sizeof(float*));
-        float** leftni = (float**)calloc2D(non->tmax1, non->singles, sizeof(float), sizeof(float*));
-        float** rightrr = (float**)calloc2D(non->tmax1, non->singles, sizeof(float), sizeof(float*));
-        float** rightri = (float**)calloc2D(non->tmax1, non->singles, sizeof(float), sizeof(float*));
-        float* rightnr = calloc(non->singles, sizeof(float));
-        float* rightni = calloc(non->singles, sizeof(float));
-
-        float* mut2 = calloc(non->singles, sizeof(float));
-        float* mut3r = calloc(non->singles, sizeof(float));
-        float* mut3i = calloc(non->singles, sizeof(float));
-        float* mut4 = calloc(non->singles, sizeof(float));
-
-        float* fr = calloc(nn2e, sizeof(float));
-        float* fi = calloc(nn2e, sizeof(float));
-        float** ft1r = (float**)calloc2D(non->tmax1, nn2e, sizeof(float), sizeof(float*));
-        float** ft1i = (float**)calloc2D(non->tmax1, nn2e, sizeof(float), sizeof(float*));
         // Read information
         mureadE(non, mut2, tj, px[1], mu_traj, mu_xyz, pol);
 
         /* Ground state bleach (GB) kI and kII */
-        for (int t1 = 0; t1 < non->tmax1; t1++) {
-            /* Read dipoles at time 0 */
-            mureadE(non, leftnr[t1], tj - t1, px[0], mu_traj, mu_xyz, pol);
+        /* Read dipoles at time 0 */
+        for (int t1 = 0; t1 < n1; t1++) {
+            mureadE(non, leftnr[t1], tj - t1 * non->dt1, px[0], mu_traj, mu_xyz, pol);
             clearvec(leftni[t1], non->singles);
+        }
 
-            /* Propagate */
-            for (int tm = 0; tm < t1; tm++) {
-                /* Read Hamiltonian */
-                if (read_He(non, Hamil_i_e, H_traj, tj - t1 + tm) != 1) {
-                    printf("Hamiltonian trajectory file to short, could not fill buffer!!!\n");
-                    exit(1);
-                }
+        /* Propagate all t1 vectors in one forward sweep over the trajectory. At time tm */
+        /* the vectors starting at or before tm (t1 >= tj - tm) take one step, such that */
+        /* each Hamiltonian is read and exponentiated only once */
+        for (int tm = tj - (n1 - 1) * non->dt1; tm < tj; tm++) {
+            int first = (tj - tm + non->dt1 - 1) / non->dt1;
+            if (non->propagation == 0) {
+                propagate_vecs_cache(non, cache, Hamil_i_e, H_traj, tm, leftnr + first, leftni + first,
+                                     n1 - first, 1);
+                continue;
+            }
 
-                if (non->propagation == 1) {
-                    propagate_vec_coupling_S(
-                        non, Hamil_i_e, leftnr[t1], leftni[t1], non->ts, 1
-                    );
-                } else if (non->propagation == 0) {
-                    propagate_vec_DIA_S(non, Hamil_i_e, leftnr[t1], leftni[t1], 1);
-                }
+            /* Read Hamiltonian */
+            if (read_He(non, Hamil_i_e, H_traj, tm) != 1) {
+                printf("Hamiltonian trajectory file to short, could not fill buffer!!!\n");
+                exit(1);
+            }
+            csr_build(non, Hamil_i_e, Hs);
 
+            if (non->propagation == 1) {
+                int t1;
+                #pragma omp parallel for \
+                    shared(non, Hs, leftnr, leftni) \
+                    schedule(static, 1)
+                for (t1 = first; t1 < n1; t1++) {
+                    propagate_vec_coupling_csr(non, Hs, leftnr[t1], leftni[t1], non->ts, 1);
+                }
+            }
+            if (non->propagation == 3) {
+                int t1;
+                #pragma omp parallel for \
+                    shared(non, Hs, leftnr, leftni) \
+                    schedule(dynamic)
+                for (t1 = first; t1 < n1; t1++) {
+                    propagate_vec_krylov(non, Hs, leftnr[t1], leftni[t1], 1);
+                }
+            }
+            if (non->propagation == 4) {
+                propagate_vecs_chebyshev(non, Hs, leftnr + first, leftni + first, n1 - first, 1);
             }
         }
 
-        float* t1nr = calloc(non->tmax1, sizeof(float));
-        float* t1ni = calloc(non->tmax1, sizeof(float));
+        /* The linear response is the overlap of the t1 vectors with the dipole of the */
+        /* same component at tj, each component is included once per sample */
+        if (molPol < 3) {
+            copyvec(mut2, muabs, non->singles);
+            if (non->Npsites > 0) projection(muabs, non);
+            for (int t1 = 0; t1 < n1; t1++) {
+                calc_S1(re_S_1, im_S_1, t1 * non->dt1, non, leftnr[t1], leftni[t1], muabs);
+            }
+        }
 
-        for (int t1 = 0; t1 < non->tmax1; t1++) {
-            t1nr[t1] = 0, t1ni[t1] = 0;
+        for (int t1 = 0; t1 < n1; t1++) {
+            t1gr[t1] = 0, t1gi[t1] = 0;
             for (int i = 0; i < non->singles; i++) {
-                t1nr[t1] += mut2[i] * leftnr[t1][i];
-                t1ni[t1] += mut2[i] * leftni[t1][i];
+                t1gr[t1] += mut2[i] * leftnr[t1][i];
+                t1gi[t1] += mut2[i] * leftni[t1][i];
             }
         }
 
-        free(mut2);
+        /* The t1 vectors are shared by all waiting times, the evolution during t2 */
+        /* continues from one waiting time to the next */
+        mureadE(non, t2rr, tj, px[1], mu_traj, mu_xyz, pol);
+        clearvec(t2ri, non->singles);
+        memcpy(t2nr[0], leftnr[0], n1 * non->singles * sizeof(float));
+        memcpy(t2ni[0], leftni[0], n1 * non->singles * sizeof(float));
+        int t2 = 0;
+        for (int w = 0; w < nT2; w++) {
+            int tk = tj + waitingTime(non, w);
+            int r0 = w * non->tmax3; // First row of the response of this waiting time
 
-        /* Combine with evolution during t3 */
-        mureadE(non, mut3r, tk, px[2], mu_traj, mu_xyz, pol);
-        clearvec(mut3i, non->singles);
-        for (int t3 = 0; t3 < non->tmax3; t3++) {
-            int tl = tk + t3;
-            mureadE(non, mut4, tl, px[3], mu_traj, mu_xyz, pol);
+            /* Combine with evolution during t3 */
+            mureadE(non, mut3r, tk, px[2], mu_traj, mu_xyz, pol);
+            clearvec(mut3i, non->singles);
+            for (int t3 = 0; t3 < non->tmax3; t3++) {
+                int tl = tk + t3;
+                mureadE(non, mut4, tl, px[3], mu_traj, mu_xyz, pol);
             
-            /* Calculate GB contributions */
-            if ((!strcmp(non->technique, "GBUVvis")) || (!strcmp(non->technique, "2DUVvis")) || (!strcmp(
-                non->technique, "noEAUVvis"))) {
-                float t3nr = 0, t3ni = 0;
-                for (int i = 0; i < non->singles; i++) {
-                    t3nr += mut4[i] * mut3r[i];
-                    t3ni += mut4[i] * mut3i[i];
-                }
+                /* Calculate GB contributions */
+                if (t3 % non->dt3 == 0 && ((!strcmp(non->technique, "GBUVvis")) || (!strcmp(non->technique, "2DUVvis")) ||
+                    (!strcmp(non->technique, "noEAUVvis")))) {
+                    float t3nr = 0, t3ni = 0;
+                    for (int i = 0; i < non->singles; i++) {
+                        t3nr += mut4[i] * mut3r[i];
+                        t3ni += mut4[i] * mut3i[i];
+                    }
 
-                for (int t1 = 0; t1 < non->tmax1; t1++) {
-                    float polWeight = polarweight(0, molPol) * lt_gb_se[t3][t1];
-                    rrIpar[t3][t1] -= (t3ni * t1nr[t1] - t3nr * t1ni[t1]) * polWeight;
-                    riIpar[t3][t1] -= (t3nr * t1nr[t1] + t3ni * t1ni[t1]) * polWeight;
-                    rrIIpar[t3][t1] -= (t3ni * t1nr[t1] + t3nr * t1ni[t1]) * polWeight;
-                    riIIpar[t3][t1] -= (t3nr * t1nr[t1] - t3ni * t1ni[t1]) * polWeight;
-                    polWeight = polarweight(1, molPol) * lt_gb_se[t3][t1];
-                    rrIper[t3][t1] -= (t3ni * t1nr[t1] - t3nr * t1ni[t1]) * polWeight;
-                    riIper[t3][t1] -= (t3nr * t1nr[t1] + t3ni * t1ni[t1]) * polWeight;
-                    rrIIper[t3][t1] -= (t3ni * t1nr[t1] + t3nr * t1ni[t1]) * polWeight;
-                    riIIper[t3][t1] -= (t3nr * t1nr[t1] - t3ni * t1ni[t1]) * polWeight;
-                    polWeight = polarweight(2, molPol) * lt_gb_se[t3][t1];
-                    rrIcro[t3][t1] -= (t3ni * t1nr[t1] - t3nr * t1ni[t1]) * polWeight;
-                    riIcro[t3][t1] -= (t3nr * t1nr[t1] + t3ni * t1ni[t1]) * polWeight;
-                    rrIIcro[t3][t1] -= (t3ni * t1nr[t1] + t3nr * t1ni[t1]) * polWeight;
-                    riIIcro[t3][t1] -= (t3nr * t1nr[t1] - t3ni * t1ni[t1]) * polWeight;
+                    for (int t1 = 0; t1 < n1; t1++) {
+                        float polWeight = polarweight(0, molPol) * lt_gb_se[t3][t1 * non->dt1];
+                        rrIpar[r0 + t3][t1 * non->dt1] -= (t3ni * t1gr[t1] - t3nr * t1gi[t1]) * polWeight;
+                        riIpar[r0 + t3][t1 * non->dt1] -= (t3nr * t1gr[t1] + t3ni * t1gi[t1]) * polWeight;
+                        rrIIpar[r0 + t3][t1 * non->dt1] -= (t3ni * t1gr[t1] + t3nr * t1gi[t1]) * polWeight;
+                        riIIpar[r0 + t3][t1 * non->dt1] -= (t3nr * t1gr[t1] - t3ni * t1gi[t1]) * polWeight;
+                        polWeight = polarweight(1, molPol) * lt_gb_se[t3][t1 * non->dt1];
+                        rrIper[r0 + t3][t1 * non->dt1] -= (t3ni * t1gr[t1] - t3nr * t1gi[t1]) * polWeight;
+                        riIper[r0 + t3][t1 * non->dt1] -= (t3nr * t1gr[t1] + t3ni * t1gi[t1]) * polWeight;
+                        rrIIper[r0 + t3][t1 * non->dt1] -= (t3ni * t1gr[t1] + t3nr * t1gi[t1]) * polWeight;
+                        riIIper[r0 + t3][t1 * non->dt1] -= (t3nr * t1gr[t1] - t3ni * t1gi[t1]) * polWeight;
+                        polWeight = polarweight(2, molPol) * lt_gb_se[t3][t1 * non->dt1];
+                        rrIcro[r0 + t3][t1 * non->dt1] -= (t3ni * t1gr[t1] - t3nr * t1gi[t1]) * polWeight;
+                        riIcro[r0 + t3][t1 * non->dt1] -= (t3nr * t1gr[t1] + t3ni * t1gi[t1]) * polWeight;
+                        rrIIcro[r0 + t3][t1 * non->dt1] -= (t3ni * t1gr[t1] + t3nr * t1gi[t1]) * polWeight;
+                        riIIcro[r0 + t3][t1 * non->dt1] -= (t3nr * t1gr[t1] - t3ni * t1gi[t1]) * polWeight;
+                    }
                 }
-            }
 
-            /* Read Hamiltonian */
-            if (read_He(non, Hamil_i_e, H_traj, tl) != 1) {
-                printf("Hamiltonian trajectory file to short, could not fill buffer!!!\n");
-                exit(1);
-            }
+                /* Propagate */
+                if (non->propagation == 0) {
+                    propagate_vecs_cache(non, cache, Hamil_i_e, H_traj, tl, &mut3r, &mut3i, 1, 1);
+                    continue;
+                }
 
-            /* Propagate */
-            if (non->propagation == 1) propagate_vec_coupling_S(non, Hamil_i_e, mut3r, mut3i, non->ts, 1);
-            if (non->propagation == 0) propagate_vec_DIA_S(non, Hamil_i_e, mut3r, mut3i, 1);
-        }
+                /* Read Hamiltonian */
+                if (read_He(non, Hamil_i_e, H_traj, tl) != 1) {
+                    printf("Hamiltonian trajectory file to short, could not fill buffer!!!\n");
+                    exit(1);
+                }
+                csr_build(non, Hamil_i_e, Hs);
 
-        /* Stimulated emission (SE) */
-        /* Calculate evolution during t2 */
-        mureadE(non, leftrr, tj, px[1], mu_traj, mu_xyz, pol);
-        clearvec(leftri, non->singles);
-        for (int t2 = 0; t2 < non->tmax2; t2++) {
-            int tm = tj + t2;
-            if (read_He(non, Hamil_i_e, H_traj, tm) != 1) {
-                printf("Hamiltonian trajectory file to short, could not fill buffer!!!\n");
-                exit(1);
+                if (non->propagation == 1) propagate_vec_coupling_csr(non, Hs, mut3r, mut3i, non->ts, 1);
+                if (non->propagation == 3) propagate_vec_krylov(non, Hs, mut3r, mut3i, 1);
+                if (non->propagation == 4) propagate_block_chebyshev(non, Hs, mut3r, mut3i, 1, 1);
             }
 
+            /* Stimulated emission (SE) */
+            /* Calculate evolution during t2 up to this waiting time */
+            for (; t2 < waitingTime(non, w); t2++) {
+                int tm = tj + t2;
+                if (read_He(non, Hamil_i_e, H_traj, tm) != 1) {
+                    printf("Hamiltonian trajectory file to short, could not fill buffer!!!\n");
+                    exit(1);
+                }
+
 
-            propagate_t2_DIA(non, Hamil_i_e, leftrr, leftri,leftnr,leftni, 1);
+                propagate_t2_DIA(non, Hamil_i_e, t2rr, t2ri, t2nr, t2ni, 1);
 	    // Old t2 propagation to be replaced 10/2-2020 
-/*            propagate_vec_DIA(non, Hamil_i_e, leftrr, leftri, 1);
+    /*            propagate_vec_DIA(non, Hamil_i_e, leftrr, leftri, 1);
 
-            int t1;
-            #pragma omp parallel for \
-                shared(non, Hamil_i_e, leftnr, leftni) \
-                schedule(static,1)
+                int t1;
+                #pragma omp parallel for \
+                    shared(non, Hamil_i_e, leftnr, leftni) \
+                    schedule(static,1)
                 
-            for (t1 = 0; t1 < non->tmax1; t1++) {
-                propagate_vec_DIA(
-                    non, Hamil_i_e, leftnr[t1], leftni[t1], 1
-                );
-            }*/
+                for (t1 = 0; t1 < non->tmax1; t1++) {
+                    propagate_vec_DIA(
+                        non, Hamil_i_e, leftnr[t1], leftni[t1], 1
+                    );
+                }*/
 	     
-        }
-
-        /* Read dipole for third interaction */
-        mureadE(non, mut3r, tk, px[2], mu_traj, mu_xyz, pol);
-
-        if ((!strcmp(non->technique, "EAUVvis")) || (!strcmp(non->technique, "2DUVvis"))) {
-            //if (non->anharmonicity == 0) {
-            //    read_over(non, over, mu2_traj, tk, px[2]);
-            //}
-            /* T2 propagation ended store vectors needed for EA */
-            dipole_double_ES(non, mut3r, leftrr, leftri, fr, fi);
-            for (int t1 = 0; t1 < non->tmax1; t1++) {
-                dipole_double_ES(non, mut3r, leftnr[t1], leftni[t1],ft1r[t1], ft1i[t1]);
             }
+            copyvec(t2rr, leftrr, non->singles), copyvec(t2ri, leftri, non->singles);
+            memcpy(leftnr[0], t2nr[0], n1 * non->singles * sizeof(float));
+            memcpy(leftni[0], t2ni[0], n1 * non->singles * sizeof(float));
 
-            memcpy(rightrr[0], leftnr[0], non->tmax1 * non->singles * sizeof(float));
-            memcpy(rightri[0], leftni[0], non->tmax1* non->singles * sizeof(float));
-            for (int i = 0; i < non->tmax1 * non->singles; i++) rightri[0][i] = -rightri[0][i];
-
-            memcpy(rightnr, leftrr, non->singles * sizeof(float));
-            memcpy(rightni, leftri, non->singles * sizeof(float));
-            for (int i = 0; i < non->singles; i++) rightni[i] = -rightni[i];
-        }
+            /* Read dipole for third interaction */
+            mureadE(non, mut3r, tk, px[2], mu_traj, mu_xyz, pol);
 
-        clearvec(mut3i, non->singles);
-
-        /* Calculate right side of nonrephasing diagram */
-        float t3nr = 0, t3ni = 0;
-        for (int i = 0; i < non->singles; i++) {
-            t3nr += leftrr[i] * mut3r[i];
-            t3ni -= leftri[i] * mut3r[i];
-        }
+            if ((!strcmp(non->technique, "EAUVvis")) || (!strcmp(non->technique, "2DUVvis"))) {
+                //if (non->anharmonicity == 0) {
+                //    read_over(non, over, mu2_traj, tk, px[2]);
+                //}
+                /* T2 propagation ended store vectors needed for EA */
+                dipole_double_ES(non, mut3r, leftrr, leftri, fr, fi);
+                for (int t1 = 0; t1 < n1; t1++) {
+                    dipole_double_ES(non, mut3r, leftnr[t1], leftni[t1],ft1r[t1], ft1i[t1]);
+                }
 
-        /* Calculate right side of rephasing diagram */
-        float* t1rr = calloc(non->tmax1, sizeof(float));
-        float* t1ri = calloc(non->tmax1, sizeof(float));
+                memcpy(rightrr[0], leftnr[0], n1 * non->singles * sizeof(float));
+                memcpy(rightri[0], leftni[0], n1* non->singles * sizeof(float));
+                for (int i = 0; i < n1 * non->singles; i++) rightri[0][i] = -rightri[0][i];
 
-        for (int t1 = 0; t1 < non->tmax1; t1++) {
-            t1rr[t1] = 0, t1ri[t1] = 0;
-            for (int i = 0; i < non->singles; i++) {
-                t1rr[t1] += leftnr[t1][i] * mut3r[i];
-                t1ri[t1] -= leftni[t1][i] * mut3r[i];
+                memcpy(rightnr, leftrr, non->singles * sizeof(float));
+                memcpy(rightni, leftri, non->singles * sizeof(float));
+                for (int i = 0; i < non->singles; i++) rightni[i] = -rightni[i];
             }
-        }
 
-        /* Combine with evolution during t3 */
-        for (int t3 = 0; t3 < non->tmax3; t3++) {
-            int tl = tk + t3;
-            mureadE(non, mut4, tl, px[3], mu_traj, mu_xyz, pol);
+            clearvec(mut3i, non->singles);
 
-            /* Calculate left side of nonrephasing diagram */
-            float t3rr = 0, t3ri = 0;
+            /* Calculate right side of nonrephasing diagram */
+            float t3nr = 0, t3ni = 0;
             for (int i = 0; i < non->singles; i++) {
-                t3rr += mut4[i] * leftrr[i];
-                t3ri += mut4[i] * leftri[i];
+                t3nr += leftrr[i] * mut3r[i];
+                t3ni -= leftri[i] * mut3r[i];
             }
 
-            /* Calculate left side of rephasing diagram */
-            for (int t1 = 0; t1 < non->tmax1; t1++) {
-                t1nr[t1] = 0, t1ni[t1] = 0;
+            /* Calculate right side of rephasing diagram */
+            for (int t1 = 0; t1 < n1; t1++) {
+                t1rr[t1] = 0, t1ri[t1] = 0;
                 for (int i = 0; i < non->singles; i++) {
-                    t1nr[t1] += leftnr[t1][i] * mut4[i];
-                    t1ni[t1] += leftni[t1][i] * mut4[i];
-                }
-            }
-
-            /* Calculate Response */
-            if ((!strcmp(non->technique, "SEUVvis")) || (!strcmp(non->technique, "2DUVvis")) || (!strcmp(
-                non->technique, "noEAUVvis"))) {
-                for (int t1 = 0; t1 < non->tmax1; t1++) {
-                    float polWeight = polarweight(0, molPol) * lt_gb_se[t3][t1];
-                    rrIpar[t3][t1] -= (t3rr * t1ri[t1] + t3ri * t1rr[t1]) * polWeight;
-                    riIpar[t3][t1] -= (t3rr * t1rr[t1] - t3ri * t1ri[t1]) * polWeight;
-                    rrIIpar[t3][t1] -= (t3ni * t1nr[t1] + t3nr * t1ni[t1]) * polWeight;
-                    riIIpar[t3][t1] -= (t3nr * t1nr[t1] - t3ni * t1ni[t1]) * polWeight;
-                    polWeight = polarweight(1, molPol) * lt_gb_se[t3][t1];
-                    rrIper[t3][t1] -= (t3rr * t1ri[t1] + t3ri * t1rr[t1]) * polWeight;
-                    riIper[t3][t1] -= (t3rr * t1rr[t1] - t3ri * t1ri[t1]) * polWeight;
-                    rrIIper[t3][t1] -= (t3ni * t1nr[t1] + t3nr * t1ni[t1]) * polWeight;
-                    riIIper[t3][t1] -= (t3nr * t1nr[t1] - t3ni * t1ni[t1]) * polWeight;
-                    polWeight = polarweight(2, molPol) * lt_gb_se[t3][t1];
-                    rrIcro[t3][t1] -= (t3rr * t1ri[t1] + t3ri * t1rr[t1]) * polWeight;
-                    riIcro[t3][t1] -= (t3rr * t1rr[t1] - t3ri * t1ri[t1]) * polWeight;
-                    rrIIcro[t3][t1] -= (t3ni * t1nr[t1] + t3nr * t1ni[t1]) * polWeight;
-                    riIIcro[t3][t1] -= (t3nr * t1nr[t1] - t3ni * t1ni[t1]) * polWeight;
+                    t1rr[t1] += leftnr[t1][i] * mut3r[i];
+                    t1ri[t1] -= leftni[t1][i] * mut3r[i];
                 }
             }
 
-
-            /* Do Propagation */
-            /* Read Hamiltonian */
-            if (read_He(non, Hamil_i_e, H_traj, tl) != 1) {
-                printf("Hamiltonian trajectory file to short, could not fill buffer!!!\n");
-                exit(1);
-            }
-
-            /* Propagate left side rephasing */
-            if (non->propagation == 1) {
-                propagate_vec_coupling_S(non, Hamil_i_e, leftrr, leftri, non->ts, 1);
-            } else if (non->propagation == 0) {
-                propagate_vec_DIA_S(non, Hamil_i_e, leftrr, leftri, 1);
-            }
-
-            /* Propagate left side nonrephasing */
-            for (int t1 = 0; t1 < non->tmax1; t1++) {
-                if (non->propagation == 0) {
-                    propagate_vec_DIA_S(
-                        non, Hamil_i_e, leftnr[t1], leftni[t1], 1
-                    );
-                } else if (non->propagation == 1) {
-                    propagate_vec_coupling_S(
-                        non, Hamil_i_e, leftnr[t1], leftni[t1], non->ts, 1
-                    );
-                }
-            }
-        }
-
-        if ((!strcmp(non->technique, "EAUVvis")) || (!strcmp(non->technique, "2DUVvis"))) {
-            /* Excited state absorption (EA) */
             /* Combine with evolution during t3 */
             for (int t3 = 0; t3 < non->tmax3; t3++) {
                 int tl = tk + t3;
-                /* Read Dipole t4 */
                 mureadE(non, mut4, tl, px[3], mu_traj, mu_xyz, pol);
-                //if (non->anharmonicity == 0) {
-                //    read_over(non, over, mu2_traj, tl, px[3]);
-                //}
-
-                /* Multiply with the last dipole */
-                dipole_double_last_ES(non, mut4, fr, fi, leftrr, leftri);
-                for (int t1 = 0; t1 < non->tmax1; t1++) {
-                    dipole_double_last_ES(non, mut4, ft1r[t1], ft1i[t1], leftnr[t1], leftni[t1]);
-                }
 
-                /* Calculate EA response */
-                for (int t1 = 0; t1 < non->tmax1; t1++) {
-                    float rrI = 0, riI = 0, rrII = 0, riII = 0;
+                /* Only the t3 times on the grid of TimeIncrement contribute */
+                if (t3 % non->dt3 == 0) {
+                    /* Calculate left side of nonrephasing diagram */
+                    float t3rr = 0, t3ri = 0;
                     for (int i = 0; i < non->singles; i++) {
-                        rrI += leftri[i] * rightrr[t1][i] + leftrr[i] * rightri[t1][i];
-                        riI += leftrr[i] * rightrr[t1][i] - rightri[t1][i] * leftri[i];
+                        t3rr += mut4[i] * leftrr[i];
+                        t3ri += mut4[i] * leftri[i];
+                    }
+
+                    /* Calculate left side of rephasing diagram */
+                    for (int t1 = 0; t1 < n1; t1++) {
+                        t1nr[t1] = 0, t1ni[t1] = 0;
+                        for (int i = 0; i < non->singles; i++) {
+                            t1nr[t1] += leftnr[t1][i] * mut4[i];
+                            t1ni[t1] += leftni[t1][i] * mut4[i];
+                        }
+                    }
 
-                        rrII += rightnr[i] * leftni[t1][i] + rightni[i] * leftnr[t1][i];
-                        riII += rightnr[i] * leftnr[t1][i] - rightni[i] * leftni[t1][i];
+                    /* Calculate Response */
+                    if ((!strcmp(non->technique, "SEUVvis")) || (!strcmp(non->technique, "2DUVvis")) || (!strcmp(
+                        non->technique, "noEAUVvis"))) {
+                        for (int t1 = 0; t1 < n1; t1++) {
+                            float polWeight = polarweight(0, molPol) * lt_gb_se[t3][t1 * non->dt1];
+                            rrIpar[r0 + t3][t1 * non->dt1] -= (t3rr * t1ri[t1] + t3ri * t1rr[t1]) * polWeight;
+                            riIpar[r0 + t3][t1 * non->dt1] -= (t3rr * t1rr[t1] - t3ri * t1ri[t1]) * polWeight;
+                            rrIIpar[r0 + t3][t1 * non->dt1] -= (t3ni * t1nr[t1] + t3nr * t1ni[t1]) * polWeight;
+                            riIIpar[r0 + t3][t1 * non->dt1] -= (t3nr * t1nr[t1] - t3ni * t1ni[t1]) * polWeight;
+                            polWeight = polarweight(1, molPol) * lt_gb_se[t3][t1 * non->dt1];
+                            rrIper[r0 + t3][t1 * non->dt1] -= (t3rr * t1ri[t1] + t3ri * t1rr[t1]) * polWeight;
+                            riIper[r0 + t3][t1 * non->dt1] -= (t3rr * t1rr[t1] - t3ri * t1ri[t1]) * polWeight;
+                            rrIIper[r0 + t3][t1 * non->dt1] -= (t3ni * t1nr[t1] + t3nr * t1ni[t1]) * polWeight;
+                            riIIper[r0 + t3][t1 * non->dt1] -= (t3nr * t1nr[t1] - t3ni * t1ni[t1]) * polWeight;
+                            polWeight = polarweight(2, molPol) * lt_gb_se[t3][t1 * non->dt1];
+                            rrIcro[r0 + t3][t1 * non->dt1] -= (t3rr * t1ri[t1] + t3ri * t1rr[t1]) * polWeight;
+                            riIcro[r0 + t3][t1 * non->dt1] -= (t3rr * t1rr[t1] - t3ri * t1ri[t1]) * polWeight;
+                            rrIIcro[r0 + t3][t1 * non->dt1] -= (t3ni * t1nr[t1] + t3nr * t1ni[t1]) * polWeight;
+                            riIIcro[r0 + t3][t1 * non->dt1] -= (t3nr * t1nr[t1] - t3ni * t1ni[t1]) * polWeight;
+                        }
                     }
+                }
+
 
-                    float polWeight = polarweight(0, molPol) * lt_ea[t3][t1];
-                    rrIpar[t3][t1] += rrI * polWeight;
-                    riIpar[t3][t1] += riI * polWeight;
-                    rrIIpar[t3][t1] += rrII * polWeight;
-                    riIIpar[t3][t1] += riII * polWeight;
-                    polWeight = polarweight(1, molPol) * lt_ea[t3][t1];
-                    rrIper[t3][t1] += rrI * polWeight;
-                    riIper[t3][t1] += riI * polWeight;
-                    rrIIper[t3][t1] += rrII * polWeight;
-                    riIIper[t3][t1] += riII * polWeight;
-                    polWeight = polarweight(2, molPol) * lt_ea[t3][t1];
-                    rrIcro[t3][t1] += rrI * polWeight;
-                    riIcro[t3][t1] += riI * polWeight;
-                    rrIIcro[t3][t1] += rrII * polWeight;
-                    riIIcro[t3][t1] += riII * polWeight;
+                /* Do Propagation */
+                if (non->propagation == 0) {
+                    /* Propagate left side rephasing and nonrephasing */
+                    propagate_vecs_cache(non, cache, Hamil_i_e, H_traj, tl, &leftrr, &leftri, 1, 1);
+                    propagate_vecs_cache(non, cache, Hamil_i_e, H_traj, tl, leftnr, leftni, n1, 1);
+                    continue;
                 }
 
                 /* Read Hamiltonian */
@@ -465,103 +506,204 @@ void calc_2DES(t_non* non, int parentRank, int parentSize, int subRank, int subS
                     printf("Hamiltonian trajectory file to short, could not fill buffer!!!\n");
                     exit(1);
                 }
+                csr_build(non, Hamil_i_e, Hs);
 
-                /* Propagate vectors left */
-                //if (non->anharmonicity == 0) {
-                //    read_A(non, Anh, A_traj, tl);
-                //}
-
-                /* Propagate */
-                if (non->propagation == 0) {
-                    float* Urs = calloc(non->singles * non->singles, sizeof(float));
-                    float* Uis = calloc(non->singles * non->singles, sizeof(float));
-
-                    int* Rs = calloc(non->singles * non->singles, sizeof(int));
-                    int* Cs = calloc(non->singles * non->singles, sizeof(int));
-
-                    // bug? Cs and Rs seems to be exchanged (TLC just multiplying with imaginary number)
-                    int elements = time_evolution_mat(non, Hamil_i_e, Urs, Uis, Cs, Rs, non->ts);
-                    if (currentSample == non->begin && molPol == 0 && t3 == 0) {
-                        printf("Sparse matrix efficiency: %f pct.\n",
-                               (1 - (1.0 * elements / (non->singles * non->singles))) * 100);
-                        printf("Present truncation %f.\n",
-                               non->thres / ((double) non->deltat * icm2ifs * (double) twoPi / non->ts * (non->deltat *
-                                   icm2ifs * twoPi / non->ts)));
-                        printf("Suggested truncation %f.\n", 0.001);
-                    }
-
-                    // Key parallel loop 1
-                    // Initial step, former t1=-1
-                    propagate_double_sparce_ES(
-                        non, Urs, Uis, Rs, Cs, fr, fi, elements, non->ts);
-
-                    int t1; // MSVC can't deal with C99 declarations inside a for with OpenMP
-                    #pragma omp parallel for \
-                        shared(non, Urs, Uis, Rs, Cs, ft1r, ft1i) \
-                        schedule(static, 1)
-
-                    for(t1 = 0; t1 < non->tmax1; t1++) {
-                        propagate_double_sparce_ES(
-                            non, Urs, Uis, Rs, Cs, ft1r[t1],
-                            ft1i[t1], elements, non->ts);
-                    }
+                if (non->propagation == 4) {
+                    /* Propagate left side rephasing and nonrephasing */
+                    propagate_block_chebyshev(non, Hs, leftrr, leftri, 1, 1);
+                    propagate_vecs_chebyshev(non, Hs, leftnr, leftni, n1, 1);
+                    continue;
+                }
 
-                    // Propagate vectors right
-                    // Key parallel loop 2
-                    // Initial step
-                    propagate_vec_DIA_S(non, Hamil_i_e, rightnr, rightni, -1);
+                /* Propagate left side rephasing */
+                if (non->propagation == 1) {
+                    propagate_vec_coupling_csr(non, Hs, leftrr, leftri, non->ts, 1);
+                }
+                if (non->propagation == 3) {
+                    propagate_vec_krylov(non, Hs, leftrr, leftri, 1);
+                }
 
-                    for(t1 = 0; t1 < non->tmax1; t1++) {
-                        propagate_vec_DIA_S(
-                            non, Hamil_i_e, rightrr[t1], rightri[t1], -1
+                /* Propagate left side nonrephasing */
+                for (int t1 = 0; t1 < n1; t1++) {
+                    if (non->propagation == 1) {
+                        propagate_vec_coupling_csr(
+                            non, Hs, leftnr[t1], leftni[t1], non->ts, 1
                         );
                     }
-
-                    free(Urs), free(Uis), free(Rs), free(Cs);
-                }
-                else if(non->propagation == 1) {
-                    // Key parallel loop 1
-                    // Initial step
-                    propagate_vec_coupling_S_doubles_ES(
-                        non, Hamil_i_e, fr, fi, non->ts); 
-
-                    int t1;
-                    #pragma omp parallel for \
-                        shared(non,Hamil_i_e,ft1r,ft1i) \
-                        schedule(static, 1)
-
-                    for (t1 = 0; t1 < non->tmax1; t1++) {
-                        propagate_vec_coupling_S_doubles_ES(
-                            non, Hamil_i_e, ft1r[t1], ft1i[t1], non->ts); 
+                    if (non->propagation == 3) {
+                        propagate_vec_krylov(non, Hs, leftnr[t1], leftni[t1], 1);
                     }
+                }
+            }
 
-                    // Key parallel loop 2
-                    // Initial step
-                    propagate_vec_coupling_S(
-                        non, Hamil_i_e, rightnr, rightni, non->ts, -1
-                    );
+            if ((!strcmp(non->technique, "EAUVvis")) || (!strcmp(non->technique, "2DUVvis"))) {
+                /* Excited state absorption (EA) */
+                /* Combine with evolution during t3 */
+                for (int t3 = 0; t3 < non->tmax3; t3++) {
+                    int tl = tk + t3;
+                    /* Read Dipole t4 */
+                    mureadE(non, mut4, tl, px[3], mu_traj, mu_xyz, pol);
+                    //if (non->anharmonicity == 0) {
+                    //    read_over(non, over, mu2_traj, tl, px[3]);
+                    //}
+
+                    /* Only the t3 times on the grid of TimeIncrement contribute */
+                    if (t3 % non->dt3 == 0) {
+                        /* Multiply with the last dipole */
+                        dipole_double_last_ES(non, mut4, fr, fi, leftrr, leftri);
+                        for (int t1 = 0; t1 < n1; t1++) {
+                            dipole_double_last_ES(non, mut4, ft1r[t1], ft1i[t1], leftnr[t1], leftni[t1]);
+                        }
+
+                        /* Calculate EA response */
+                        for (int t1 = 0; t1 < n1; t1++) {
+                            float rrI = 0, riI = 0, rrII = 0, riII = 0;
+                            for (int i = 0; i < non->singles; i++) {
+                                rrI += leftri[i] * rightrr[t1][i] + leftrr[i] * rightri[t1][i];
+                                riI += leftrr[i] * rightrr[t1][i] - rightri[t1][i] * leftri[i];
+
+                                rrII += rightnr[i] * leftni[t1][i] + rightni[i] * leftnr[t1][i];
+                                riII += rightnr[i] * leftnr[t1][i] - rightni[i] * leftni[t1][i];
+                            }
+
+                            float polWeight = polarweight(0, molPol) * lt_ea[t3][t1 * non->dt1];
+                            rrIpar[r0 + t3][t1 * non->dt1] += rrI * polWeight;
+                            riIpar[r0 + t3][t1 * non->dt1] += riI * polWeight;
+                            rrIIpar[r0 + t3][t1 * non->dt1] += rrII * polWeight;
+                            riIIpar[r0 + t3][t1 * non->dt1] += riII * polWeight;
+                            polWeight = polarweight(1, molPol) * lt_ea[t3][t1 * non->dt1];
+                            rrIper[r0 + t3][t1 * non->dt1] += rrI * polWeight;
+                            riIper[r0 + t3][t1 * non->dt1] += riI * polWeight;
+                            rrIIper[r0 + t3][t1 * non->dt1] += rrII * polWeight;
+                            riIIper[r0 + t3][t1 * non->dt1] += riII * polWeight;
+                            polWeight = polarweight(2, molPol) * lt_ea[t3][t1 * non->dt1];
+                            rrIcro[r0 + t3][t1 * non->dt1] += rrI * polWeight;
+                            riIcro[r0 + t3][t1 * non->dt1] += riI * polWeight;
+                            rrIIcro[r0 + t3][t1 * non->dt1] += rrII * polWeight;
+                            riIIcro[r0 + t3][t1 * non->dt1] += riII * polWeight;
+                        }
+                    }
 
-                    for (t1 = 0; t1 < non->tmax1; t1++) {
-                        propagate_vec_coupling_S(
-                            non, Hamil_i_e, rightrr[t1], rightri[t1], non->ts, -1
-                        );
+                    /* Read Hamiltonian */
+                    if (read_He(non, Hamil_i_e, H_traj, tl) != 1) {
+                        printf("Hamiltonian trajectory file to short, could not fill buffer!!!\n");
+                        exit(1);
+                    }
+                    if (non->propagation != 0) csr_build(non, Hamil_i_e, Hs);
+
+                    /* Propagate vectors left */
+                    //if (non->anharmonicity == 0) {
+                    //    read_A(non, Anh, A_traj, tl);
+                    //}
+
+                    /* Propagate */
+                    if (non->propagation == 0) {
+                        // bug? Cs and Rs seems to be exchanged (TLC just multiplying with imaginary number)
+                        int elements = time_evolution_mat(non, Hamil_i_e, Urs, Uis, Cs, Rs, non->ts);
+                        if (currentSample == non->begin && molPol == 0 && t3 == 0) {
+                            printf("Sparse matrix efficiency: %f pct.\n",
+                                   (1 - (1.0 * elements / (non->singles * non->singles))) * 100);
+                            printf("Present truncation %f.\n",
+                                   non->thres / ((double) non->deltat * icm2ifs * (double) twoPi / non->ts * (non->deltat *
+                                       icm2ifs * twoPi / non->ts)));
+                            printf("Suggested truncation %f.\n", 0.001);
+                        }
+
+                        if (elements > 2 * non->singles * sqrt(non->singles)) {
+                            // Dense propagator, the two exciton vectors evolve as U F U^T
+                            // without the doubly excited sites
+                            propagator_dense(non, Urs, Uis, Rs, Cs, elements, Udr, Udi);
+                            propagate_doubles_U(non, Udr, Udi, &fr, &fi, 1, non->ts, NULL);
+                            propagate_doubles_U(non, Udr, Udi, ft1r, ft1i, n1, non->ts, NULL);
+                        }
+                        else {
+                            // Key parallel loop 1
+                            // Initial step, former t1=-1
+                            propagate_double_sparce_ES(
+                                non, Urs, Uis, Rs, Cs, fr, fi, elements, non->ts);
+
+                            int t1; // MSVC can't deal with C99 declarations inside a for with OpenMP
+                            #pragma omp parallel for \
+                                shared(non, Urs, Uis, Rs, Cs, ft1r, ft1i) \
+                                schedule(static, 1)
+
+                            for(t1 = 0; t1 < n1; t1++) {
+                                propagate_double_sparce_ES(
+                                    non, Urs, Uis, Rs, Cs, ft1r[t1],
+                                    ft1i[t1], elements, non->ts);
+                            }
+                        }
+
+                        // Propagate vectors right
+                        // Key parallel loop 2
+                        // Initial step
+                        propagate_vecs_cache(non, cache, Hamil_i_e, H_traj, tl, &rightnr, &rightni, 1, -1);
+                        propagate_vecs_cache(non, cache, Hamil_i_e, H_traj, tl, rightrr, rightri, n1, -1);
+                    }
+                    else {
+                        int t1;
+                        if ((non->propagation == 3 || non->propagation == 4) && csr_dense_doubles(Hs)) {
+                            // Dense Krylov or Chebyshev propagator of the substeps, the two exciton
+                            // vectors evolve as U F U^T without the doubly excited sites
+                            if (non->propagation == 3) propagator_krylov(non, Hs, Udr, Udi, non->ts);
+                            if (non->propagation == 4) propagator_chebyshev(non, Hs, Udr, Udi, non->ts);
+                            propagate_doubles_U(non, Udr, Udi, &fr, &fi, 1, non->ts, NULL);
+                            propagate_doubles_U(non, Udr, Udi, ft1r, ft1i, n1, non->ts, NULL);
+                        }
+                        else {
+                            // Key parallel loop 1
+                            // Initial step
+                            propagate_vec_coupling_S_doubles_ES(
+                                non, Hamil_i_e, fr, fi, non->ts); 
+
+                            #pragma omp parallel for \
+                                shared(non,Hamil_i_e,ft1r,ft1i) \
+                                schedule(static, 1)
+
+                            for (t1 = 0; t1 < n1; t1++) {
+                                propagate_vec_coupling_S_doubles_ES(
+                                    non, Hamil_i_e, ft1r[t1], ft1i[t1], non->ts); 
+                            }
+                        }
+
+                        // Key parallel loop 2
+                        // Initial step
+                        if (non->propagation == 4) {
+                            propagate_block_chebyshev(non, Hs, rightnr, rightni, 1, -1);
+                            propagate_vecs_chebyshev(non, Hs, rightrr, rightri, n1, -1);
+                        } else if (non->propagation == 3) {
+                            propagate_vec_krylov(non, Hs, rightnr, rightni, -1);
+                            #pragma omp parallel for \
+                                shared(non, Hs, rightrr, rightri) \
+                                schedule(dynamic)
+                            for (t1 = 0; t1 < n1; t1++) {
+                                propagate_vec_krylov(non, Hs, rightrr[t1], rightri[t1], -1);
+                            }
+                        } else {
+                            propagate_vec_coupling_csr(
+                                non, Hs, rightnr, rightni, non->ts, -1
+                            );
+
+                            for (t1 = 0; t1 < n1; t1++) {
+                                propagate_vec_coupling_csr(
+                                    non, Hs, rightrr[t1], rightri[t1], non->ts, -1
+                                );
+                            }
+                        }
                     }
                 }
             }
-        }
 
-        free(leftrr), free(leftri), free2D((void**) leftnr), free2D((void**) leftni);
-        free2D((void**) rightrr), free2D((void**) rightri), free(rightnr), free(rightni);
-        free(t1rr), free(t1ri), free(t1nr), free(t1ni);
-        free(mut3r);
-        free(mut3i);
-        free(mut4);
-        free(fr), free(fi);
-        free2D((void**) ft1r), free2D((void**) ft1i);
+        }
 
+        markCheckpoint(&cp, item, parentRank, parentSize);
+        int converged = updateStream(&stream, non, &queue, item, parentRank);
+        if (converged >= 0) sampleCount = converged;
         counter++;
 	if (subRank==0){
-	    counter_current=counter*100.0/sampleCount/21*parentSize;
+	    // With dynamic scheduling the item number measures the progress of all processes
+	    if (queue.dynamic) counter_current=(item+1)*100.0/totalWorkItems;
+	    else counter_current=counter*100.0/sampleCount/21*parentSize;
             if (counter_current>counter_pass){
 		if (non->printLevel>0){
 		    my_current_time=MPI_Wtime();    
@@ -576,11 +718,29 @@ void calc_2DES(t_non* non, int parentRank, int parentSize, int subRank, int subS
 	}
     }
 
+    free(leftrr), free(leftri), free2D((void**) leftnr), free2D((void**) leftni);
+    free2D((void**) rightrr), free2D((void**) rightri), free(rightnr), free(rightni);
+    free(t1rr), free(t1ri), free(t1nr), free(t1ni), free(t1gr), free(t1gi);
+    free(t2rr), free(t2ri), free2D((void**) t2nr), free2D((void**) t2ni);
+    free(mut2), free(mut3r), free(mut3i), free(mut4), free(muabs);
+    free(fr), free(fi);
+    free2D((void**) ft1r), free2D((void**) ft1i);
+    free(Urs), free(Uis), free(Rs), free(Cs);
+    free(Udr), free(Udi);
+
+    freeStream(&stream);
+    freeWorkQueue(&queue, parentRank, parentSize);
+    free(completed);
+    propcache_log(cache, "2DUVvis");
+    propcache_free(cache);
+    csr_free(Hs);
+    prefetch_free(pf);
+    if (non->sharedtraj) {
+        unshareFrames(H_traj, &H_win), unshareFrames(mu_traj, &mu_win);
+    }
+
     // Reduce calculation results, in a tiered approach to save network bandwidth
-    int reduceArraySize = non->tmax3 * non->tmax1;
-    float** reductionArrays[12] = {
-        rrIpar, riIpar, rrIIpar, riIIpar, rrIper, riIper, rrIIper, riIIper, rrIcro, riIcro, rrIIcro, riIIcro
-    };
+    int reduceArraySize = nT2 * non->tmax3 * non->tmax1;
     MPI_Request reductions[2][12];
 
     // Reduce at small scope
@@ -613,6 +773,9 @@ void calc_2DES(t_non* non, int parentRank, int parentSize, int subRank, int subS
     if(parentRank == 0 || subRank == 0)
         asyncWaitForMPI(reductions[1], 12, 1, 5000);
 
+    // The absorption spectrum is obtained from the same t1 propagation
+    printAbsorption(non, re_S_1, im_S_1, sampleCount, parentRank, subRank, subComm, rootComm);
+
     /* The calculation is finished, lets write output */
     if (parentRank == 0) {
         log_item("Finished Calculating Response!\nWriting to file\n");
@@ -624,15 +787,15 @@ void calc_2DES(t_non* non, int parentRank, int parentSize, int subRank, int subS
         }
 
         /* Close Files */
-        fclose(mu_traj), fclose(H_traj);
+        traj_fclose(mu_traj), traj_fclose(H_traj);
 
         /* Print 2D */
-        print2D("RparI.dat", rrIpar, riIpar, non, sampleCount);
-        print2D("RparII.dat", rrIIpar, riIIpar, non, sampleCount);
-        print2D("RperI.dat", rrIper, riIper, non, sampleCount);
-        print2D("RperII.dat", rrIIper, riIIper, non, sampleCount);
-        print2D("RcroI.dat", rrIcro, riIcro, non, sampleCount);
-        print2D("RcroII.dat", rrIIcro, riIIcro, non, sampleCount);
+        print2Dseries("RparI.dat", rrIpar, riIpar, non, sampleCount);
+        print2Dseries("RparII.dat", rrIIpar, riIIpar, non, sampleCount);
+        print2Dseries("RperI.dat", rrIper, riIper, non, sampleCount);
+        print2Dseries("RperII.dat", rrIIper, riIIper, non, sampleCount);
+        print2Dseries("RcroI.dat", rrIcro, riIcro, non, sampleCount);
+        print2Dseries("RcroII.dat", rrIIcro, riIIcro, non, sampleCount);
 
         printf("----------------------------------------\n");
         printf(" 2DES calculation succesfully completed\n");
@@ -650,14 +813,18 @@ void calc_2DES(t_non* non, int parentRank, int parentSize, int subRank, int subS
     free2D((void**)rrIIper), free2D((void**)riIIper);
     free2D((void**)rrIcro), free2D((void**)riIcro);
     free2D((void**)rrIIcro), free2D((void**)riIIcro);
+    free(re_S_1), free(im_S_1);
     free(mu_xyz);
     free2D((void**)lt_gb_se);
     free2D((void**)lt_ea);
-    free(workset); free(worksetSizes);
+    free(workset);
     free(Hamil_i_e);
 
     // Barrier to gather all threads and exit simultaneously
     MPI_Request barrierRequest[1];
     MPI_Ibarrier(MPI_COMM_WORLD, &(barrierRequest[0]));
     asyncWaitForMPI(barrierRequest, 1, 1, 5000);
+
+    // The results are written, the checkpoints are no longer needed
+    freeCheckpoint(&cp, parentRank);
 }
@@ -11,47 +11,45 @@
 #include "omp.h"
 #include "types.h"
 #include "NISE_subs.h"
+#include "trajectory.h"
 #include "polar.h"
 #include "calc_2DIR.h"
 #include <stdarg.h>
 #include "mpi.h"
 #include "MPI_subs.h"
+#include "propagator_cache.h"
+#include "prefetch.h"
+#include "convergence.h"
+#include "sparse.h"
+#include "krylov.h"
+#include "chebyshev.h"
+#include "1DFFT.h"
+#include "absorption.h"
 
 void calc_2DIR(t_non* non, int parentRank, int parentSize, int subRank, int subSize, MPI_Comm subComm, MPI_Comm rootComm) {
     // Start by determining the work to be done, make an array of samples/poldir to simulate
-    // and distribute those statically over all processors
-    int clusterCount = 0, sampleCount = 0, * workset, * worksetSizes = calloc(parentSize, sizeof(int));;
+    // and send it to all processors, which take items from it through a work queue
+    int clusterCount = 0, sampleCount = 0, totalWorkItems = 0, * workset;
     int counter,counter_pass;
     float counter_current;
     double my_time,my_current_time;
     counter=0,counter_pass=1;
+    // In batched orientation mode one work item covers all polarization directions of a sample
+    int polItems = non->orientation == 1 ? 1 : 21;
     if(parentRank == 0) {
         // Master process calculates the work items to be performed
         int* fullWorkset;
-        calculateWorkset(non, &fullWorkset, &sampleCount, &clusterCount);
+        calculateWorkset(non, &fullWorkset, &sampleCount, &clusterCount, polItems);
         log_item("Begin sample: %d, End sample: %d.\n", non->begin, non->end);
 
-        // Distribute work, each process does as many items as the others (static decomposition)
+        // Send the work items to all processes
         MPI_Bcast(&clusterCount, 1, MPI_INT, 0, MPI_COMM_WORLD);
         MPI_Bcast(&sampleCount, 1, MPI_INT, 0, MPI_COMM_WORLD);
 
-        int totalWorkItems = 21 * sampleCount;
-        int baseWorksetSize = totalWorkItems / parentSize;
-        int remainder = totalWorkItems % parentSize;
-
-        // Make array of worksetsizes, since each process might have a different workset size, distribute that array to the other processes
-        int* worksetOffsets = calloc(parentSize, sizeof(int));
-        for(int i = 0; i < parentSize; i++) {
-            worksetSizes[i] = i < remainder ? (baseWorksetSize + 1) * 2 : baseWorksetSize * 2;
-            worksetOffsets[i] = i == 0 ? 0 : worksetOffsets[i - 1] + worksetSizes[i];
-        }
-
-        MPI_Bcast(worksetSizes, parentSize, MPI_INT, 0, MPI_COMM_WORLD);
-        workset = malloc(worksetSizes[0] * sizeof(int));
-        MPI_Scatterv(fullWorkset, worksetSizes, worksetOffsets, MPI_INT, workset, worksetSizes[0], MPI_INT, 0, MPI_COMM_WORLD);
-
-        free(fullWorkset);
-        free(worksetOffsets);
+        totalWorkItems = polItems * sampleCount;
+        MPI_Bcast(&totalWorkItems, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        workset = fullWorkset;
+        MPI_Bcast(workset, 2 * totalWorkItems, MPI_INT, 0, MPI_COMM_WORLD);
     } else {
         // Fix non settings
         const int totalSampleCount = (non->length - non->tmax1 - non->tmax2 - non->tmax3 - 1) / non->sample + 1;
@@ -61,9 +59,9 @@ void calc_2DIR(t_non* non, int parentRank, int parentSize, int subRank, int subS
         MPI_Bcast(&clusterCount, 1, MPI_INT, 0, MPI_COMM_WORLD);
         MPI_Bcast(&sampleCount, 1, MPI_INT, 0, MPI_COMM_WORLD);
 
-        MPI_Bcast(worksetSizes, parentSize, MPI_INT, 0, MPI_COMM_WORLD);
-        workset = malloc(worksetSizes[parentRank] * sizeof(int));
-        MPI_Scatterv(NULL, NULL, NULL, MPI_INT, workset, worksetSizes[parentRank], MPI_INT, 0, MPI_COMM_WORLD);
+        MPI_Bcast(&totalWorkItems, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        workset = malloc(2 * totalWorkItems * sizeof(int));
+        MPI_Bcast(workset, 2 * totalWorkItems, MPI_INT, 0, MPI_COMM_WORLD);
     }
 
     // Initialize each process base variables
@@ -78,23 +76,29 @@ void calc_2DIR(t_non* non, int parentRank, int parentSize, int subRank, int subS
     non->shiftf = 2 * shift1;
 
     // Arrays where the result is stored, these will be reduced (summed) at the end!
+    // For a t2 series the tmax3 rows of each waiting time follow each other
+    const int nT2 = waitingTimes(non);
 
     // 2D response function parallel
-    float** rrIpar = (float**) calloc2D(non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
-    float** riIpar = (float**)calloc2D(non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
-    float** rrIIpar = (float**)calloc2D(non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
-    float** riIIpar = (float**)calloc2D(non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
+    float** rrIpar = (float**) calloc2D(nT2 * non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
+    float** riIpar = (float**)calloc2D(nT2 * non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
+    float** rrIIpar = (float**)calloc2D(nT2 * non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
+    float** riIIpar = (float**)calloc2D(nT2 * non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
     // 2D response function perpendicular
-    float** rrIper = (float**)calloc2D(non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
-    float** riIper = (float**)calloc2D(non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
-    float** rrIIper = (float**)calloc2D(non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
-    float** riIIper = (float**)calloc2D(non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
+    float** rrIper = (float**)calloc2D(nT2 * non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
+    float** riIper = (float**)calloc2D(nT2 * non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
+    float** rrIIper = (float**)calloc2D(nT2 * non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
+    float** riIIper = (float**)calloc2D(nT2 * non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
     // 2D response function cross
-    float** rrIcro = (float**)calloc2D(non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
-    float** riIcro = (float**)calloc2D(non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
-    float** rrIIcro = (float**)calloc2D(non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
-    float** riIIcro = (float**)calloc2D(non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
+    float** rrIcro = (float**)calloc2D(nT2 * non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
+    float** riIcro = (float**)calloc2D(nT2 * non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
+    float** rrIIcro = (float**)calloc2D(nT2 * non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
+    float** riIIcro = (float**)calloc2D(nT2 * non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // REDUCE
+
 
+    // Linear response from the t1 vectors, written as the absorption spectrum
+    float* re_S_1 = calloc(non->tmax1, sizeof(float)); // REDUCE
+    float* im_S_1 = calloc(non->tmax1, sizeof(float)); // REDUCE
 
     // These arrays are initialized here and only read in the loops
     float** lt_gb_se = (float**)calloc2D(non->tmax3, non->tmax1, sizeof(float), sizeof(float*)); // RO
@@ -120,11 +124,14 @@ void calc_2DIR(t_non* non, int parentRank, int parentSize, int subRank, int subS
         MPI_Abort(MPI_COMM_WORLD, 1);
     }
 
+    // The pump probe signal contains all diagrams of the 2DIR response at t1=0 only
+    const int pumpProbe = !strcmp(non->technique, "PumpProbe");
+
     /* Open file for fluctuating anharmonicities and sequence transition dipoles if needed */
-    FILE* A_traj, *mu2_traj;
+    FILE* A_traj = NULL, *mu2_traj = NULL;
     if (non->anharmonicity == 0 && (!strcmp(non->technique, "2DIR") || (!strcmp(non->technique, "EAIR")) || (!
             strcmp(non->technique, "noEAIR")) || (!strcmp(non->technique, "GBIR")) || (!strcmp(
-            non->technique, "SEIR")))) {
+            non->technique, "SEIR")) || pumpProbe)) {
         A_traj = fopen(non->anharFName, "rb");
         if (A_traj == NULL) {
             if (parentRank == 0) printf("Anharmonicity file %s not found!\n", non->anharFName);
@@ -150,7 +157,7 @@ void calc_2DIR(t_non* non, int parentRank, int parentSize, int subRank, int subS
             if (parentRank == 0) printf("Coupling trajectory file to short, could not fill buffer!!!\n");
             MPI_Abort(MPI_COMM_WORLD, 1);
         }
-        fclose(C_traj);
+        traj_fclose(C_traj);
 
         for (int x = 0; x < 3; x++) {
             if (read_mue(non, mu_xyz + non->singles * x, mu_traj, 0, x) != 1) {
@@ -161,318 +168,448 @@ void calc_2DIR(t_non* non, int parentRank, int parentSize, int subRank, int subS
         }
     }
 
+    // Cache of the one exciton propagators for the Sparse propagation scheme
+    t_propcache* cache = non->propagation == 0 ? propcache_init(non) : NULL;
+    // Sparse Hamiltonian of the frame for the other propagation schemes
+    t_csr* Hs = csr_init(non->singles);
+
+    // Read the frames of all samples once per node into shared memory if requested
+    MPI_Win H_win, mu_win, A_win, mu2_win;
+    const int firstFrame = non->begin * non->sample;
+    const int frameCount = (non->end - non->begin - 1) * non->sample + non->tmax1 + non->tmax2 + non->tmax3 + 1;
+    if (non->sharedtraj) {
+        H_win = shareFrames(H_traj, He_frame_bytes(non), firstFrame, frameCount, subRank, subComm);
+        mu_win = shareFrames(mu_traj, mue_frame_bytes(non), firstFrame, frameCount, subRank, subComm);
+        if (A_traj != NULL) {
+            A_win = shareFrames(A_traj, sizeof(int) + sizeof(float) * non->singles, firstFrame, frameCount,
+                                subRank, subComm);
+            mu2_win = shareFrames(mu2_traj, sizeof(int) + sizeof(float) * 3 * non->singles, firstFrame,
+                                  frameCount, subRank, subComm);
+        }
+    }
+
+    // Reader thread for the frames of the coming samples, not needed with shared frames
+    t_prefetch* pf = non->sharedtraj ? NULL : prefetch_init(non, H_traj, mu_traj);
+
     // Start clock
     if (parentRank==0){
 	my_time=MPI_Wtime();
     }
 
-    // From now on we'll do the calculations
-    for (int currentWorkItem = 0; currentWorkItem < worksetSizes[parentRank]; currentWorkItem += 2) {
-        int currentSample = workset[currentWorkItem];
-        int molPol = workset[currentWorkItem + 1];
+    // Number of Cartesian dipole components propagated per interaction. Normally each work item is
+    // one molecular polarization direction using a single component per interaction. In batched
+    // orientation mode a work item is a full sample, where the x, y, and z components are propagated
+    // once and all 21 orientational contributions are assembled from them.
+    const int nc = non->orientation == 1 ? 3 : 1;
+    const int nc2 = nc * nc;
+    const int nMolPol = non->orientation == 1 ? 21 : 1;
+    // Only the t1 times on the grid of TimeIncrement get a vector
+    const int n1 = t1Points(non);
+
+    // Allocate the work item arrays once, they are reused for all work items
+    float* Anh = calloc(non->singles, sizeof(float));
+    float** over = (float**)calloc2D(nc, non->singles, sizeof(float), sizeof(float*));
+
+    float** leftrr = (float**)calloc2D(nc, non->singles, sizeof(float), sizeof(float*));
+    float** leftri = (float**)calloc2D(nc, non->singles, sizeof(float), sizeof(float*));
+    float** leftnr = (float**)calloc2D(nc * n1, non->singles, sizeof(float), sizeof(float*));
+    float** leftni = (float**)calloc2D(nc * n1, non->singles, sizeof(float), sizeof(float*));
+    float** rightrr = (float**)calloc2D(nc * n1, non->singles, sizeof(float), sizeof(float*));
+    float** rightri = (float**)calloc2D(nc * n1, non->singles, sizeof(float), sizeof(float*));
+    float** rightnr = (float**)calloc2D(nc, non->singles, sizeof(float), sizeof(float*));
+    float** rightni = (float**)calloc2D(nc, non->singles, sizeof(float), sizeof(float*));
+    float* lastr = calloc(non->singles, sizeof(float));
+    float* lasti = calloc(non->singles, sizeof(float));
+    float* muabs = calloc(non->singles, sizeof(float));
+    float** lastt1r = (float**)calloc2D(n1, non->singles, sizeof(float), sizeof(float*));
+    float** lastt1i = (float**)calloc2D(n1, non->singles, sizeof(float), sizeof(float*));
+
+    float** mut2 = (float**)calloc2D(nc, non->singles, sizeof(float), sizeof(float*));
+    float** mut3r = (float**)calloc2D(nc, non->singles, sizeof(float), sizeof(float*));
+    float** mut3i = (float**)calloc2D(nc, non->singles, sizeof(float), sizeof(float*));
+    float** mut4 = (float**)calloc2D(nc, non->singles, sizeof(float), sizeof(float*));
+
+    float** fr = (float**)calloc2D(nc2, nn2, sizeof(float), sizeof(float*));
+    float** fi = (float**)calloc2D(nc2, nn2, sizeof(float), sizeof(float*));
+    float** ft1r = (float**)calloc2D(nc2 * n1, nn2, sizeof(float), sizeof(float*));
+    float** ft1i = (float**)calloc2D(nc2 * n1, nn2, sizeof(float), sizeof(float*));
+
+    // Overlaps are stored for every combination of components of the two interactions
+    float* t1nr = calloc(nc2 * n1, sizeof(float));
+    float* t1ni = calloc(nc2 * n1, sizeof(float));
+    float* t1rr = calloc(nc2 * n1, sizeof(float));
+    float* t1ri = calloc(nc2 * n1, sizeof(float));
+    float* t1gr = calloc(nc2 * n1, sizeof(float));
+    float* t1gi = calloc(nc2 * n1, sizeof(float));
+
+    // Vectors at the waiting time reached, kept for the next waiting time of a t2 series
+    float** t2rr = (float**)calloc2D(nc, non->singles, sizeof(float), sizeof(float*));
+    float** t2ri = (float**)calloc2D(nc, non->singles, sizeof(float), sizeof(float*));
+    float** t2nr = (float**)calloc2D(nc * n1, non->singles, sizeof(float), sizeof(float*));
+    float** t2ni = (float**)calloc2D(nc * n1, non->singles, sizeof(float), sizeof(float*));
+
+    // Sparse time evolution operator for the two exciton propagation
+    float* Urs = calloc(non->singles * non->singles, sizeof(float));
+    float* Uis = calloc(non->singles * non->singles, sizeof(float));
+    int* Rs = calloc(non->singles * non->singles, sizeof(int));
+    int* Cs = calloc(non->singles * non->singles, sizeof(int));
+    float* Udr = calloc(non->singles * non->singles, sizeof(float));
+    float* Udi = calloc(non->singles * non->singles, sizeof(float));
+
+    // Checkpoints of the accumulated response, completed items are skipped on restart
+    float** reductionArrays[12] = {
+        rrIpar, riIpar, rrIIpar, riIIpar, rrIper, riIper, rrIIper, riIIper, rrIcro, riIcro, rrIIcro, riIIcro
+    };
+    t_checkpoint cp;
+    char* completed = initCheckpoint(&cp, non, reductionArrays, 12, totalWorkItems, parentRank, parentSize);
 
-        if (currentSample == -1 || molPol == -1) continue;
+    // Intermediate spectra and convergence monitoring
+    char* streamNames[6] = { "RparI.dat", "RparII.dat", "RperI.dat", "RperII.dat", "RcroI.dat", "RcroII.dat" };
+    t_stream stream;
+    initStream(&stream, non, reductionArrays, streamNames, 12, polItems, completed, totalWorkItems, parentRank);
 
-        /* Calculate 2DIR response */
-        int tj = currentSample * non->sample + non->tmax1;
-        int tk = tj + non->tmax2;
-        int px[4];
-        polar(px, molPol);
-
-        // Allocate arrays
-        float* Anh = calloc(non->singles, sizeof(float));
-        float* over = calloc(non->singles, sizeof(float));
-
-        float* leftrr = calloc(non->singles, sizeof(float));
-        float* leftri = calloc(non->singles, sizeof(float));
-        float** leftnr = (float**)calloc2D(non->tmax1, non->singles, sizeof(float), sizeof(float*));
-        float** leftni = (float**)calloc2D(non->tmax1, non->singles, sizeof(float), sizeof(float*));
-        float** rightrr = (float**)calloc2D(non->tmax1, non->singles, sizeof(float), sizeof(float*));
-        float** rightri = (float**)calloc2D(non->tmax1, non->singles, sizeof(float), sizeof(float*));
-        float* rightnr = calloc(non->singles, sizeof(float));
-        float* rightni = calloc(non->singles, sizeof(float));
-
-        float* mut2 = calloc(non->singles, sizeof(float));
-        float* mut3r = calloc(non->singles, sizeof(float));
-        float* mut3i = calloc(non->singles, sizeof(float));
-        float* mut4 = calloc(non->singles, sizeof(float));
-
-        float* fr = calloc(nn2, sizeof(float));
-        float* fi = calloc(nn2, sizeof(float));
-        float** ft1r = (float**)calloc2D(non->tmax1, nn2, sizeof(float), sizeof(float*));
-        float** ft1i = (float**)calloc2D(non->tmax1, nn2, sizeof(float), sizeof(float*));
-        // Read information
-        mureadE(non, mut2, tj, px[1], mu_traj, mu_xyz, pol);
+    // From now on we'll do the calculations, taking work items until none are left
+    t_workqueue queue;
+    initWorkQueue(&queue, totalWorkItems, non->scheduling, parentRank, parentSize);
+    for (int item = nextWorkItem(&queue); item >= 0; item = nextWorkItem(&queue)) {
+        int currentSample = workset[2 * item];
+        int molPol = workset[2 * item + 1];
 
-        /* Ground state bleach (GB) kI and kII */
-        for (int t1 = 0; t1 < non->tmax1; t1++) {
-            /* Read dipoles at time 0 */
-            mureadE(non, leftnr[t1], tj - t1, px[0], mu_traj, mu_xyz, pol);
-            clearvec(leftni[t1], non->singles);
-
-            /* Propagate */
-            for (int tm = 0; tm < t1; tm++) {
-                /* Read Hamiltonian */
-                if (read_He(non, Hamil_i_e, H_traj, tj - t1 + tm) != 1) {
-                    printf("Hamiltonian trajectory file to short, could not fill buffer!!!\n");
-                    exit(1);
-                }
-
-                if (non->propagation == 1) {
-                    propagate_vec_coupling_S(
-                        non, Hamil_i_e, leftnr[t1], leftni[t1], non->ts, 1
-                    );
-                } else if (non->propagation == 0) {
-                    propagate_vec_DIA_S(non, Hamil_i_e, leftnr[t1], leftni[t1], 1);
-                }
+        if (currentSample == -1 || molPol == -1 || completed[item]) continue;
 
+        /* Calculate 2DIR response */
+        int tj = currentSample * non->sample + non->tmax1;
+        read_ahead(non, H_traj, mu_traj, tj - non->tmax1, non->tmax1 + non->tmax2 + non->tmax3 + 1);
+        prefetch_window(pf, tj - non->tmax1, non->tmax1 + non->tmax2 + non->tmax3 + 1);
+
+        /* Find the molecular polarization directions of this work item, the index of */
+        /* the propagated component for each interaction (ix) and its Cartesian direction (comp) */
+        int molPols[21], ix[21][4], comp[4][3];
+        for (int m = 0; m < nMolPol; m++) {
+            int px[4];
+            molPols[m] = nMolPol == 21 ? m : molPol;
+            polar(px, molPols[m]);
+            for (int k = 0; k < 4; k++) {
+                ix[m][k] = nc == 3 ? px[k] : 0;
+                comp[k][ix[m][k]] = px[k];
             }
         }
 
-        float* t1nr = calloc(non->tmax1, sizeof(float));
-        float* t1ni = calloc(non->tmax1, sizeof(float));
+        // Read information
+        for (int c = 0; c < nc; c++) {
+            mureadE(non, mut2[c], tj, comp[1][c], mu_traj, mu_xyz, pol);
+        }
 
-        for (int t1 = 0; t1 < non->tmax1; t1++) {
-            t1nr[t1] = 0, t1ni[t1] = 0;
-            for (int i = 0; i < non->singles; i++) {
-                t1nr[t1] += mut2[i] * leftnr[t1][i];
-                t1ni[t1] += mut2[i] * leftni[t1][i];
+        /* Ground state bleach (GB) kI and kII */
+        /* Read dipoles at time 0 */
+        for (int c = 0; c < nc; c++) {
+            for (int t1 = 0; t1 < n1; t1++) {
+                mureadE(non, leftnr[c * n1 + t1], tj - t1 * non->dt1, comp[0][c], mu_traj, mu_xyz, pol);
+                clearvec(leftni[c * n1 + t1], non->singles);
             }
         }
 
-        free(mut2);
-
-        /* Combine with evolution during t3 */
-        mureadE(non, mut3r, tk, px[2], mu_traj, mu_xyz, pol);
-        clearvec(mut3i, non->singles);
-        for (int t3 = 0; t3 < non->tmax3; t3++) {
-            int tl = tk + t3;
-            mureadE(non, mut4, tl, px[3], mu_traj, mu_xyz, pol);
-            
-            /* Calculate GB contributions */
-            if ((!strcmp(non->technique, "GBIR")) || (!strcmp(non->technique, "2DIR")) || (!strcmp(
-                non->technique, "noEAIR"))) {
-                float t3nr = 0, t3ni = 0;
-                for (int i = 0; i < non->singles; i++) {
-                    t3nr += mut4[i] * mut3r[i];
-                    t3ni += mut4[i] * mut3i[i];
-                }
-
-                for (int t1 = 0; t1 < non->tmax1; t1++) {
-                    float polWeight = polarweight(0, molPol) * lt_gb_se[t3][t1];
-                    rrIpar[t3][t1] -= (t3ni * t1nr[t1] - t3nr * t1ni[t1]) * polWeight;
-                    riIpar[t3][t1] -= (t3nr * t1nr[t1] + t3ni * t1ni[t1]) * polWeight;
-                    rrIIpar[t3][t1] -= (t3ni * t1nr[t1] + t3nr * t1ni[t1]) * polWeight;
-                    riIIpar[t3][t1] -= (t3nr * t1nr[t1] - t3ni * t1ni[t1]) * polWeight;
-                    polWeight = polarweight(1, molPol) * lt_gb_se[t3][t1];
-                    rrIper[t3][t1] -= (t3ni * t1nr[t1] - t3nr * t1ni[t1]) * polWeight;
-                    riIper[t3][t1] -= (t3nr * t1nr[t1] + t3ni * t1ni[t1]) * polWeight;
-                    rrIIper[t3][t1] -= (t3ni * t1nr[t1] + t3nr * t1ni[t1]) * polWeight;
-                    riIIper[t3][t1] -= (t3nr * t1nr[t1] - t3ni * t1ni[t1]) * polWeight;
-                    polWeight = polarweight(2, molPol) * lt_gb_se[t3][t1];
-                    rrIcro[t3][t1] -= (t3ni * t1nr[t1] - t3nr * t1ni[t1]) * polWeight;
-                    riIcro[t3][t1] -= (t3nr * t1nr[t1] + t3ni * t1ni[t1]) * polWeight;
-                    rrIIcro[t3][t1] -= (t3ni * t1nr[t1] + t3nr * t1ni[t1]) * polWeight;
-                    riIIcro[t3][t1] -= (t3nr * t1nr[t1] - t3ni * t1ni[t1]) * polWeight;
+        /* Propagate all t1 vectors in one forward sweep over the trajectory. At time tm */
+        /* the vectors starting at or before tm (t1 >= tj - tm) take one step, such that */
+        /* each Hamiltonian is read and exponentiated only once */
+        for (int tm = tj - (n1 - 1) * non->dt1; tm < tj; tm++) {
+            int first = (tj - tm + non->dt1 - 1) / non->dt1;
+            if (non->propagation == 0) {
+                for (int c = 0; c < nc; c++) {
+                    int v0 = c * n1 + first;
+                    propagate_vecs_cache(non, cache, Hamil_i_e, H_traj, tm, leftnr + v0, leftni + v0,
+                                         n1 - first, 1);
                 }
+                continue;
             }
 
             /* Read Hamiltonian */
-            if (read_He(non, Hamil_i_e, H_traj, tl) != 1) {
+            if (read_He(non, Hamil_i_e, H_traj, tm) != 1) {
                 printf("Hamiltonian trajectory file to short, could not fill buffer!!!\n");
                 exit(1);
             }
+            csr_build(non, Hamil_i_e, Hs);
 
-            /* Propagate */
-            if (non->propagation == 1) propagate_vec_coupling_S(non, Hamil_i_e, mut3r, mut3i, non->ts, 1);
-            if (non->propagation == 0) propagate_vec_DIA_S(non, Hamil_i_e, mut3r, mut3i, 1);
+            for (int c = 0; c < nc; c++) {
+                int v0 = c * n1 + first;
+                if (non->propagation == 1) {
+                    int v;
+                    #pragma omp parallel for \
+                        shared(non, Hs, leftnr, leftni) \
+                        schedule(static, 1)
+                    for (v = v0; v < (c + 1) * n1; v++) {
+                        propagate_vec_coupling_csr(non, Hs, leftnr[v], leftni[v], non->ts, 1);
+                    }
+                }
+                if (non->propagation == 3) {
+                    int v;
+                    #pragma omp parallel for \
+                        shared(non, Hs, leftnr, leftni) \
+                        schedule(dynamic)
+                    for (v = v0; v < (c + 1) * n1; v++) {
+                        propagate_vec_krylov(non, Hs, leftnr[v], leftni[v], 1);
+                    }
+                }
+                if (non->propagation == 4) {
+                    propagate_vecs_chebyshev(non, Hs, leftnr + v0, leftni + v0, n1 - first, 1);
+                }
+            }
         }
 
-        /* Stimulated emission (SE) */
-        /* Calculate evolution during t2 */
-        mureadE(non, leftrr, tj, px[1], mu_traj, mu_xyz, pol);
-        clearvec(leftri, non->singles);
-        for (int t2 = 0; t2 < non->tmax2; t2++) {
-            int tm = tj + t2;
-            if (read_He(non, Hamil_i_e, H_traj, tm) != 1) {
-                printf("Hamiltonian trajectory file to short, could not fill buffer!!!\n");
-                exit(1);
+        /* The linear response is the overlap of the t1 vectors with the dipole of the */
+        /* same component at tj, each component is included once per sample */
+        if (!pumpProbe && (nc == 3 || molPol < 3)) {
+            for (int c = 0; c < nc; c++) {
+                copyvec(mut2[c], muabs, non->singles);
+                if (non->Npsites > 0) projection(muabs, non);
+                for (int t1 = 0; t1 < n1; t1++) {
+                    calc_S1(re_S_1, im_S_1, t1 * non->dt1, non, leftnr[c * n1 + t1], leftni[c * n1 + t1], muabs);
+                }
             }
-
-
-	    propagate_t2_DIA(non, Hamil_i_e, leftrr, leftri,leftnr,leftni, 1);
-/*            propagate_vec_DIA(non, Hamil_i_e, leftrr, leftri, 1);
-
-            int t1;
-            #pragma omp parallel for \
-                shared(non, Hamil_i_e, leftnr, leftni) \
-                schedule(static,1)
-                
-            for (t1 = 0; t1 < non->tmax1; t1++) {
-                propagate_vec_DIA(
-                    non, Hamil_i_e, leftnr[t1], leftni[t1], 1
-                );
-            }*/
         }
 
-        /* Read dipole for third interaction */
-        mureadE(non, mut3r, tk, px[2], mu_traj, mu_xyz, pol);
-
-        if ((!strcmp(non->technique, "EAIR")) || (!strcmp(non->technique, "2DIR"))) {
-            if (non->anharmonicity == 0) {
-                read_over(non, over, mu2_traj, tk, px[2]);
-            }
-            /* T2 propagation ended store vectors needed for EA */
-            dipole_double(non, mut3r, leftrr, leftri, fr, fi,over);
-            for (int t1 = 0; t1 < non->tmax1; t1++) {
-                dipole_double(non, mut3r, leftnr[t1], leftni[t1],ft1r[t1], ft1i[t1],over);
+        for (int c0 = 0; c0 < nc; c0++) {
+            for (int c1 = 0; c1 < nc; c1++) {
+                for (int t1 = 0; t1 < n1; t1++) {
+                    int o = (c0 * nc + c1) * n1 + t1, v = c0 * n1 + t1;
+                    t1gr[o] = 0, t1gi[o] = 0;
+                    for (int i = 0; i < non->singles; i++) {
+                        t1gr[o] += mut2[c1][i] * leftnr[v][i];
+                        t1gi[o] += mut2[c1][i] * leftni[v][i];
+                    }
+                }
             }
+        }
 
-            memcpy(rightrr[0], leftnr[0], non->tmax1 * non->singles * sizeof(float));
-            memcpy(rightri[0], leftni[0], non->tmax1* non->singles * sizeof(float));
-            for (int i = 0; i < non->tmax1 * non->singles; i++) rightri[0][i] = -rightri[0][i];
-
-            memcpy(rightnr, leftrr, non->singles * sizeof(float));
-            memcpy(rightni, leftri, non->singles * sizeof(float));
-            for (int i = 0; i < non->singles; i++) rightni[i] = -rightni[i];
+        /* The t1 vectors are shared by all waiting times, the evolution during t2 */
+        /* continues from one waiting time to the next */
+        for (int c = 0; c < nc; c++) {
+            mureadE(non, t2rr[c], tj, comp[1][c], mu_traj, mu_xyz, pol);
+            clearvec(t2ri[c], non->singles);
         }
+        memcpy(t2nr[0], leftnr[0], nc * n1 * non->singles * sizeof(float));
+        memcpy(t2ni[0], leftni[0], nc * n1 * non->singles * sizeof(float));
+        int t2 = 0;
+        for (int w = 0; w < nT2; w++) {
+            int tk = tj + waitingTime(non, w);
+            int r0 = w * non->tmax3; // First row of the response of this waiting time
 
-        clearvec(mut3i, non->singles);
+            /* Combine with evolution during t3 */
+            for (int c = 0; c < nc; c++) {
+                mureadE(non, mut3r[c], tk, comp[2][c], mu_traj, mu_xyz, pol);
+                clearvec(mut3i[c], non->singles);
+            }
+            for (int t3 = 0; t3 < non->tmax3; t3++) {
+                int tl = tk + t3;
+                for (int c = 0; c < nc; c++) {
+                    mureadE(non, mut4[c], tl, comp[3][c], mu_traj, mu_xyz, pol);
+                }
+            
+                /* Calculate GB contributions */
+                if (t3 % non->dt3 == 0 && ((!strcmp(non->technique, "GBIR")) || (!strcmp(non->technique, "2DIR")) ||
+                    (!strcmp(non->technique, "noEAIR")) || pumpProbe)) {
+                    float t3gr[9], t3gi[9];
+                    for (int c2 = 0; c2 < nc; c2++) {
+                        for (int c3 = 0; c3 < nc; c3++) {
+                            t3gr[c2 * nc + c3] = 0, t3gi[c2 * nc + c3] = 0;
+                            for (int i = 0; i < non->singles; i++) {
+                                t3gr[c2 * nc + c3] += mut4[c3][i] * mut3r[c2][i];
+                                t3gi[c2 * nc + c3] += mut4[c3][i] * mut3i[c2][i];
+                            }
+                        }
+                    }
 
-        /* Calculate right side of nonrephasing diagram */
-        float t3nr = 0, t3ni = 0;
-        for (int i = 0; i < non->singles; i++) {
-            t3nr += leftrr[i] * mut3r[i];
-            t3ni -= leftri[i] * mut3r[i];
-        }
+                    for (int m = 0; m < nMolPol; m++) {
+                        float t3nr = t3gr[ix[m][2] * nc + ix[m][3]], t3ni = t3gi[ix[m][2] * nc + ix[m][3]];
+                        float* t1mr = t1gr + (ix[m][0] * nc + ix[m][1]) * n1;
+                        float* t1mi = t1gi + (ix[m][0] * nc + ix[m][1]) * n1;
+                        for (int t1 = 0; t1 < n1; t1++) {
+                            float polWeight = polarweight(0, molPols[m]) * lt_gb_se[t3][t1 * non->dt1];
+                            rrIpar[r0 + t3][t1 * non->dt1] -= (t3ni * t1mr[t1] - t3nr * t1mi[t1]) * polWeight;
+                            riIpar[r0 + t3][t1 * non->dt1] -= (t3nr * t1mr[t1] + t3ni * t1mi[t1]) * polWeight;
+                            rrIIpar[r0 + t3][t1 * non->dt1] -= (t3ni * t1mr[t1] + t3nr * t1mi[t1]) * polWeight;
+                            riIIpar[r0 + t3][t1 * non->dt1] -= (t3nr * t1mr[t1] - t3ni * t1mi[t1]) * polWeight;
+                            polWeight = polarweight(1, molPols[m]) * lt_gb_se[t3][t1 * non->dt1];
+                            rrIper[r0 + t3][t1 * non->dt1] -= (t3ni * t1mr[t1] - t3nr * t1mi[t1]) * polWeight;
+                            riIper[r0 + t3][t1 * non->dt1] -= (t3nr * t1mr[t1] + t3ni * t1mi[t1]) * polWeight;
+                            rrIIper[r0 + t3][t1 * non->dt1] -= (t3ni * t1mr[t1] + t3nr * t1mi[t1]) * polWeight;
+                            riIIper[r0 + t3][t1 * non->dt1] -= (t3nr * t1mr[t1] - t3ni * t1mi[t1]) * polWeight;
+                            polWeight = polarweight(2, molPols[m]) * lt_gb_se[t3][t1 * non->dt1];
+                            rrIcro[r0 + t3][t1 * non->dt1] -= (t3ni * t1mr[t1] - t3nr * t1mi[t1]) * polWeight;
+                            riIcro[r0 + t3][t1 * non->dt1] -= (t3nr * t1mr[t1] + t3ni * t1mi[t1]) * polWeight;
+                            rrIIcro[r0 + t3][t1 * non->dt1] -= (t3ni * t1mr[t1] + t3nr * t1mi[t1]) * polWeight;
+                            riIIcro[r0 + t3][t1 * non->dt1] -= (t3nr * t1mr[t1] - t3ni * t1mi[t1]) * polWeight;
+                        }
+                    }
+                }
 
-        /* Calculate right side of rephasing diagram */
-        float* t1rr = calloc(non->tmax1, sizeof(float));
-        float* t1ri = calloc(non->tmax1, sizeof(float));
+                /* Propagate */
+                if (non->propagation == 0) {
+                    propagate_vecs_cache(non, cache, Hamil_i_e, H_traj, tl, mut3r, mut3i, nc, 1);
+                    continue;
+                }
 
-        for (int t1 = 0; t1 < non->tmax1; t1++) {
-            t1rr[t1] = 0, t1ri[t1] = 0;
-            for (int i = 0; i < non->singles; i++) {
-                t1rr[t1] += leftnr[t1][i] * mut3r[i];
-                t1ri[t1] -= leftni[t1][i] * mut3r[i];
-            }
-        }
+                /* Read Hamiltonian */
+                if (read_He(non, Hamil_i_e, H_traj, tl) != 1) {
+                    printf("Hamiltonian trajectory file to short, could not fill buffer!!!\n");
+                    exit(1);
+                }
+                csr_build(non, Hamil_i_e, Hs);
 
-        /* Combine with evolution during t3 */
-        for (int t3 = 0; t3 < non->tmax3; t3++) {
-            int tl = tk + t3;
-            mureadE(non, mut4, tl, px[3], mu_traj, mu_xyz, pol);
-
-            /* Calculate left side of nonrephasing diagram */
-            float t3rr = 0, t3ri = 0;
-            for (int i = 0; i < non->singles; i++) {
-                t3rr += mut4[i] * leftrr[i];
-                t3ri += mut4[i] * leftri[i];
+                for (int c = 0; c < nc; c++) {
+                    if (non->propagation == 1) propagate_vec_coupling_csr(non, Hs, mut3r[c], mut3i[c], non->ts, 1);
+                    if (non->propagation == 3) propagate_vec_krylov(non, Hs, mut3r[c], mut3i[c], 1);
+                    if (non->propagation == 4) propagate_block_chebyshev(non, Hs, mut3r[c], mut3i[c], 1, 1);
+                }
             }
 
-            /* Calculate left side of rephasing diagram */
-            for (int t1 = 0; t1 < non->tmax1; t1++) {
-                t1nr[t1] = 0, t1ni[t1] = 0;
-                for (int i = 0; i < non->singles; i++) {
-                    t1nr[t1] += leftnr[t1][i] * mut4[i];
-                    t1ni[t1] += leftni[t1][i] * mut4[i];
+            /* Stimulated emission (SE) */
+            /* Calculate evolution during t2 up to this waiting time */
+            for (; t2 < waitingTime(non, w); t2++) {
+                int tm = tj + t2;
+                if (read_He(non, Hamil_i_e, H_traj, tm) != 1) {
+                    printf("Hamiltonian trajectory file to short, could not fill buffer!!!\n");
+                    exit(1);
                 }
-            }
 
-            /* Calculate Response */
-            if ((!strcmp(non->technique, "SEIR")) || (!strcmp(non->technique, "2DIR")) || (!strcmp(
-                non->technique, "noEAIR"))) {
-                for (int t1 = 0; t1 < non->tmax1; t1++) {
-                    float polWeight = polarweight(0, molPol) * lt_gb_se[t3][t1];
-                    rrIpar[t3][t1] -= (t3rr * t1ri[t1] + t3ri * t1rr[t1]) * polWeight;
-                    riIpar[t3][t1] -= (t3rr * t1rr[t1] - t3ri * t1ri[t1]) * polWeight;
-                    rrIIpar[t3][t1] -= (t3ni * t1nr[t1] + t3nr * t1ni[t1]) * polWeight;
-                    riIIpar[t3][t1] -= (t3nr * t1nr[t1] - t3ni * t1ni[t1]) * polWeight;
-                    polWeight = polarweight(1, molPol) * lt_gb_se[t3][t1];
-                    rrIper[t3][t1] -= (t3rr * t1ri[t1] + t3ri * t1rr[t1]) * polWeight;
-                    riIper[t3][t1] -= (t3rr * t1rr[t1] - t3ri * t1ri[t1]) * polWeight;
-                    rrIIper[t3][t1] -= (t3ni * t1nr[t1] + t3nr * t1ni[t1]) * polWeight;
-                    riIIper[t3][t1] -= (t3nr * t1nr[t1] - t3ni * t1ni[t1]) * polWeight;
-                    polWeight = polarweight(2, molPol) * lt_gb_se[t3][t1];
-                    rrIcro[t3][t1] -= (t3rr * t1ri[t1] + t3ri * t1rr[t1]) * polWeight;
-                    riIcro[t3][t1] -= (t3rr * t1rr[t1] - t3ri * t1ri[t1]) * polWeight;
-                    rrIIcro[t3][t1] -= (t3ni * t1nr[t1] + t3nr * t1ni[t1]) * polWeight;
-                    riIIcro[t3][t1] -= (t3nr * t1nr[t1] - t3ni * t1ni[t1]) * polWeight;
+                for (int c = 0; c < nc; c++) {
+                    propagate_t2_DIA(non, Hamil_i_e, t2rr[c], t2ri[c], t2nr + c * n1, t2ni + c * n1, 1);
                 }
             }
+            memcpy(leftrr[0], t2rr[0], nc * non->singles * sizeof(float));
+            memcpy(leftri[0], t2ri[0], nc * non->singles * sizeof(float));
+            memcpy(leftnr[0], t2nr[0], nc * n1 * non->singles * sizeof(float));
+            memcpy(leftni[0], t2ni[0], nc * n1 * non->singles * sizeof(float));
+
+            /* Read dipole for third interaction */
+            for (int c = 0; c < nc; c++) {
+                mureadE(non, mut3r[c], tk, comp[2][c], mu_traj, mu_xyz, pol);
+            }
 
+            if ((!strcmp(non->technique, "EAIR")) || (!strcmp(non->technique, "2DIR")) || pumpProbe) {
+                /* T2 propagation ended store vectors needed for EA */
+                for (int c2 = 0; c2 < nc; c2++) {
+                    if (non->anharmonicity == 0) {
+                        read_over(non, over[c2], mu2_traj, tk, comp[2][c2]);
+                    }
+                    for (int c1 = 0; c1 < nc; c1++) {
+                        dipole_double(non, mut3r[c2], leftrr[c1], leftri[c1], fr[c2 * nc + c1], fi[c2 * nc + c1], over[c2]);
+                    }
+                    for (int c0 = 0; c0 < nc; c0++) {
+                        for (int t1 = 0; t1 < n1; t1++) {
+                            int f = (c2 * nc + c0) * n1 + t1, v = c0 * n1 + t1;
+                            dipole_double(non, mut3r[c2], leftnr[v], leftni[v], ft1r[f], ft1i[f], over[c2]);
+                        }
+                    }
+                }
 
-            /* Do Propagation */
-            /* Read Hamiltonian */
-            if (read_He(non, Hamil_i_e, H_traj, tl) != 1) {
-                printf("Hamiltonian trajectory file to short, could not fill buffer!!!\n");
-                exit(1);
+                memcpy(rightrr[0], leftnr[0], nc * n1 * non->singles * sizeof(float));
+                memcpy(rightri[0], leftni[0], nc * n1 * non->singles * sizeof(float));
+                for (int i = 0; i < nc * n1 * non->singles; i++) rightri[0][i] = -rightri[0][i];
+
+                memcpy(rightnr[0], leftrr[0], nc * non->singles * sizeof(float));
+                memcpy(rightni[0], leftri[0], nc * non->singles * sizeof(float));
+                for (int i = 0; i < nc * non->singles; i++) rightni[0][i] = -rightni[0][i];
             }
 
-            /* Propagate left side rephasing */
-            if (non->propagation == 1) {
-                propagate_vec_coupling_S(non, Hamil_i_e, leftrr, leftri, non->ts, 1);
-            } else if (non->propagation == 0) {
-                propagate_vec_DIA_S(non, Hamil_i_e, leftrr, leftri, 1);
+            /* Calculate right side of nonrephasing diagram */
+            float t3nr[9], t3ni[9];
+            for (int c1 = 0; c1 < nc; c1++) {
+                for (int c2 = 0; c2 < nc; c2++) {
+                    t3nr[c1 * nc + c2] = 0, t3ni[c1 * nc + c2] = 0;
+                    for (int i = 0; i < non->singles; i++) {
+                        t3nr[c1 * nc + c2] += leftrr[c1][i] * mut3r[c2][i];
+                        t3ni[c1 * nc + c2] -= leftri[c1][i] * mut3r[c2][i];
+                    }
+                }
             }
 
-            /* Propagate left side nonrephasing */
-            for (int t1 = 0; t1 < non->tmax1; t1++) {
-                if (non->propagation == 0) {
-                    propagate_vec_DIA_S(
-                        non, Hamil_i_e, leftnr[t1], leftni[t1], 1
-                    );
-                } else if (non->propagation == 1) {
-                    propagate_vec_coupling_S(
-                        non, Hamil_i_e, leftnr[t1], leftni[t1], non->ts, 1
-                    );
+            /* Calculate right side of rephasing diagram */
+            for (int c0 = 0; c0 < nc; c0++) {
+                for (int c2 = 0; c2 < nc; c2++) {
+                    for (int t1 = 0; t1 < n1; t1++) {
+                        int o = (c0 * nc + c2) * n1 + t1, v = c0 * n1 + t1;
+                        t1rr[o] = 0, t1ri[o] = 0;
+                        for (int i = 0; i < non->singles; i++) {
+                            t1rr[o] += leftnr[v][i] * mut3r[c2][i];
+                            t1ri[o] -= leftni[v][i] * mut3r[c2][i];
+                        }
+                    }
                 }
             }
-        }
 
-        if ((!strcmp(non->technique, "EAIR")) || (!strcmp(non->technique, "2DIR"))) {
-            /* Excited state absorption (EA) */
             /* Combine with evolution during t3 */
             for (int t3 = 0; t3 < non->tmax3; t3++) {
                 int tl = tk + t3;
-                /* Read Dipole t4 */
-                mureadE(non, mut4, tl, px[3], mu_traj, mu_xyz, pol);
-                if (non->anharmonicity == 0) {
-                    read_over(non, over, mu2_traj, tl, px[3]);
+                for (int c = 0; c < nc; c++) {
+                    mureadE(non, mut4[c], tl, comp[3][c], mu_traj, mu_xyz, pol);
                 }
 
-                /* Multiply with the last dipole */
-                dipole_double_last(non, mut4, fr, fi, leftrr, leftri,over);
-                for (int t1 = 0; t1 < non->tmax1; t1++) {
-                    dipole_double_last(non, mut4, ft1r[t1], ft1i[t1], leftnr[t1], leftni[t1],over);
-                }
+                /* Only the t3 times on the grid of TimeIncrement contribute */
+                if (t3 % non->dt3 == 0) {
+                    /* Calculate left side of nonrephasing diagram */
+                    float t3rr[9], t3ri[9];
+                    for (int c1 = 0; c1 < nc; c1++) {
+                        for (int c3 = 0; c3 < nc; c3++) {
+                            t3rr[c1 * nc + c3] = 0, t3ri[c1 * nc + c3] = 0;
+                            for (int i = 0; i < non->singles; i++) {
+                                t3rr[c1 * nc + c3] += mut4[c3][i] * leftrr[c1][i];
+                                t3ri[c1 * nc + c3] += mut4[c3][i] * leftri[c1][i];
+                            }
+                        }
+                    }
 
-                /* Calculate EA response */
-                for (int t1 = 0; t1 < non->tmax1; t1++) {
-                    float rrI = 0, riI = 0, rrII = 0, riII = 0;
-                    for (int i = 0; i < non->singles; i++) {
-                        rrI += leftri[i] * rightrr[t1][i] + leftrr[i] * rightri[t1][i];
-                        riI += leftrr[i] * rightrr[t1][i] - rightri[t1][i] * leftri[i];
+                    /* Calculate left side of rephasing diagram */
+                    for (int c0 = 0; c0 < nc; c0++) {
+                        for (int c3 = 0; c3 < nc; c3++) {
+                            for (int t1 = 0; t1 < n1; t1++) {
+                                int o = (c0 * nc + c3) * n1 + t1, v = c0 * n1 + t1;
+                                t1nr[o] = 0, t1ni[o] = 0;
+                                for (int i = 0; i < non->singles; i++) {
+                                    t1nr[o] += leftnr[v][i] * mut4[c3][i];
+                                    t1ni[o] += leftni[v][i] * mut4[c3][i];
+                                }
+                            }
+                        }
+                    }
 
-                        rrII += rightnr[i] * leftni[t1][i] + rightni[i] * leftnr[t1][i];
-                        riII += rightnr[i] * leftnr[t1][i] - rightni[i] * leftni[t1][i];
+                    /* Calculate Response */
+                    if ((!strcmp(non->technique, "SEIR")) || (!strcmp(non->technique, "2DIR")) || (!strcmp(
+                        non->technique, "noEAIR")) || pumpProbe) {
+                        for (int m = 0; m < nMolPol; m++) {
+                            int o3r = ix[m][1] * nc + ix[m][3], o3n = ix[m][1] * nc + ix[m][2];
+                            float* t1mrr = t1rr + (ix[m][0] * nc + ix[m][2]) * n1;
+                            float* t1mri = t1ri + (ix[m][0] * nc + ix[m][2]) * n1;
+                            float* t1mnr = t1nr + (ix[m][0] * nc + ix[m][3]) * n1;
+                            float* t1mni = t1ni + (ix[m][0] * nc + ix[m][3]) * n1;
+                            for (int t1 = 0; t1 < n1; t1++) {
+                                float polWeight = polarweight(0, molPols[m]) * lt_gb_se[t3][t1 * non->dt1];
+                                rrIpar[r0 + t3][t1 * non->dt1] -= (t3rr[o3r] * t1mri[t1] + t3ri[o3r] * t1mrr[t1]) * polWeight;
+                                riIpar[r0 + t3][t1 * non->dt1] -= (t3rr[o3r] * t1mrr[t1] - t3ri[o3r] * t1mri[t1]) * polWeight;
+                                rrIIpar[r0 + t3][t1 * non->dt1] -= (t3ni[o3n] * t1mnr[t1] + t3nr[o3n] * t1mni[t1]) * polWeight;
+                                riIIpar[r0 + t3][t1 * non->dt1] -= (t3nr[o3n] * t1mnr[t1] - t3ni[o3n] * t1mni[t1]) * polWeight;
+                                polWeight = polarweight(1, molPols[m]) * lt_gb_se[t3][t1 * non->dt1];
+                                rrIper[r0 + t3][t1 * non->dt1] -= (t3rr[o3r] * t1mri[t1] + t3ri[o3r] * t1mrr[t1]) * polWeight;
+                                riIper[r0 + t3][t1 * non->dt1] -= (t3rr[o3r] * t1mrr[t1] - t3ri[o3r] * t1mri[t1]) * polWeight;
+                                rrIIper[r0 + t3][t1 * non->dt1] -= (t3ni[o3n] * t1mnr[t1] + t3nr[o3n] * t1mni[t1]) * polWeight;
+                                riIIper[r0 + t3][t1 * non->dt1] -= (t3nr[o3n] * t1mnr[t1] - t3ni[o3n] * t1mni[t1]) * polWeight;
+                                polWeight = polarweight(2, molPols[m]) * lt_gb_se[t3][t1 * non->dt1];
+                                rrIcro[r0 + t3][t1 * non->dt1] -= (t3rr[o3r] * t1mri[t1] + t3ri[o3r] * t1mrr[t1]) * polWeight;
+                                riIcro[r0 + t3][t1 * non->dt1] -= (t3rr[o3r] * t1mrr[t1] - t3ri[o3r] * t1mri[t1]) * polWeight;
+                                rrIIcro[r0 + t3][t1 * non->dt1] -= (t3ni[o3n] * t1mnr[t1] + t3nr[o3n] * t1mni[t1]) * polWeight;
+                                riIIcro[r0 + t3][t1 * non->dt1] -= (t3nr[o3n] * t1mnr[t1] - t3ni[o3n] * t1mni[t1]) * polWeight;
+                            }
+                        }
                     }
+                }
+
 
-                    float polWeight = polarweight(0, molPol) * lt_ea[t3][t1];
-                    rrIpar[t3][t1] += rrI * polWeight;
-                    riIpar[t3][t1] += riI * polWeight;
-                    rrIIpar[t3][t1] += rrII * polWeight;
-                    riIIpar[t3][t1] += riII * polWeight;
-                    polWeight = polarweight(1, molPol) * lt_ea[t3][t1];
-                    rrIper[t3][t1] += rrI * polWeight;
-                    riIper[t3][t1] += riI * polWeight;
-                    rrIIper[t3][t1] += rrII * polWeight;
-                    riIIper[t3][t1] += riII * polWeight;
-                    polWeight = polarweight(2, molPol) * lt_ea[t3][t1];
-                    rrIcro[t3][t1] += rrI * polWeight;
-                    riIcro[t3][t1] += riI * polWeight;
-                    rrIIcro[t3][t1] += rrII * polWeight;
-                    riIIcro[t3][t1] += riII * polWeight;
+                /* Do Propagation */
+                if (non->propagation == 0) {
+                    /* Propagate left side rephasing and nonrephasing */
+                    propagate_vecs_cache(non, cache, Hamil_i_e, H_traj, tl, leftrr, leftri, nc, 1);
+                    propagate_vecs_cache(non, cache, Hamil_i_e, H_traj, tl, leftnr, leftni, nc * n1, 1);
+                    continue;
                 }
 
                 /* Read Hamiltonian */
@@ -480,106 +617,222 @@ void calc_2DIR(t_non* non, int parentRank, int parentSize, int subRank, int subS
                     printf("Hamiltonian trajectory file to short, could not fill buffer!!!\n");
                     exit(1);
                 }
+                csr_build(non, Hamil_i_e, Hs);
 
-                /* Propagate vectors left */
-                if (non->anharmonicity == 0) {
-                    read_A(non, Anh, A_traj, tl);
+                if (non->propagation == 4) {
+                    /* Propagate left side rephasing and nonrephasing */
+                    propagate_vecs_chebyshev(non, Hs, leftrr, leftri, nc, 1);
+                    propagate_vecs_chebyshev(non, Hs, leftnr, leftni, nc * n1, 1);
+                    continue;
                 }
 
-                /* Propagate */
-                if (non->propagation == 0) {
-                    float* Urs = calloc(non->singles * non->singles, sizeof(float));
-                    float* Uis = calloc(non->singles * non->singles, sizeof(float));
-
-                    int* Rs = calloc(non->singles * non->singles, sizeof(int));
-                    int* Cs = calloc(non->singles * non->singles, sizeof(int));
-
-                    // bug? Cs and Rs seems to be exchanged (TLC just multiplying with imaginary number)
-                    int elements = time_evolution_mat(non, Hamil_i_e, Urs, Uis, Cs, Rs, non->ts);
-                    if (currentSample == non->begin && molPol == 0 && t3 == 0) {
-                        printf("Sparse matrix efficiency: %f pct.\n",
-                               (1 - (1.0 * elements / (non->singles * non->singles))) * 100);
-                        printf("Present truncation %f.\n",
-                               non->thres / ((double) non->deltat * icm2ifs * (double) twoPi / non->ts * (non->deltat *
-                                   icm2ifs * twoPi / non->ts)));
-                        printf("Suggested truncation %f.\n", 0.001);
+                /* Propagate left side rephasing */
+                for (int c = 0; c < nc; c++) {
+                    if (non->propagation == 1) {
+                        propagate_vec_coupling_csr(non, Hs, leftrr[c], leftri[c], non->ts, 1);
                     }
-
-                    // Key parallel loop 1
-                    // Initial step, former t1=-1
-                    propagate_double_sparce(
-                        non, Urs, Uis, Rs, Cs, fr, fi, elements, non->ts, Anh
-                    );
-
-                    int t1; // MSVC can't deal with C99 declarations inside a for with OpenMP
-                    #pragma omp parallel for \
-                        shared(non, Anh, Urs, Uis, Rs, Cs, ft1r, ft1i) \
-                        schedule(static, 1)
-
-                    for(t1 = 0; t1 < non->tmax1; t1++) {
-                        propagate_double_sparce(
-                            non, Urs, Uis, Rs, Cs, ft1r[t1],
-                            ft1i[t1], elements, non->ts, Anh
-                        );
+                    if (non->propagation == 3) {
+                        propagate_vec_krylov(non, Hs, leftrr[c], leftri[c], 1);
                     }
+                }
 
-                    // Propagate vectors right
-                    // Key parallel loop 2
-                    // Initial step
-                    propagate_vec_DIA_S(non, Hamil_i_e, rightnr, rightni, -1);
-
-                    for(t1 = 0; t1 < non->tmax1; t1++) {
-                        propagate_vec_DIA_S(
-                            non, Hamil_i_e, rightrr[t1], rightri[t1], -1
+                /* Propagate left side nonrephasing */
+                for (int v = 0; v < nc * n1; v++) {
+                    if (non->propagation == 1) {
+                        propagate_vec_coupling_csr(
+                            non, Hs, leftnr[v], leftni[v], non->ts, 1
                         );
                     }
-
-                    free(Urs), free(Uis), free(Rs), free(Cs);
+                    if (non->propagation == 3) {
+                        propagate_vec_krylov(non, Hs, leftnr[v], leftni[v], 1);
+                    }
                 }
-                else if(non->propagation == 1) {
-                    // Key parallel loop 1
-                    // Initial step
-                    propagate_vec_coupling_S_doubles(
-                        non, Hamil_i_e, fr, fi, non->ts,Anh); 
+            }
 
-                    int t1;
-                    #pragma omp parallel for \
-                        shared(non,Hamil_i_e,Anh,ft1r,ft1i) \
-                        schedule(static, 1)
+            if ((!strcmp(non->technique, "EAIR")) || (!strcmp(non->technique, "2DIR")) || pumpProbe) {
+                /* Excited state absorption (EA) */
+                /* Combine with evolution during t3 */
+                for (int t3 = 0; t3 < non->tmax3; t3++) {
+                    int tl = tk + t3;
+                    /* Read Dipole t4 */
+                    for (int c = 0; c < nc; c++) {
+                        mureadE(non, mut4[c], tl, comp[3][c], mu_traj, mu_xyz, pol);
+                        if (non->anharmonicity == 0) {
+                            read_over(non, over[c], mu2_traj, tl, comp[3][c]);
+                        }
+                    }
 
-                    for (t1 = 0; t1 < non->tmax1; t1++) {
-                        propagate_vec_coupling_S_doubles(
-                            non, Hamil_i_e, ft1r[t1], ft1i[t1], non->ts,Anh); 
+                    /* Only the t3 times on the grid of TimeIncrement contribute */
+                    for (int m = 0; m < nMolPol && t3 % non->dt3 == 0; m++) {
+                        int c0 = ix[m][0], c1 = ix[m][1], c2 = ix[m][2], c3 = ix[m][3];
+
+                        /* Multiply with the last dipole */
+                        dipole_double_last(non, mut4[c3], fr[c2 * nc + c1], fi[c2 * nc + c1], lastr, lasti, over[c3]);
+                        for (int t1 = 0; t1 < n1; t1++) {
+                            int f = (c2 * nc + c0) * n1 + t1;
+                            dipole_double_last(non, mut4[c3], ft1r[f], ft1i[f], lastt1r[t1], lastt1i[t1], over[c3]);
+                        }
+
+                        /* Calculate EA response */
+                        for (int t1 = 0; t1 < n1; t1++) {
+                            int v = c0 * n1 + t1;
+                            float rrI = 0, riI = 0, rrII = 0, riII = 0;
+                            for (int i = 0; i < non->singles; i++) {
+                                rrI += lasti[i] * rightrr[v][i] + lastr[i] * rightri[v][i];
+                                riI += lastr[i] * rightrr[v][i] - rightri[v][i] * lasti[i];
+
+                                rrII += rightnr[c1][i] * lastt1i[t1][i] + rightni[c1][i] * lastt1r[t1][i];
+                                riII += rightnr[c1][i] * lastt1r[t1][i] - rightni[c1][i] * lastt1i[t1][i];
+                            }
+
+                            float polWeight = polarweight(0, molPols[m]) * lt_ea[t3][t1 * non->dt1];
+                            rrIpar[r0 + t3][t1 * non->dt1] += rrI * polWeight;
+                            riIpar[r0 + t3][t1 * non->dt1] += riI * polWeight;
+                            rrIIpar[r0 + t3][t1 * non->dt1] += rrII * polWeight;
+                            riIIpar[r0 + t3][t1 * non->dt1] += riII * polWeight;
+                            polWeight = polarweight(1, molPols[m]) * lt_ea[t3][t1 * non->dt1];
+                            rrIper[r0 + t3][t1 * non->dt1] += rrI * polWeight;
+                            riIper[r0 + t3][t1 * non->dt1] += riI * polWeight;
+                            rrIIper[r0 + t3][t1 * non->dt1] += rrII * polWeight;
+                            riIIper[r0 + t3][t1 * non->dt1] += riII * polWeight;
+                            polWeight = polarweight(2, molPols[m]) * lt_ea[t3][t1 * non->dt1];
+                            rrIcro[r0 + t3][t1 * non->dt1] += rrI * polWeight;
+                            riIcro[r0 + t3][t1 * non->dt1] += riI * polWeight;
+                            rrIIcro[r0 + t3][t1 * non->dt1] += rrII * polWeight;
+                            riIIcro[r0 + t3][t1 * non->dt1] += riII * polWeight;
+                        }
                     }
 
-                    // Key parallel loop 2
-                    // Initial step
-                    propagate_vec_coupling_S(
-                        non, Hamil_i_e, rightnr, rightni, non->ts, -1
-                    );
+                    /* Read Hamiltonian */
+                    if (read_He(non, Hamil_i_e, H_traj, tl) != 1) {
+                        printf("Hamiltonian trajectory file to short, could not fill buffer!!!\n");
+                        exit(1);
+                    }
+                    if (non->propagation != 0) csr_build(non, Hamil_i_e, Hs);
 
-                    for (t1 = 0; t1 < non->tmax1; t1++) {
-                        propagate_vec_coupling_S(
-                            non, Hamil_i_e, rightrr[t1], rightri[t1], non->ts, -1
-                        );
+                    /* Propagate vectors left */
+                    if (non->anharmonicity == 0) {
+                        read_A(non, Anh, A_traj, tl);
+                    }
+
+                    /* Propagate */
+                    if (non->propagation == 0) {
+                        // bug? Cs and Rs seems to be exchanged (TLC just multiplying with imaginary number)
+                        int elements = time_evolution_mat(non, Hamil_i_e, Urs, Uis, Cs, Rs, non->ts);
+                        if (currentSample == non->begin && molPol == 0 && t3 == 0) {
+                            printf("Sparse matrix efficiency: %f pct.\n",
+                                   (1 - (1.0 * elements / (non->singles * non->singles))) * 100);
+                            printf("Present truncation %f.\n",
+                                   non->thres / ((double) non->deltat * icm2ifs * (double) twoPi / non->ts * (non->deltat *
+                                       icm2ifs * twoPi / non->ts)));
+                            printf("Suggested truncation %f.\n", 0.001);
+                        }
+
+                        if (elements > 2 * non->singles * sqrt(non->singles)) {
+                            // Dense propagator, the two exciton vectors evolve as U F U^T
+                            propagator_dense(non, Urs, Uis, Rs, Cs, elements, Udr, Udi);
+                            propagate_doubles_U(non, Udr, Udi, fr, fi, nc2, non->ts, Anh);
+                            propagate_doubles_U(non, Udr, Udi, ft1r, ft1i, nc2 * n1, non->ts, Anh);
+                        }
+                        else {
+                            // Key parallel loop 1
+                            // Initial step, former t1=-1
+                            for (int c = 0; c < nc2; c++) {
+                                propagate_double_sparce(
+                                    non, Urs, Uis, Rs, Cs, fr[c], fi[c], elements, non->ts, Anh
+                                );
+                            }
+
+                            int v; // MSVC can't deal with C99 declarations inside a for with OpenMP
+                            #pragma omp parallel for \
+                                shared(non, Anh, Urs, Uis, Rs, Cs, ft1r, ft1i) \
+                                schedule(static, 1)
+
+                            for(v = 0; v < nc2 * n1; v++) {
+                                propagate_double_sparce(
+                                    non, Urs, Uis, Rs, Cs, ft1r[v],
+                                    ft1i[v], elements, non->ts, Anh
+                                );
+                            }
+                        }
+
+                        // Propagate vectors right
+                        // Key parallel loop 2
+                        // Initial step
+                        propagate_vecs_cache(non, cache, Hamil_i_e, H_traj, tl, rightnr, rightni, nc, -1);
+                        propagate_vecs_cache(non, cache, Hamil_i_e, H_traj, tl, rightrr, rightri, nc * n1, -1);
+                    }
+                    else {
+                        int v;
+                        if ((non->propagation == 3 || non->propagation == 4) && csr_dense_doubles(Hs)) {
+                            // Dense Krylov or Chebyshev propagator of the substeps, the two exciton
+                            // vectors evolve as U F U^T
+                            if (non->propagation == 3) propagator_krylov(non, Hs, Udr, Udi, non->ts);
+                            if (non->propagation == 4) propagator_chebyshev(non, Hs, Udr, Udi, non->ts);
+                            propagate_doubles_U(non, Udr, Udi, fr, fi, nc2, non->ts, Anh);
+                            propagate_doubles_U(non, Udr, Udi, ft1r, ft1i, nc2 * n1, non->ts, Anh);
+                        }
+                        else {
+                            // Key parallel loop 1
+                            // Initial step
+                            for (int c = 0; c < nc2; c++) {
+                                propagate_vec_coupling_S_doubles(
+                                    non, Hamil_i_e, fr[c], fi[c], non->ts,Anh); 
+                            }
+
+                            #pragma omp parallel for \
+                                shared(non,Hamil_i_e,Anh,ft1r,ft1i) \
+                                schedule(static, 1)
+
+                            for (v = 0; v < nc2 * n1; v++) {
+                                propagate_vec_coupling_S_doubles(
+                                    non, Hamil_i_e, ft1r[v], ft1i[v], non->ts,Anh); 
+                            }
+                        }
+
+                        // Key parallel loop 2
+                        // Initial step
+                        if (non->propagation == 4) {
+                            propagate_vecs_chebyshev(non, Hs, rightnr, rightni, nc, -1);
+                            propagate_vecs_chebyshev(non, Hs, rightrr, rightri, nc * n1, -1);
+                            continue;
+                        }
+                        for (int c = 0; c < nc; c++) {
+                            if (non->propagation == 3) {
+                                propagate_vec_krylov(non, Hs, rightnr[c], rightni[c], -1);
+                                continue;
+                            }
+                            propagate_vec_coupling_csr(
+                                non, Hs, rightnr[c], rightni[c], non->ts, -1
+                            );
+                        }
+
+                        #pragma omp parallel for \
+                            shared(non, Hs, rightrr, rightri) \
+                            schedule(dynamic)
+                        for (v = 0; v < nc * n1; v++) {
+                            if (non->propagation == 3) {
+                                propagate_vec_krylov(non, Hs, rightrr[v], rightri[v], -1);
+                                continue;
+                            }
+                            propagate_vec_coupling_csr(
+                                non, Hs, rightrr[v], rightri[v], non->ts, -1
+                            );
+                        }
                     }
                 }
             }
+
         }
 
-        free(leftrr), free(leftri), free2D((void**) leftnr), free2D((void**) leftni);
-        free2D((void**) rightrr), free2D((void**) rightri), free(rightnr), free(rightni);
-        free(t1rr), free(t1ri), free(t1nr), free(t1ni);
-        free(mut3r);
-        free(mut3i);
-        free(mut4);
-        free(Anh), free(over);
-        free(fr), free(fi);
-        free2D((void**) ft1r), free2D((void**) ft1i);
-
-        counter++;
+        markCheckpoint(&cp, item, parentRank, parentSize);
+        int converged = updateStream(&stream, non, &queue, item, parentRank);
+        if (converged >= 0) sampleCount = converged;
+        counter += nMolPol;
 	if (subRank==0){
-	    counter_current=counter*100.0/sampleCount/21*parentSize;
+	    // With dynamic scheduling the item number measures the progress of all processes
+	    if (queue.dynamic) counter_current=(item+1)*100.0/totalWorkItems;
+	    else counter_current=counter*100.0/sampleCount/21*parentSize;
             if (counter_current>counter_pass){
 		if (non->printLevel>0){
                     my_current_time=MPI_Wtime();
@@ -596,11 +849,32 @@ void calc_2DIR(t_non* non, int parentRank, int parentSize, int subRank, int subS
 	}	
     }
 
+    free2D((void**) leftrr), free2D((void**) leftri), free2D((void**) leftnr), free2D((void**) leftni);
+    free2D((void**) rightrr), free2D((void**) rightri), free2D((void**) rightnr), free2D((void**) rightni);
+    free(lastr), free(lasti), free(muabs), free2D((void**) lastt1r), free2D((void**) lastt1i);
+    free(t1rr), free(t1ri), free(t1nr), free(t1ni), free(t1gr), free(t1gi);
+    free2D((void**) t2rr), free2D((void**) t2ri), free2D((void**) t2nr), free2D((void**) t2ni);
+    free2D((void**) mut2), free2D((void**) mut3r), free2D((void**) mut3i), free2D((void**) mut4);
+    free(Anh), free2D((void**) over);
+    free2D((void**) fr), free2D((void**) fi);
+    free2D((void**) ft1r), free2D((void**) ft1i);
+    free(Urs), free(Uis), free(Rs), free(Cs);
+    free(Udr), free(Udi);
+
+    freeStream(&stream);
+    freeWorkQueue(&queue, parentRank, parentSize);
+    free(completed);
+    propcache_log(cache, "2DIR");
+    propcache_free(cache);
+    csr_free(Hs);
+    prefetch_free(pf);
+    if (non->sharedtraj) {
+        unshareFrames(H_traj, &H_win), unshareFrames(mu_traj, &mu_win);
+        if (A_traj != NULL) unshareFrames(A_traj, &A_win), unshareFrames(mu2_traj, &mu2_win);
+    }
+
     // Reduce calculation results, in a tiered approach to save network bandwidth
-    int reduceArraySize = non->tmax3 * non->tmax1;
-    float** reductionArrays[12] = {
-        rrIpar, riIpar, rrIIpar, riIIpar, rrIper, riIper, rrIIper, riIIper, rrIcro, riIcro, rrIIcro, riIIcro
-    };
+    int reduceArraySize = nT2 * non->tmax3 * non->tmax1;
     MPI_Request reductions[2][12];
 
     // Reduce at small scope
@@ -633,6 +907,9 @@ void calc_2DIR(t_non* non, int parentRank, int parentSize, int subRank, int subS
     if(parentRank == 0 || subRank == 0)
         asyncWaitForMPI(reductions[1], 12, 1, 5000);
 
+    // The absorption spectrum is obtained from the same t1 propagation
+    if (!pumpProbe) printAbsorption(non, re_S_1, im_S_1, sampleCount, parentRank, subRank, subComm, rootComm);
+
     /* The calculation is finished, lets write output */
     if (parentRank == 0) {
         log_item("Finished Calculating Response!\nWriting to file\n");
@@ -644,22 +921,29 @@ void calc_2DIR(t_non* non, int parentRank, int parentSize, int subRank, int subS
         }
 
         /* Close Files */
-        fclose(mu_traj), fclose(H_traj);
+        traj_fclose(mu_traj), traj_fclose(H_traj);
         if ((!strcmp(non->technique, "2DIR")) || (!strcmp(non->technique, "GBIR")) || (!
             strcmp(non->technique, "SEIR")) || (!strcmp(non->technique, "EAIR")) || (!strcmp(
-                non->technique, "noEAIR"))) {
+                non->technique, "noEAIR")) || pumpProbe) {
             if (non->anharmonicity == 0) {
-                fclose(mu2_traj), fclose(A_traj);
+                traj_fclose(mu2_traj), traj_fclose(A_traj);
             }
         }
 
+        /* Print pump probe spectra, before the response is normalized */
+        if (pumpProbe) {
+            do_PPFFT(non, "PP_t1=0.par.dat", rrIpar, riIpar, rrIIpar, riIIpar, sampleCount);
+            do_PPFFT(non, "PP_t1=0.per.dat", rrIper, riIper, rrIIper, riIIper, sampleCount);
+            do_PPFFT(non, "PP_t1=0.cro.dat", rrIcro, riIcro, rrIIcro, riIIcro, sampleCount);
+        }
+
         /* Print 2D */
-        print2D("RparI.dat", rrIpar, riIpar, non, sampleCount);
-        print2D("RparII.dat", rrIIpar, riIIpar, non, sampleCount);
-        print2D("RperI.dat", rrIper, riIper, non, sampleCount);
-        print2D("RperII.dat", rrIIper, riIIper, non, sampleCount);
-        print2D("RcroI.dat", rrIcro, riIcro, non, sampleCount);
-        print2D("RcroII.dat", rrIIcro, riIIcro, non, sampleCount);
+        print2Dseries("RparI.dat", rrIpar, riIpar, non, sampleCount);
+        print2Dseries("RparII.dat", rrIIpar, riIIpar, non, sampleCount);
+        print2Dseries("RperI.dat", rrIper, riIper, non, sampleCount);
+        print2Dseries("RperII.dat", rrIIper, riIIper, non, sampleCount);
+        print2Dseries("RcroI.dat", rrIcro, riIcro, non, sampleCount);
+        print2Dseries("RcroII.dat", rrIIcro, riIIcro, non, sampleCount);
 
         printf("----------------------------------------\n");
         printf(" 2DIR calculation succesfully completed\n");
@@ -677,14 +961,18 @@ void calc_2DIR(t_non* non, int parentRank, int parentSize, int subRank, int subS
     free2D((void**)rrIIper), free2D((void**)riIIper);
     free2D((void**)rrIcro), free2D((void**)riIcro);
     free2D((void**)rrIIcro), free2D((void**)riIIcro);
+    free(re_S_1), free(im_S_1);
     free(mu_xyz);
     free2D((void**)lt_gb_se);
     free2D((void**)lt_ea);
-    free(workset); free(worksetSizes);
+    free(workset);
     free(Hamil_i_e);
 
     // Barrier to gather all threads and exit simultaneously
     MPI_Request barrierRequest[1];
     MPI_Ibarrier(MPI_COMM_WORLD, &(barrierRequest[0]));
     asyncWaitForMPI(barrierRequest, 1, 1, 5000);
+
+    // The results are written, the checkpoints are no longer needed
+    freeCheckpoint(&cp, parentRank);
 }
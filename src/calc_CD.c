@@ -4,21 +4,85 @@
 #include <string.h>
 #include <time.h>
 #include <fftw3.h>
+#include <mpi.h>
 #include "omp.h"
 #include "types.h"
 #include "NISE_subs.h"
+#include "trajectory.h"
+#include "linear.h"
 #include "calc_CD.h"
 #include "1DFFT.h"
 
-void calc_CD(t_non *non){
+// Frame data for the CD: the initial vectors are the excitations of the single
+// sites j by the dipole component x, and the final vectors combine the other two
+// dipole components with the distances to site j along the third direction
+void CD_frame(t_non *non,void *data,int frame,float *Hamil_i_e,float *L,float *X0){
+  t_CDdata *d=data;
+  int N=non->singles;
+  int i,j,x,y,z,v,sign;
+  float posj;
+
+  for (x=0;x<3;x++){
+    if (read_mue(non,d->mu+x*N,d->mu_traj,frame,x)!=1){
+      printf("Dipole trajectory file to short, could not fill buffer!!!\n");
+      printf("JTIME %d %d\n",frame,x);
+      exit(1);
+    }
+    // Read positions
+    if (read_mue(non,d->pos+x*N,d->pos_traj,frame,x)!=1){
+      printf("Position trajectory file to short, could not fill buffer!!!\n");
+      printf("JTIME %d %d\n",frame,x);
+      exit(1);
+    }
+  }
+  // Initialize excitation on initial site
+  clearvec(X0,N*3*N);
+  for (j=0;j<N;j++){
+    for (x=0;x<3;x++){
+      X0[(j*3+x)*N+j]=d->mu[x*N+j];
+    }
+  }
+  // Do projection on selected sites if asked
+  if (non->Npsites>0){
+    for (x=0;x<3;x++) projection(d->mu+x*N,non);
+  }
+
+  clearvec(L,N*3*N);
+  for (j=0;j<N;j++){
+    for (x=0;x<3;x++){
+      v=j*3+x;
+      // Loop over polarization values y for mu, excluding the first interaction
+      for (y=0;y<3;y++){
+        if (y==x) continue;
+        // Find corresponding value for the polarization used for the distance matrix
+        z=3-x-y;
+        sign=0;
+        // Determine the sign
+        if (z==0 & y==1 & x==2){sign=1;}
+        if (z==0 & y==2 & x==1){sign=-1;}
+        if (z==1 & y==0 & x==2){sign=-1;}
+        if (z==2 & y==0 & x==1){sign=1;}
+        if (z==2 & y==1 & x==0){sign=-1;}
+        if (z==1 & y==2 & x==0){sign=1;}
+        if (sign==0){
+          printf("Bug in CD routine.\n");
+          exit(1);
+        }
+        posj=d->pos[z*N+j];
+        for (i=0;i<N;i++){
+          L[v*N+i]+=sign*(d->pos[z*N+i]-posj)*d->mu[y*N+i];
+        }
+      }
+    }
+  }
+}
+
+void calc_CD(t_non *non,int parentRank,int parentSize,int subRank,int subSize,MPI_Comm subComm,MPI_Comm rootComm){
   // Initialize variables
   float *re_S_1,*im_S_1; // The first-order response function
-  float *mu_eg,*Hamil_i_e;
-  float *pos;
-  float posj;
-  // Aid arrays
-  float *vecr,*veci;
-  //,*vecr_old,*veci_old;
+  t_lintech tech;
+  float *Hamil_i_e;
+  t_CDdata data;
 
   /* Floats */
   float shift1;
@@ -29,19 +93,15 @@ void calc_CD(t_non *non){
   /* File handles */
   FILE *H_traj,*mu_traj,*pos_traj;
   FILE *outone,*log;
-  FILE *Cfile;
+  FILE *Cfile=NULL;
 
   /* Integers */
   int nn2;
   int itime,N_samples;
   int samples;
-  int x,ti,tj,i;
-  int y,z;
-  int j,N;
+  int N;
   int t1,fft;
-  int elements;
-  int cl,Ncl;
-  int sign;
+  int Ncl;
 
   /* Time parameters */
   time_t time_now,time_old,time_0;
@@ -49,7 +109,7 @@ void calc_CD(t_non *non){
   time(&time_now);
   time(&time_0);
   shift1=(non->max1+non->min1)/2;
-  printf("Frequency shift %f.\n",shift1);
+  if (parentRank==0) printf("Frequency shift %f.\n",shift1);
   non->shifte=shift1;
 
   // Allocate memory
@@ -98,7 +158,7 @@ void calc_CD(t_non *non){
   // Do calculation
   N_samples=(non->length-non->tmax1-1)/non->sample+1;
   if (N_samples>0) {
-    printf("Making %d samples!\n",N_samples);
+    if (parentRank==0) printf("Making %d samples!\n",N_samples);
   } else {
     printf("Insufficient data to calculate spectrum.\n");
     printf("Please, lower max times or provide longer\n");
@@ -108,140 +168,41 @@ void calc_CD(t_non *non){
 
   if (non->end==0) non->end=N_samples;
 
-  log=fopen("NISE.log","a");
-  fprintf(log,"Begin sample: %d, End sample: %d.\n",non->begin,non->end);
-  fclose(log);
-
-  vecr=(float *)calloc(non->singles,sizeof(float));	
-  veci=(float *)calloc(non->singles,sizeof(float));
-//  vecr_old=(float *)calloc(non->singles,sizeof(float));
-//  veci_old=(float *)calloc(non->singles,sizeof(float));
-  mu_eg=(float *)calloc(non->singles,sizeof(float));
-  pos=(float *)calloc(non->singles,sizeof(float));
-
-  // Loop over samples
-  for (samples=non->begin;samples<non->end;samples++){
-
-    // Calculate linear response    
-    ti=samples*non->sample;
-    if (non->cluster!=-1){
-      if (read_cluster(non,ti,&cl,Cfile)!=1){
-	printf("Cluster trajectory file to short, could not fill buffer!!!\n");
-	printf("ITIME %d\n",ti);
-	exit(1);
-      }
-      //      printf("%d\n",cl);
-      // Configuration belong to cluster
-      if (non->cluster==cl){
-	Ncl++;
-      }
-    }
-    if (non->cluster==-1 || non->cluster==cl){
-
-    // Loop over initial sites
-    for (j=0;j<N;j++){ 
-
-    // Loop over polarizations of the initial excitation      
-    for (x=0;x<3;x++){
-      // Read mu(ti)
-      if (read_mue(non,mu_eg,mu_traj,ti,x)!=1){
-	printf("Dipole trajectory file to short, could not fill buffer!!!\n");
-	printf("ITIME %d %d\n",ti,x);
-	exit(1);
-      }
-      // Initialize excitation on initial site
-      clearvec(vecr,non->singles);
-      clearvec(veci,non->singles);
-      vecr[j]=mu_eg[j];
-//      copyvec(vecr,vecr_old,non->singles);
-//      copyvec(vecr,mu_eg,non->singles);
-      // Loop over delay
-      for (t1=0;t1<non->tmax;t1++){
-	tj=ti+t1;
-	// Read Hamiltonian
-	if (read_He(non,Hamil_i_e,H_traj,tj)!=1){
-	  printf("Hamiltonian trajectory file to short, could not fill buffer!!!\n");
-	  exit(1);
-	}
-
-        // Loop over polarization values y for mu
-        for (y=0;y<3;y++){
-          // Exclude values taken up by the first interaction
-          if (y!=x){	
-            // Find corresponding value for the polarization used for the distance matrix
-            z=3-x-y;
-	    // Read mu(tj)
-	    if (read_mue(non,mu_eg,mu_traj,tj,y)!=1){
-	      printf("Dipole trajectory file to short, could not fill buffer!!!\n");
-	      printf("JTIME %d %d\n",tj,y);
-	      exit(1);
-            }
-            // Read positions
-            if (read_mue(non,pos,pos_traj,tj,z)!=1){
-              printf("Position trajectory file to short, could not fill buffer!!!\n");
-              printf("JTIME %d %d\n",tj,z);
-              exit(1);
-            }
-            posj=pos[j];
-	    // Do projection on selected sites if asked
-	    if (non->Npsites>0){
-	      projection(mu_eg,non);
-	    }
-	
-            sign=0;
-            // Determine the sign
-            if (z==0 & y==1 & x==2){sign=1;}//{sign=1;}
-            if (z==0 & y==2 & x==1){sign=-1;}//{}sign=-1;}
-            if (z==1 & y==0 & x==2){sign=-1;}//{sign=-1;}
-            if (z==2 & y==0 & x==1){sign=1;}//{sign=1;}
-            if (z==2 & y==1 & x==0){sign=-1;}//{sign=-1;}
-            if (z==1 & y==2 & x==0){sign=1;}//{sign=1;}
-            if (sign==0){
-              printf("Bug in CD routine.\n");
-              exit(1);
-            }
-
-	    // Find response
-	    calc_CD1(re_S_1,im_S_1,t1,non,vecr,veci,mu_eg,pos,sign,posj);
-	  }
-        }
-
-	// Propagate vector
-	if (non->propagation==1) propagate_vec_coupling_S(non,Hamil_i_e,vecr,veci,non->ts,1);
-	if (non->propagation==0){
-	  if (non->thres==0 || non->thres>1){
-	    propagate_vec_DIA(non,Hamil_i_e,vecr,veci,1);
-	  } else {
-	    elements=propagate_vec_DIA_S(non,Hamil_i_e,vecr,veci,1);
-	    if (samples==non->begin){
-	      if (t1==0){
-		if (x==0){
-		  printf("Sparce matrix efficiency: %f pct.\n",(1-(1.0*elements/(non->singles*non->singles)))*100);
-		  printf("Pressent tuncation %f.\n",non->thres/((non->deltat*icm2ifs*twoPi/non->ts)*(non->deltat*icm2ifs*twoPi/non->ts)));
-		  printf("Suggested truncation %f.\n",0.001);
-		}
-	      }
-	    }
-	  }
-	}
-      }
-    }
-    }
-    } // Cluster loop
-  
-    // Log time
+  if (parentRank==0){
     log=fopen("NISE.log","a");
-    fprintf(log,"Finished sample %d\n",samples);
-          
-    time_now=log_time(time_now,log);
+    fprintf(log,"Begin sample: %d, End sample: %d.\n",non->begin,non->end);
     fclose(log);
   }
 
-  free(vecr);
-  free(veci);
-  free(mu_eg);
+  // Propagate all samples in one pass over the trajectory
+  data.mu_traj=mu_traj;
+  data.pos_traj=pos_traj;
+  data.mu=(float *)calloc(3*N,sizeof(float));
+  data.pos=(float *)calloc(3*N,sizeof(float));
+  tech.nv=3*N;
+  tech.exponential=0;
+  tech.frame=CD_frame;
+  tech.response=NULL;
+  tech.data=&data;
+  linear_response(non,Hamil_i_e,H_traj,mu_traj,Cfile,&Ncl,&tech,re_S_1,im_S_1,
+                  parentRank,parentSize,subRank,subComm,rootComm);
+  samples=non->end;
+
+  free(data.mu);
+  free(data.pos);
   free(Hamil_i_e);
 
+  traj_fclose(mu_traj),traj_fclose(H_traj),traj_fclose(pos_traj);
+  if (non->cluster!=-1){
+    traj_fclose(Cfile);
+  }
+
+  // Only the master writes the results
+  if (parentRank!=0){
+    free(re_S_1),free(im_S_1);
+    return;
+  }
+
   // The calculation is finished, lets write output
   log=fopen("NISE.log","a");
   fprintf(log,"Finished Calculating Response!\n");
@@ -257,11 +218,6 @@ void calc_CD(t_non *non){
     }
   }
 
-  fclose(mu_traj),fclose(H_traj),fclose(pos_traj);
-  if (non->cluster!=-1){
-    fclose(Cfile);
-  }
-
   outone=fopen("TD_CD.dat","w");
   for (t1=0;t1<non->tmax1;t1+=non->dt1){
     fprintf(outone,"%f %e %e\n",t1*non->deltat,re_S_1[t1]/samples,im_S_1[t1]/samples);
@@ -1,6 +1,15 @@
 #ifndef _calc_CD_
 #define _calc_CD_
-void calc_CD(t_non *non);
+#include <mpi.h>
+
+// Trajectories of the CD and the dipoles and positions of the present frame
+typedef struct {
+  FILE *mu_traj,*pos_traj;
+  float *mu,*pos;
+} t_CDdata;
+
+void calc_CD(t_non *non,int parentRank,int parentSize,int subRank,int subSize,MPI_Comm subComm,MPI_Comm rootComm);
+void CD_frame(t_non *non,void *data,int frame,float *Hamil_i_e,float *L,float *X0);
 void calc_CD1(float *re_S_1,float *im_S_1,int t1,t_non *non,float *cr,float *ci,float *mu,float *pos,int sign,float posj);
 
 #endif // _calc_CD_
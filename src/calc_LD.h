@@ -1,6 +1,8 @@
 #ifndef _LD_
 #define _LD_
-void LD(t_non *non);
+#include <mpi.h>
+void LD(t_non *non,int parentRank,int parentSize,int subRank,int subSize,MPI_Comm subComm,MPI_Comm rootComm);
+void LD_frame(t_non *non,void *data,int frame,float *Hamil_i_e,float *L,float *X0);
 void calc_LD(float *re_S_1,float *im_S_1,int t1,t_non *non,float *cr,float *ci,float *mu,int x);
 
 #endif // _LD_
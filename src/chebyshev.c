@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "types.h"
+#include "NISE_subs.h"
+#include "workspace.h"
+#include "sparse.h"
+#include "chebyshev.h"
+
+/* Chebyshev expansion of the one exciton propagator.                          */
+/* The spectrum of the Hamiltonian of the frame is bounded with the Gershgorin  */
+/* circles and the Hamiltonian is scaled to [-1,1]. exp(-i H dt) is then a sum  */
+/* of Chebyshev polynomials of the scaled Hamiltonian with Bessel function      */
+/* coefficients, truncated when the coefficients drop below ChebyshevTolerance. */
+/* The polynomials are applied with the three term recurrence, one product of */
+/* the sparse Hamiltonian per term for the real and imaginary parts of all    */
+/* vectors together, so the expansion is exact to the tolerance for any time   */
+/* step.                                                                       */
+
+// Bessel functions J_0 to J_kmax of x>=0 with Miller's backward recurrence
+static void chebyshev_bessel(double x, double* J, int kmax) {
+    int k, M;
+    double jp, j, jm, norm;
+
+    for (k = 0; k <= kmax; k++) J[k] = 0;
+    if (x == 0) {
+        J[0] = 1;
+        return;
+    }
+    M = 2 * ((kmax + (int) sqrt(40 * kmax) + 20) / 2);
+    jp = 0, j = 1e-30, norm = 0;
+    for (k = M; k > 0; k--) {
+        jm = 2 * k / x * j - jp;
+        jp = j, j = jm;
+        // Keep the recurrence in range
+        if (fabs(j) > 1e250) {
+            jp *= 1e-250, j *= 1e-250, norm *= 1e-250;
+            for (int l = k; l <= kmax; l++) J[l] *= 1e-250;
+        }
+        if (k - 1 <= kmax) J[k - 1] = j;
+        if ((k - 1) % 2 == 0 && k > 1) norm += 2 * j;
+    }
+    norm += j;
+    for (k = 0; k <= kmax; k++) J[k] /= norm;
+}
+
+// Bounds of the spectrum of the sparse Hamiltonian from the Gershgorin circles
+static void chebyshev_bounds(t_csr* H, double* emin, double* emax) {
+    int a, k;
+    double r;
+    *emin = 1e30, *emax = -1e30;
+    for (a = 0; a < H->N; a++) {
+        r = 0;
+        for (k = H->first[a]; k < H->first[a + 1]; k++) r += fabs(H->val[k]);
+        if (H->diag[a] - r < *emin) *emin = H->diag[a] - r;
+        if (H->diag[a] + r > *emax) *emax = H->diag[a] + r;
+    }
+}
+
+// Propagate the columns of the N x n matrix (Xr,Xi) one time step with the
+// Chebyshev expansion. Returns the number of terms used.
+int propagate_block_chebyshev(t_non* non, t_csr* H, float* Xr, float* Xi, int n, int sign) {
+    int N = non->singles;
+    int m = 2 * n; // Real and imaginary parts are propagated as one block
+    int i, k, K, kmax;
+    double emin, emax, c, r, x, f;
+    double *J;
+    float cr, ci, co, si;
+    float *P0, *P1, *P2, *A, *T;
+    t_wsmark mark;
+
+    if (n <= 0) return 0;
+    f = non->deltat * icm2ifs * twoPi;
+    chebyshev_bounds(H, &emin, &emax);
+    c = 0.5 * (emax + emin);
+    r = 0.5 * (emax - emin);
+    if (r == 0) r = 1;
+    x = f * r;
+
+    // Number of terms, the coefficients decay rapidly once k exceeds x
+    kmax = (int) (x + 10 * pow(x + 1, 1.0 / 3.0) + 20);
+    mark = ws_mark();
+    J = ws_alloc(kmax + 1, sizeof(double));
+    chebyshev_bessel(x, J, kmax);
+    for (K = kmax; K > 1 && 2 * fabs(J[K]) < non->chebytol && K > x; K--);
+
+    P0 = ws_alloc(N * m, sizeof(float));
+    P1 = ws_alloc(N * m, sizeof(float));
+    P2 = ws_alloc(N * m, sizeof(float));
+    A = ws_alloc(N * m, sizeof(float));
+    copyvec(Xr, P0, N * n), copyvec(Xi, P0 + N * n, N * n);
+
+    // Coefficient of term k is (2-delta_k0) J_k (-i sign)^k
+    for (i = 0; i < N * m; i++) A[i] = J[0] * P0[i];
+    // P1 = (H-c)/r P0
+    csr_spmm(H, P0, P1, m);
+    for (i = 0; i < N * m; i++) P1[i] = (P1[i] - c * P0[i]) / r;
+    for (k = 1; k <= K; k++) {
+        if (k > 1) {
+            // P2 = 2 (H-c)/r P1 - P0
+            csr_spmm(H, P1, P2, m);
+            for (i = 0; i < N * m; i++) P2[i] = 2 * (P2[i] - c * P1[i]) / r - P0[i];
+            T = P0, P0 = P1, P1 = P2, P2 = T;
+        }
+        cr = k % 2 == 0 ? 2 * J[k] * (k % 4 == 0 ? 1 : -1) : 0;
+        ci = k % 2 == 1 ? 2 * J[k] * (k % 4 == 1 ? -sign : sign) : 0;
+        for (i = 0; i < N * n; i++) {
+            A[i] += cr * P1[i] - ci * P1[i + N * n];
+            A[i + N * n] += cr * P1[i + N * n] + ci * P1[i];
+        }
+    }
+
+    // Phase of the center of the spectrum
+    co = cos(f * c), si = sign * sin(f * c);
+    for (i = 0; i < N * n; i++) {
+        Xr[i] = co * A[i] + si * A[i + N * n];
+        Xi[i] = co * A[i + N * n] - si * A[i];
+    }
+    ws_release(mark);
+    return K + 1;
+}
+
+// Propagate n vectors one time step with the Chebyshev expansion
+int propagate_vecs_chebyshev(t_non* non, t_csr* H, float** vr, float** vi, int n, int sign) {
+    int N = non->singles, K;
+    t_wsmark mark = ws_mark();
+    float* Xr = ws_alloc(N * n, sizeof(float));
+    float* Xi = ws_alloc(N * n, sizeof(float));
+
+    pack_vecs(vr, Xr, n, N), pack_vecs(vi, Xi, n, N);
+    K = propagate_block_chebyshev(non, H, Xr, Xi, n, sign);
+    unpack_vecs(vr, Xr, n, N), unpack_vecs(vi, Xi, n, N);
+    ws_release(mark);
+    return K;
+}
+
+// Dense one exciton propagator (Udr,Udi) of the time step dt/m, stored by
+// columns as in propagator_dense, for the two exciton propagation with
+// propagate_doubles_U. The unit vectors are propagated as one block.
+void propagator_chebyshev(t_non* non, t_csr* H, float* Udr, float* Udi, int m) {
+    int N = non->singles;
+    int j;
+    t_non sub = *non;
+
+    sub.deltat = non->deltat / m;
+    clearvec(Udr, N * N), clearvec(Udi, N * N);
+    for (j = 0; j < N; j++) Udr[j + j * N] = 1;
+    propagate_block_chebyshev(&sub, H, Udr, Udi, N, 1);
+}
@@ -0,0 +1,11 @@
+#ifndef _CHEBYSHEV_
+#define _CHEBYSHEV_
+
+#include "types.h"
+#include "sparse.h"
+
+int propagate_block_chebyshev(t_non *non,t_csr *H,float *Xr,float *Xi,int n,int sign);
+int propagate_vecs_chebyshev(t_non *non,t_csr *H,float **vr,float **vi,int n,int sign);
+void propagator_chebyshev(t_non *non,t_csr *H,float *Udr,float *Udi,int m);
+
+#endif // _CHEBYSHEV_
@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <mpi.h>
+#include "types.h"
+#include "NISE_subs.h"
+#include "MPI_subs.h"
+#include "convergence.h"
+
+/* Streaming convergence monitoring for the 2D techniques.                      */
+/* After every work item the change of the accumulators is added to one of     */
+/* STREAM_BATCHES batches of consecutive samples, in the order in which the    */
+/* work queue hands them out. All batches hold the same number of samples,     */
+/* which is doubled by merging neighbouring batches when the samples do not    */
+/* fit. At regular times every process adds its batches to a window on the     */
+/* master, without waiting for the other processes. The master then writes the */
+/* intermediate spectra and estimates the statistical error from the spread of */
+/* the means of the completed batches, and may stop the work queue when it is  */
+/* small enough.                                                               */
+
+// Length of the data of one batch, the accumulators followed by the item count
+static int blockLength(t_stream* st) {
+    return st->nArrays * st->size + 1;
+}
+
+// Length of the data of all batches followed by the number of samples per batch
+static int streamLength(t_stream* st) {
+    return STREAM_BATCHES * blockLength(st) + 1;
+}
+
+// Merge neighbouring batches and double the number of samples per batch
+static void doubleBatches(t_stream* st, float* data) {
+    int l = blockLength(st);
+    for (int b = 0; b < STREAM_BATCHES / 2; b++) {
+        for (int j = 0; j < l; j++) data[b * l + j] = data[2 * b * l + j] + data[(2 * b + 1) * l + j];
+    }
+    clearvec(data + STREAM_BATCHES / 2 * l, STREAM_BATCHES / 2 * l);
+    data[STREAM_BATCHES * l] *= 2;
+}
+
+void initStream(t_stream* st, t_non* non, float*** arrays, char** names, int nArrays, int polItems, char* skip,
+                int totalItems, int parentRank) {
+    int n;
+
+    st->active = non->intermediate > 0 || non->convergence > 0;
+    if (!st->active) return;
+    st->nArrays = nArrays;
+    st->size = waitingTimes(non) * non->tmax3 * non->tmax1;
+    st->polItems = polItems;
+    st->skip = skip;
+    st->totalItems = totalItems;
+    st->arrays = arrays;
+    st->names = names;
+    st->threshold = non->convergence;
+    st->interval = non->intermediate > 0 ? non->intermediate * 60.0 : 60.0;
+    st->last = MPI_Wtime();
+
+    n = streamLength(st);
+    st->snapshot = calloc(nArrays * st->size, sizeof(float));
+    st->delta = calloc(n, sizeof(float));
+    st->sums = calloc(n, sizeof(float));
+    st->delta[n - 1] = 1;
+    for (int i = 0; i < nArrays; i++) copyvec(arrays[i][0], st->snapshot + i * st->size, st->size);
+
+    MPI_Win_allocate(parentRank == 0 ? n * sizeof(float) : 0, sizeof(float), MPI_INFO_NULL, MPI_COMM_WORLD,
+                     &st->base, &st->win);
+    if (parentRank == 0) {
+        MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, st->win);
+        clearvec(st->base, n);
+        st->base[n - 1] = 1;
+        MPI_Win_unlock(0, st->win);
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+}
+
+// Add the batches of this process to those on the master. The batches of the
+// process and the master are first brought to the same number of samples.
+static void flushStream(t_stream* st) {
+    int n = streamLength(st);
+
+    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, st->win);
+    MPI_Get(st->sums, n, MPI_FLOAT, 0, 0, n, MPI_FLOAT, st->win);
+    MPI_Win_flush(0, st->win);
+    while (st->sums[n - 1] < st->delta[n - 1]) doubleBatches(st, st->sums);
+    while (st->delta[n - 1] < st->sums[n - 1]) doubleBatches(st, st->delta);
+    for (int j = 0; j < n - 1; j++) st->sums[j] += st->delta[j];
+    MPI_Put(st->sums, n, MPI_FLOAT, 0, 0, n, MPI_FLOAT, st->win);
+    MPI_Win_unlock(0, st->win);
+    clearvec(st->delta, n - 1);
+}
+
+// Write the intermediate spectra and return the relative statistical error
+static float intermediateSpectra(t_stream* st, t_non* non) {
+    int l = blockLength(st);
+    int B = st->sums[streamLength(st) - 1];
+    int complete[STREAM_BATCHES];
+    int K = 0;
+    float items = 0, error = INFINITY;
+    double var = 0, norm = 0;
+
+    // Only batches with all their samples done are used for the error, these all
+    // have the same number of samples
+    for (int b = 0; b < STREAM_BATCHES; b++) {
+        int first = b * B * st->polItems, last = (b + 1) * B * st->polItems, expected = 0;
+        items += st->sums[b * l + l - 1];
+        if (last > st->totalItems) continue;
+        for (int i = first; i < last; i++) expected += !st->skip[i];
+        if (expected > 0 && st->sums[b * l + l - 1] == expected) complete[K++] = b;
+    }
+    if (items < st->polItems) return INFINITY;
+    float samples = items / st->polItems;
+
+    float** R = (float**)calloc2D(waitingTimes(non) * non->tmax3, non->tmax1, sizeof(float), sizeof(float*));
+    float** I = (float**)calloc2D(waitingTimes(non) * non->tmax3, non->tmax1, sizeof(float), sizeof(float*));
+    for (int a = 0; a < st->nArrays; a++) {
+        float* total = (a % 2 == 0 ? R : I)[0];
+        clearvec(total, st->size);
+        for (int b = 0; b < STREAM_BATCHES; b++) {
+            float* block = st->sums + b * l + a * st->size;
+            for (int j = 0; j < st->size; j++) total[j] += block[j];
+        }
+        // Squared standard error of the mean of every point from the batch means
+        for (int j = 0; j < st->size && K >= STREAM_BATCHES / 2; j++) {
+            double mean = 0, d2 = 0;
+            for (int k = 0; k < K; k++) {
+                float* block = st->sums + complete[k] * l;
+                mean += block[a * st->size + j] / (block[l - 1] / st->polItems);
+            }
+            mean /= K;
+            for (int k = 0; k < K; k++) {
+                float* block = st->sums + complete[k] * l;
+                double d = block[a * st->size + j] / (block[l - 1] / st->polItems) - mean;
+                d2 += d * d;
+            }
+            var += d2 / (K * (K - 1));
+            norm += mean * mean;
+        }
+        if (a % 2 == 1) print2Dseries(st->names[a / 2], R, I, non, (int)(samples + 0.5));
+    }
+    free2D((void**)R), free2D((void**)I);
+    // Norm of the standard errors relative to the norm of the response, which is
+    // only estimated when at least half of the batches are complete
+    if (K >= STREAM_BATCHES / 2 && norm > 0) error = sqrt(var / norm);
+    log_item("Intermediate spectra from %d samples, relative error %g from %d batches\n", (int)(samples + 0.5),
+             error, K);
+    return error;
+}
+
+// Register the response of a completed work item. Returns the number of samples
+// that will be completed when the master stopped the calculation because it
+// converged, otherwise -1.
+int updateStream(t_stream* st, t_non* non, t_workqueue* queue, int item, int parentRank) {
+    float* block;
+    float error;
+    int l, ordinal, items;
+
+    if (!st->active) return -1;
+    l = blockLength(st);
+    ordinal = item / st->polItems;
+    while (ordinal >= STREAM_BATCHES * st->delta[STREAM_BATCHES * l]) doubleBatches(st, st->delta);
+    block = st->delta + ordinal / (int)st->delta[STREAM_BATCHES * l] * l;
+    for (int i = 0; i < st->nArrays; i++) {
+        float* now = st->arrays[i][0];
+        float* before = st->snapshot + i * st->size;
+        for (int j = 0; j < st->size; j++) {
+            block[i * st->size + j] += now[j] - before[j];
+            before[j] = now[j];
+        }
+    }
+    block[l - 1] += 1;
+    if (MPI_Wtime() - st->last < st->interval) return -1;
+
+    // Send the response of the batches to the master
+    flushStream(st);
+    st->last = MPI_Wtime();
+    if (parentRank != 0) return -1;
+
+    error = intermediateSpectra(st, non);
+    if (st->threshold > 0 && error < st->threshold && queue->dynamic && !queue->stopped) {
+        items = stopWorkQueue(queue, st->polItems);
+        printf("Converged to relative error %g, stopping after %d samples.\n", error, items / st->polItems);
+        log_item("Converged to relative error %g, stopping after %d samples.\n", error, items / st->polItems);
+        return items / st->polItems;
+    }
+    return -1;
+}
+
+void freeStream(t_stream* st) {
+    if (!st->active) return;
+    MPI_Win_free(&st->win);
+    free(st->snapshot), free(st->delta), free(st->sums);
+}
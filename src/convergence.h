@@ -0,0 +1,35 @@
+#ifndef _CONVERGENCE_
+#define _CONVERGENCE_
+
+#include <mpi.h>
+#include "types.h"
+#include "MPI_subs.h"
+
+// Number of batches of samples for the statistical error, after merging the
+// batches at least half of them are in use
+#define STREAM_BATCHES 20
+
+// Streaming of the accumulated 2D response to the master for intermediate
+// spectra and statistical error estimates
+typedef struct {
+  int active;
+  int nArrays,size,polItems;
+  char *skip; // Work items completed before a restart, these are not streamed
+  int totalItems;
+  float ***arrays; // Accumulators of this process, each tmax3 x tmax1
+  char **names; // Output file for each pair of real and imaginary accumulators
+  float *snapshot; // Accumulators after the previous work item
+  float *delta; // Response per batch since the last flush, followed by the samples per batch
+  float *sums; // Copy of the response per batch of all processes on the master
+  double interval,last;
+  float threshold;
+  MPI_Win win;
+  float *base;
+} t_stream;
+
+void initStream(t_stream *st,t_non *non,float ***arrays,char **names,int nArrays,int polItems,char *skip,
+                int totalItems,int parentRank);
+int updateStream(t_stream *st,t_non *non,t_workqueue *queue,int item,int parentRank);
+void freeStream(t_stream *st);
+
+#endif // _CONVERGENCE_
@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "types.h"
+#include "NISE_subs.h"
+#include "workspace.h"
+#include "sparse.h"
+#include "krylov.h"
+
+/* Short iterative Lanczos propagation of one exciton vectors.                 */
+/* The vector is propagated with exp(-i H dt) in the Krylov subspace spanned by */
+/* the vector and its products with the Hamiltonian. The subspace grows until   */
+/* the estimated error is below KrylovTolerance relative to the norm of the    */
+/* vector, which only needs products of the sparse Hamiltonian with vectors    */
+/* instead of the full diagonalization. When KRYLOV_MAXDIM vectors are not     */
+/* sufficient the time step is divided in smaller steps. The Lanczos vectors   */
+/* are kept in double precision and orthogonalized against all previous ones.  */
+
+// (yr,yi)=H(xr,xi) with the sparse Hamiltonian
+static void krylov_matvec(t_csr* H, double* xr, double* xi, double* yr, double* yi) {
+    int a, k;
+    double h;
+    for (a = 0; a < H->N; a++) {
+        yr[a] = H->diag[a] * xr[a], yi[a] = H->diag[a] * xi[a];
+        for (k = H->first[a]; k < H->first[a + 1]; k++) {
+            h = H->val[k];
+            yr[a] += h * xr[H->col[k]], yi[a] += h * xi[H->col[k]];
+        }
+    }
+}
+
+// Coefficients (yr,yi) of exp(-i f T) e1 for the m x m tridiagonal Lanczos
+// matrix T with diagonal alpha and off-diagonal beta
+static void krylov_exp(double* alpha, double* beta, int m, double f, double* yr, double* yi) {
+    int j, l;
+    double w;
+    t_wsmark mark = ws_mark();
+    float* T = ws_calloc(m * m, sizeof(float));
+    float* e = ws_alloc(m, sizeof(float));
+
+    for (j = 0; j < m; j++) {
+        T[j + j * m] = alpha[j];
+        if (j + 1 < m) T[j + 1 + j * m] = T[j + (j + 1) * m] = beta[j];
+    }
+    diagonalizeLPD(T, e, m);
+    for (j = 0; j < m; j++) {
+        yr[j] = 0, yi[j] = 0;
+        for (l = 0; l < m; l++) {
+            w = T[l] * T[l + j * m];
+            yr[j] += w * cos(f * e[l]);
+            yi[j] -= w * sin(f * e[l]);
+        }
+    }
+    ws_release(mark);
+}
+
+// Propagate (xr,xi) over the time f in one Krylov subspace. Returns the
+// dimension of the subspace or -1 if the tolerance was not reached.
+static int krylov_step(t_non* non, t_csr* H, double* xr, double* xi, double f, int kmax) {
+    int N = non->singles;
+    int a, j, l, pass;
+    double norm, p, err;
+    double *Vr, *Vi, *wr, *wi;
+    double *alpha, *beta, *yr, *yi;
+    t_wsmark mark = ws_mark();
+
+    norm = 0;
+    for (a = 0; a < N; a++) norm += xr[a] * xr[a] + xi[a] * xi[a];
+    norm = sqrt(norm);
+    if (norm == 0) {
+        ws_release(mark);
+        return 0;
+    }
+
+    Vr = ws_alloc((kmax + 1) * N, sizeof(double));
+    Vi = ws_alloc((kmax + 1) * N, sizeof(double));
+    alpha = ws_alloc(kmax, sizeof(double));
+    beta = ws_alloc(kmax, sizeof(double));
+    yr = ws_alloc(kmax, sizeof(double));
+    yi = ws_alloc(kmax, sizeof(double));
+    for (a = 0; a < N; a++) Vr[a] = xr[a] / norm, Vi[a] = xi[a] / norm;
+
+    for (j = 0; j < kmax; j++) {
+        wr = Vr + (j + 1) * N, wi = Vi + (j + 1) * N;
+        krylov_matvec(H, Vr + j * N, Vi + j * N, wr, wi);
+
+        // Orthogonalize against all previous vectors, twice for stability. The
+        // Hamiltonian is real, so the overlaps of the vectors are real as well.
+        alpha[j] = 0;
+        for (pass = 0; pass < 2; pass++) {
+            for (l = 0; l <= j; l++) {
+                p = 0;
+                for (a = 0; a < N; a++) p += Vr[l * N + a] * wr[a] + Vi[l * N + a] * wi[a];
+                for (a = 0; a < N; a++) wr[a] -= p * Vr[l * N + a], wi[a] -= p * Vi[l * N + a];
+                if (l == j) alpha[j] += p;
+            }
+        }
+        beta[j] = 0;
+        for (a = 0; a < N; a++) beta[j] += wr[a] * wr[a] + wi[a] * wi[a];
+        beta[j] = sqrt(beta[j]);
+
+        // Error estimate from the coupling to the next Krylov vector
+        krylov_exp(alpha, beta, j + 1, f, yr, yi);
+        err = norm * beta[j] * sqrt(yr[j] * yr[j] + yi[j] * yi[j]);
+        if (err <= non->krylovtol * norm || beta[j] == 0) {
+            for (a = 0; a < N; a++) xr[a] = 0, xi[a] = 0;
+            for (l = 0; l <= j; l++) {
+                for (a = 0; a < N; a++) {
+                    xr[a] += norm * (Vr[l * N + a] * yr[l] - Vi[l * N + a] * yi[l]);
+                    xi[a] += norm * (Vr[l * N + a] * yi[l] + Vi[l * N + a] * yr[l]);
+                }
+            }
+            ws_release(mark);
+            return j + 1;
+        }
+        for (a = 0; a < N; a++) wr[a] /= beta[j], wi[a] /= beta[j];
+    }
+    ws_release(mark);
+    return -1;
+}
+
+// Propagate the vector (cr,ci) one time step with the Krylov subspace method.
+// Returns the largest dimension of the Krylov subspace used.
+int propagate_vec_krylov(t_non* non, t_csr* H, float* cr, float* ci, int sign) {
+    int N = non->singles;
+    int kmax = N < KRYLOV_MAXDIM ? N : KRYLOV_MAXDIM;
+    int a, s, m, steps, dim;
+    double f = non->deltat * icm2ifs * twoPi * sign;
+    double *xr, *xi;
+    t_wsmark mark = ws_mark();
+
+    xr = ws_alloc(N, sizeof(double));
+    xi = ws_alloc(N, sizeof(double));
+    for (steps = 1;; steps *= 2) {
+        if (steps > 1024) {
+            printf("The Krylov propagation did not reach the tolerance %g.\n", non->krylovtol);
+            printf("Increase the KrylovTolerance or use a shorter Timestep.\n");
+            exit(1);
+        }
+        for (a = 0; a < N; a++) xr[a] = cr[a], xi[a] = ci[a];
+        dim = 0;
+        for (s = 0; s < steps; s++) {
+            m = krylov_step(non, H, xr, xi, f / steps, kmax);
+            if (m < 0) break;
+            if (m > dim) dim = m;
+        }
+        if (s == steps) break;
+    }
+    for (a = 0; a < N; a++) cr[a] = xr[a], ci[a] = xi[a];
+    ws_release(mark);
+    return dim;
+}
+
+// Dense one exciton propagator (Udr,Udi) of the time step dt/m, stored by
+// columns as in propagator_dense, for the two exciton propagation with
+// propagate_doubles_U. The columns are the propagated unit vectors.
+void propagator_krylov(t_non* non, t_csr* H, float* Udr, float* Udi, int m) {
+    int N = non->singles;
+    int j;
+    t_non sub = *non;
+
+    sub.deltat = non->deltat / m;
+    clearvec(Udr, N * N), clearvec(Udi, N * N);
+    #pragma omp parallel for schedule(dynamic)
+    for (j = 0; j < N; j++) {
+        Udr[j + j * N] = 1;
+        propagate_vec_krylov(&sub, H, Udr + j * N, Udi + j * N, 1);
+    }
+}
@@ -0,0 +1,13 @@
+#ifndef _KRYLOV_
+#define _KRYLOV_
+
+#include "types.h"
+#include "sparse.h"
+
+// Largest dimension of the Krylov subspace before the time step is divided
+#define KRYLOV_MAXDIM 40
+
+int propagate_vec_krylov(t_non *non,t_csr *H,float *cr,float *ci,int sign);
+void propagator_krylov(t_non *non,t_csr *H,float *Udr,float *Udi,int m);
+
+#endif // _KRYLOV_
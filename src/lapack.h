@@ -23,4 +23,25 @@ extern void ssyev_(
               int *info
               );
 
+// Matrix-matrix multiplication from BLAS
+// C = alpha*op(A)*op(B) + beta*C
+// transa/transb 'N'= op(X)=X, 'T'= op(X)=X^T
+// m,n,k = op(A) is m x k, op(B) is k x n and C is m x n
+// lda, ldb, ldc = leading dimensions of the column major matrices
+extern void sgemm_(
+              char *transa,
+              char *transb,
+              int *m,
+              int *n,
+              int *k,
+              float *alpha,
+              float *a,
+              int *lda,
+              float *b,
+              int *ldb,
+              float *beta,
+              float *c,
+              int *ldc
+              );
+
 #endif // LAPACK
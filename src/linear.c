@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include <mpi.h>
+#include "omp.h"
+#include "types.h"
+#include "NISE_subs.h"
+#include "prefetch.h"
+#include "MPI_subs.h"
+#include "sparse.h"
+#include "krylov.h"
+#include "chebyshev.h"
+#include "linear.h"
+
+/* Frame-major driver for the linear response functions.                        */
+/* Instead of walking the tmax frames of every sample in turn, which reads and   */
+/* diagonalizes every frame tmax/Samplerate times, the frames are visited once   */
+/* in order. All samples with a window covering the frame are propagated        */
+/* together as one block of vectors with a single propagator, and each adds its */
+/* response at its own delay. The samples are kept in a ring of slots. When the */
+/* vectors of all overlapping samples do not fit in LINEAR_BLOCK_MB, every k-th */
+/* sample is done in each of k passes over the trajectory.                      */
+/* The frames are read into Hamil_i_e, which for the Coupling Hamiltonian must   */
+/* hold the couplings already.                                                   */
+/* The samples are handed out to the MPI processes in chunks of consecutive      */
+/* samples through the work queue. Within a process the OpenMP threads share the */
+/* propagation of the block and the response of the samples.                    */
+
+// Propagate the n columns of (Xr,Xi) one step, sharing the columns among the threads
+static int linear_propagate(t_non* non, t_lintech* tech, float* Hamil_i_e, t_csr* Hs, float* Xr, float* Xi, int n,
+                            int* start) {
+    int N = non->singles;
+    int elements = N * N;
+    int v, c, nt;
+    float *Ur, *Ui;
+
+    // The schemes based on products with the Hamiltonian use the sparse storage
+    if (non->propagation >= 3 || (non->propagation == 1 && !tech->exponential)) {
+        csr_build(non, Hamil_i_e, Hs);
+    }
+    if (non->propagation == 3) {
+        #pragma omp parallel for schedule(dynamic)
+        for (v = 0; v < n; v++) {
+            if (start[v / tech->nv] == -1) continue;
+            propagate_vec_krylov(non, Hs, Xr + v * N, Xi + v * N, 1);
+        }
+        return elements;
+    }
+    if (non->propagation == 4) {
+        nt = omp_get_max_threads();
+        if (nt > n) nt = n;
+        #pragma omp parallel for num_threads(nt)
+        for (c = 0; c < nt; c++) {
+            int first = c * n / nt;
+            propagate_block_chebyshev(non, Hs, Xr + first * N, Xi + first * N, (c + 1) * n / nt - first, 1);
+        }
+        return elements;
+    }
+
+    if (non->propagation == 1 && !tech->exponential) {
+        #pragma omp parallel for schedule(dynamic)
+        for (v = 0; v < n; v++) {
+            if (start[v / tech->nv] == -1) continue;
+            propagate_vec_coupling_csr(non, Hs, Xr + v * N, Xi + v * N, non->ts, 1);
+        }
+        return elements;
+    }
+    if (non->propagation != 0 && !tech->exponential) return elements;
+
+    Ur = (float *)calloc(N * N, sizeof(float));
+    Ui = (float *)calloc(N * N, sizeof(float));
+    if (non->thres == 0 || non->thres > 1) {
+        propagator_DIA(non, Hamil_i_e, Ur, Ui, 1);
+    } else {
+        elements = propagator_DIA_S(non, Hamil_i_e, Ur, Ui, 1);
+    }
+    nt = omp_get_max_threads();
+    if (nt > n) nt = n;
+    #pragma omp parallel for num_threads(nt)
+    for (c = 0; c < nt; c++) {
+        int first = c * n / nt;
+        propagate_block_U(non, Ur, Ui, Xr + first * N, Xi + first * N, (c + 1) * n / nt - first, 1);
+    }
+    free(Ur), free(Ui);
+    return elements;
+}
+
+// Find the response of the samples begin to end-1
+static void linear_samples(t_non* non, float* Hamil_i_e, FILE* H_traj, FILE* mu_traj, FILE* Cfile, int* Ncl,
+                           t_lintech* tech, float* re_S_1, float* im_S_1, t_prefetch* pf, int begin, int end,
+                           int* reported) {
+    int N = non->singles;
+    int nv = tech->nv;
+    int overlap, maxSlots, passes, nslots, stride;
+    int pass, first, last, f, s, slot, cl, elements;
+    int* start;
+    float *L, *X0, *Xr, *Xi;
+    t_csr* Hs;
+    time_t time_now;
+    FILE* log;
+
+    time(&time_now);
+
+    // Number of samples that are propagated at the same time
+    overlap = (non->tmax + non->sample - 1) / non->sample;
+    maxSlots = (long) LINEAR_BLOCK_MB * 1024 * 1024 / (2 * sizeof(float) * N * nv);
+    if (maxSlots < 1) maxSlots = 1;
+    passes = (overlap + maxSlots - 1) / maxSlots;
+    if (passes > end - begin) passes = end - begin;
+    stride = passes * non->sample;
+    nslots = (non->tmax + stride - 1) / stride;
+
+    L = (float *)calloc(N * nv, sizeof(float));
+    X0 = (float *)calloc(N * nv, sizeof(float));
+    Xr = (float *)calloc((size_t) N * nv * nslots, sizeof(float));
+    Xi = (float *)calloc((size_t) N * nv * nslots, sizeof(float));
+    start = (int *)malloc(nslots * sizeof(int));
+    Hs = csr_init(N);
+    if (Xr == NULL || Xi == NULL) {
+        printf("Could not allocate the vectors of %d samples!\n", nslots);
+        exit(1);
+    }
+    if (passes > 1 && !*reported) {
+        log_item("Linear response in %d passes of %d samples at a time.\n", passes, nslots);
+    }
+
+    for (pass = 0; pass < passes; pass++) {
+        first = (begin + pass) * non->sample;
+        last = ((end - 1 - begin - pass) / passes * passes + begin + pass) * non->sample + non->tmax;
+        for (slot = 0; slot < nslots; slot++) start[slot] = -1;
+        read_ahead(non, H_traj, mu_traj, first, last - first);
+        prefetch_window(pf, first, last - first);
+
+        for (f = first; f < last; f++) {
+            // Sample starting at this frame in the present pass
+            s = (f - first) % stride == 0 && f / non->sample < end ? f / non->sample : -1;
+            for (slot = 0; slot < nslots && start[slot] == -1; slot++);
+            if (s == -1 && slot == nslots) continue; // Frame between samples
+
+            if (read_He(non, Hamil_i_e, H_traj, f) != 1) {
+                printf("Hamiltonian trajectory file to short, could not fill buffer!!!\n");
+                exit(1);
+            }
+            tech->frame(non, tech->data, f, Hamil_i_e, L, X0);
+
+            // Add the new sample
+            if (s != -1 && Cfile != NULL) {
+                if (read_cluster(non, f, &cl, Cfile) != 1) {
+                    printf("Cluster trajectory file to short, could not fill buffer!!!\n");
+                    printf("ITIME %d\n", f);
+                    exit(1);
+                }
+                // Configuration belong to cluster
+                if (non->cluster == cl) {
+                    (*Ncl)++;
+                } else {
+                    s = -1;
+                }
+            }
+            if (s != -1) {
+                slot = (f - first) / stride % nslots;
+                copyvec(X0, Xr + slot * N * nv, N * nv);
+                clearvec(Xi + slot * N * nv, N * nv);
+                start[slot] = f;
+            }
+
+            // Find response, the samples are at different delays
+            #pragma omp parallel for
+            for (slot = 0; slot < nslots; slot++) {
+                int t1, v, i;
+                if (start[slot] == -1) continue;
+                t1 = f - start[slot];
+                if (tech->response != NULL) {
+                    tech->response(non, tech->data, t1, Xr + slot * N * nv, Xi + slot * N * nv);
+                    continue;
+                }
+                for (v = 0; v < nv; v++) {
+                    for (i = 0; i < N; i++) {
+                        re_S_1[t1] += L[v * N + i] * Xr[(slot * nv + v) * N + i];
+                        im_S_1[t1] += L[v * N + i] * Xi[(slot * nv + v) * N + i];
+                    }
+                }
+            }
+
+            // Propagate the vectors of all samples
+            elements = linear_propagate(non, tech, Hamil_i_e, Hs, Xr, Xi, nv * nslots, start);
+            if ((non->propagation == 0 || (tech->exponential && non->propagation < 3)) && non->thres > 0 && non->thres <= 1 && !*reported) {
+                printf("Sparce matrix efficiency: %f pct.\n", (1 - (1.0 * elements / (N * N))) * 100);
+                printf("Pressent tuncation %f.\n", non->thres / ((non->deltat * icm2ifs * twoPi / non->ts) * (non->deltat * icm2ifs * twoPi / non->ts)));
+                printf("Suggested truncation %f.\n", 0.001);
+            }
+            if (Hs->nnz > 0 && !*reported) {
+                printf("Sparse Hamiltonian with %d of %d couplings.\n", Hs->nnz / 2, N * (N - 1) / 2);
+            }
+            *reported = 1;
+
+            // Retire the samples that reached tmax
+            for (slot = 0; slot < nslots; slot++) {
+                if (start[slot] != -1 && f - start[slot] == non->tmax - 1) {
+                    clearvec(Xr + slot * N * nv, N * nv), clearvec(Xi + slot * N * nv, N * nv);
+                    log = fopen("NISE.log", "a");
+                    fprintf(log, "Finished sample %d\n", start[slot] / non->sample);
+                    time_now = log_time(time_now, log);
+                    fclose(log);
+                    start[slot] = -1;
+                }
+            }
+        }
+    }
+
+    free(L), free(X0), free(Xr), free(Xi), free(start);
+    csr_free(Hs);
+}
+
+// Sum an array over all processes on the master, first within the nodes and
+// then over the node roots
+void linear_reduce(float* a, int n, int parentRank, int subRank, MPI_Comm subComm, MPI_Comm rootComm) {
+    if (subRank == 0) MPI_Reduce(MPI_IN_PLACE, a, n, MPI_FLOAT, MPI_SUM, 0, subComm);
+    else MPI_Reduce(a, NULL, n, MPI_FLOAT, MPI_SUM, 0, subComm);
+    if (parentRank == 0) MPI_Reduce(MPI_IN_PLACE, a, n, MPI_FLOAT, MPI_SUM, 0, rootComm);
+    else if (subRank == 0) MPI_Reduce(a, NULL, n, MPI_FLOAT, MPI_SUM, 0, rootComm);
+}
+
+// Find the linear response of the samples non->begin to non->end-1 on all
+// processes. The summed response and cluster count are returned on the master
+void linear_response(t_non* non, float* Hamil_i_e, FILE* H_traj, FILE* mu_traj, FILE* Cfile, int* Ncl, t_lintech* tech,
+                     float* re_S_1, float* im_S_1, int parentRank, int parentSize, int subRank, MPI_Comm subComm,
+                     MPI_Comm rootComm) {
+    int nSamples = non->end - non->begin;
+    int chunk, total, item, count = 0, sum = 0;
+    int reported = parentRank != 0; // Report the truncation on the master only
+    t_prefetch* pf;
+    t_workqueue queue;
+
+    if (nSamples <= 0) return;
+    // Several chunks per process for the load balance, every chunk reads the
+    // frames of its samples once
+    chunk = parentSize == 1 ? nSamples : (nSamples + 4 * parentSize - 1) / (4 * parentSize);
+    total = (nSamples + chunk - 1) / chunk;
+
+    // Start reading frames ahead if requested
+    pf = prefetch_init(non, H_traj, mu_traj);
+
+    initWorkQueue(&queue, total, non->scheduling, parentRank, parentSize);
+    for (item = nextWorkItem(&queue); item >= 0; item = nextWorkItem(&queue)) {
+        int begin = non->begin + item * chunk;
+        int end = begin + chunk < non->end ? begin + chunk : non->end;
+        linear_samples(non, Hamil_i_e, H_traj, mu_traj, Cfile, &count, tech, re_S_1, im_S_1, pf, begin, end,
+                       &reported);
+    }
+    freeWorkQueue(&queue, parentRank, parentSize);
+    prefetch_free(pf);
+
+    if (re_S_1 != NULL) linear_reduce(re_S_1, non->tmax, parentRank, subRank, subComm, rootComm);
+    if (im_S_1 != NULL) linear_reduce(im_S_1, non->tmax, parentRank, subRank, subComm, rootComm);
+    MPI_Reduce(&count, &sum, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+    if (Ncl != NULL) *Ncl = sum;
+}
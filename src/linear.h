@@ -0,0 +1,32 @@
+#ifndef _LINEAR_
+#define _LINEAR_
+
+#include <stdio.h>
+#include <mpi.h>
+#include "types.h"
+
+// Maximum memory in MB for the vectors of the samples propagated together
+#define LINEAR_BLOCK_MB 256
+
+// Technique specific data of one frame. Fills the N x nv matrix L with the
+// vectors the propagated vectors are projected on and the N x nv matrix X0 with
+// the initial vectors of a sample starting at the frame
+typedef void (*t_linframe)(t_non *non,void *data,int frame,float *Hamiltonian_i,float *L,float *X0);
+
+// Response of a sample at delay t1 from its N x nv block of propagated vectors
+typedef void (*t_linresponse)(t_non *non,void *data,int t1,float *Xr,float *Xi);
+
+// Technique specific part of the linear driver
+typedef struct {
+  int nv; // Number of vectors propagated for each sample
+  int exponential; // Propagate with the matrix exponential also for the Coupling scheme
+  t_linframe frame;
+  t_linresponse response; // NULL to project on L and add to re_S_1 and im_S_1
+  void *data;
+} t_lintech;
+
+void linear_response(t_non *non,float *Hamil_i_e,FILE *H_traj,FILE *mu_traj,FILE *Cfile,int *Ncl,t_lintech *tech,float *re_S_1,float *im_S_1,
+                     int parentRank,int parentSize,int subRank,MPI_Comm subComm,MPI_Comm rootComm);
+void linear_reduce(float *a,int n,int parentRank,int subRank,MPI_Comm subComm,MPI_Comm rootComm);
+
+#endif // _LINEAR_
@@ -0,0 +1,258 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include <mpi.h>
+#include "omp.h"
+#include "types.h"
+#include "NISE_subs.h"
+#include "trajectory.h"
+#include "linear.h"
+#include "absorption.h"
+#include "calc_LD.h"
+#include "calc_CD.h"
+#include "luminescence.h"
+#include "linear_multi.h"
+#include "1DFFT.h"
+
+/* Several linear techniques from one propagation.                             */
+/* Absorption, LD, CD and Luminescence propagate the same vectors and differ   */
+/* only in the vectors these are projected on. With a list of techniques like  */
+/* Absorption,LD,CD the vectors of each sample are propagated once with the    */
+/* linear driver, and the frame routine of every technique provides its final  */
+/* vectors. The CD propagates the excitations of the single sites weighted     */
+/* with the dipoles. These sum to the propagated dipoles, so when the CD is    */
+/* included its vectors are shared by the other techniques.                    */
+
+#define MULTI_ABSORPTION 0
+#define MULTI_LD 1
+#define MULTI_CD 2
+#define MULTI_LUMINESCENCE 3
+#define MULTI_MAX 4
+
+static char *multi_names[MULTI_MAX]={"Absorption","LD","CD","Luminescence"};
+static char *multi_tdnames[MULTI_MAX]={"TD_Absorption.dat","TD_LD.dat","TD_CD.dat","RLum.dat"};
+static char *multi_fftnames[MULTI_MAX]={"Absorption.dat","LD.dat","CD.dat","Luminescence.dat"};
+
+typedef struct {
+  int n; // Number of techniques
+  int id[MULTI_MAX];
+  int cd; // The CD vectors are propagated
+  float *L[MULTI_MAX]; // Final vectors of each technique in the present frame
+  float *X0; // Initial vectors of the techniques not setting the propagated ones
+  float *re_S_1[MULTI_MAX],*im_S_1[MULTI_MAX];
+  FILE *mu_traj;
+  t_CDdata cd_data;
+} t_multidata;
+
+// Frame data of all techniques. The CD sets the propagated vectors when it is
+// included, otherwise these are the dipoles that all other techniques start from
+static void multi_frame(t_non *non,void *data,int frame,float *Hamil_i_e,float *L,float *X0){
+  t_multidata *d=data;
+  int k;
+  float *X;
+  for (k=0;k<d->n;k++){
+    X=(d->id[k]==MULTI_CD || !d->cd) ? X0 : d->X0;
+    if (d->id[k]==MULTI_ABSORPTION) absorption_frame(non,d->mu_traj,frame,Hamil_i_e,d->L[k],X);
+    if (d->id[k]==MULTI_LD) LD_frame(non,d->mu_traj,frame,Hamil_i_e,d->L[k],X);
+    if (d->id[k]==MULTI_CD) CD_frame(non,&d->cd_data,frame,Hamil_i_e,d->L[k],X);
+    if (d->id[k]==MULTI_LUMINESCENCE) luminescence_frame(non,d->mu_traj,frame,Hamil_i_e,d->L[k],X);
+  }
+}
+
+// Response of all techniques for a sample at delay t1
+static void multi_response(t_non *non,void *data,int t1,float *Xr,float *Xi){
+  t_multidata *d=data;
+  int N=non->singles;
+  int k,v,i,x,nv;
+  for (k=0;k<d->n;k++){
+    if (d->id[k]==MULTI_CD || !d->cd){
+      nv=d->id[k]==MULTI_CD ? 3*N : 3;
+      for (v=0;v<nv;v++){
+        for (i=0;i<N;i++){
+          d->re_S_1[k][t1]+=d->L[k][v*N+i]*Xr[v*N+i];
+          d->im_S_1[k][t1]+=d->L[k][v*N+i]*Xi[v*N+i];
+        }
+      }
+    } else {
+      // The propagated dipole x is the sum of the CD vectors of the sites for x
+      for (v=0;v<3*N;v++){
+        x=v%3;
+        for (i=0;i<N;i++){
+          d->re_S_1[k][t1]+=d->L[k][x*N+i]*Xr[v*N+i];
+          d->im_S_1[k][t1]+=d->L[k][x*N+i]*Xi[v*N+i];
+        }
+      }
+    }
+  }
+}
+
+void linear_multi(t_non *non,int parentRank,int parentSize,int subRank,int subSize,MPI_Comm subComm,MPI_Comm rootComm){
+  t_lintech tech;
+  t_multidata d;
+  float *Hamil_i_e;
+  float shift1;
+  char list[256];
+  char *name;
+  FILE *H_traj,*mu_traj,*pos_traj=NULL;
+  FILE *outone,*log;
+  FILE *Cfile=NULL;
+  int N,k,id,t1,N_samples,samples,Ncl;
+
+  N=non->singles;
+  // Find the techniques of the list
+  d.n=0,d.cd=0;
+  strncpy(list,non->technique,sizeof(list)-1);
+  list[sizeof(list)-1]='\0';
+  for (name=strtok(list,",");name!=NULL;name=strtok(NULL,",")){
+    for (id=0;id<MULTI_MAX && strcmp(name,multi_names[id]);id++);
+    if (id==MULTI_MAX){
+      if (parentRank==0) printf("The technique %s can not be combined with other linear techniques!\n",name);
+      MPI_Abort(MPI_COMM_WORLD,1);
+    }
+    for (k=0;k<d.n;k++){
+      if (d.id[k]==id){
+        if (parentRank==0) printf("The technique %s is given more than once!\n",name);
+        MPI_Abort(MPI_COMM_WORLD,1);
+      }
+    }
+    d.id[d.n++]=id;
+    if (id==MULTI_CD) d.cd=1;
+  }
+  if (!strcmp(non->hamiltonian,"Coupling")){
+    if (parentRank==0) printf("Combined linear techniques are not implemented for the Coupling Hamiltonian!\n");
+    MPI_Abort(MPI_COMM_WORLD,1);
+  }
+
+  shift1=(non->max1+non->min1)/2;
+  if (parentRank==0) printf("Frequency shift %f.\n",shift1);
+  non->shifte=shift1;
+
+  // Allocate memory
+  Hamil_i_e=(float *)calloc(N*(N+1)/2,sizeof(float));
+  for (k=0;k<d.n;k++){
+    d.L[k]=(float *)calloc(d.id[k]==MULTI_CD ? 3*N*N : 3*N,sizeof(float));
+    d.re_S_1[k]=(float *)calloc(non->tmax,sizeof(float));
+    d.im_S_1[k]=(float *)calloc(non->tmax,sizeof(float));
+  }
+  d.X0=(float *)calloc(3*N,sizeof(float));
+
+  /* Open Trajectory files */
+  H_traj=fopen(non->energyFName,"rb");
+  if (H_traj==NULL){
+    printf("Hamiltonian file not found!\n");
+    exit(1);
+  }
+
+  mu_traj=fopen(non->dipoleFName,"rb");
+  if (mu_traj==NULL){
+    printf("Dipole file %s not found!\n",non->dipoleFName);
+    exit(1);
+  }
+  d.mu_traj=mu_traj;
+
+  if (d.cd){
+    pos_traj=fopen(non->positionFName,"rb");
+    if (pos_traj==NULL){
+      printf("Position file %s not found!\n",non->positionFName);
+      exit(1);
+    }
+    d.cd_data.mu_traj=mu_traj;
+    d.cd_data.pos_traj=pos_traj;
+    d.cd_data.mu=(float *)calloc(3*N,sizeof(float));
+    d.cd_data.pos=(float *)calloc(3*N,sizeof(float));
+  }
+
+  /* Open file with cluster information if appicable */
+  if (non->cluster!=-1){
+    Cfile=fopen("Cluster.bin","rb");
+    if (Cfile==NULL){
+      printf("Cluster option was activated but no Cluster.bin file provided.\n");
+      printf("Please, provide cluster file or remove Cluster keyword from\n");
+      printf("input file.\n");
+      exit(0);
+    }
+    Ncl=0; // Counter for snapshots calculated
+  }
+
+  // Here we want to call the routine for checking the trajectory files
+  control(non);
+
+  N_samples=(non->length-non->tmax1-1)/non->sample+1;
+  if (N_samples>0) {
+    if (parentRank==0) printf("Making %d samples!\n",N_samples);
+  } else {
+    printf("Insufficient data to calculate spectrum.\n");
+    printf("Please, lower max times or provide longer\n");
+    printf("trajectory.\n");
+    exit(1);
+  }
+
+  if (non->end==0) non->end=N_samples;
+
+  if (parentRank==0){
+    log=fopen("NISE.log","a");
+    fprintf(log,"Begin sample: %d, End sample: %d.\n",non->begin,non->end);
+    fclose(log);
+  }
+
+  // Propagate all samples in one pass over the trajectory for all techniques
+  tech.nv=d.cd ? 3*N : 3;
+  tech.exponential=0;
+  tech.frame=multi_frame;
+  tech.response=multi_response;
+  tech.data=&d;
+  linear_response(non,Hamil_i_e,H_traj,mu_traj,Cfile,&Ncl,&tech,NULL,NULL,
+                  parentRank,parentSize,subRank,subComm,rootComm);
+  for (k=0;k<d.n;k++){
+    linear_reduce(d.re_S_1[k],non->tmax,parentRank,subRank,subComm,rootComm);
+    linear_reduce(d.im_S_1[k],non->tmax,parentRank,subRank,subComm,rootComm);
+  }
+  samples=non->end;
+  free(Hamil_i_e),free(d.X0);
+  for (k=0;k<d.n;k++) free(d.L[k]);
+
+  traj_fclose(mu_traj),traj_fclose(H_traj);
+  if (d.cd){
+    traj_fclose(pos_traj);
+    free(d.cd_data.mu),free(d.cd_data.pos);
+  }
+  if (non->cluster!=-1){
+    traj_fclose(Cfile);
+  }
+
+  // Only the master writes the results
+  if (parentRank==0){
+    log=fopen("NISE.log","a");
+    fprintf(log,"Finished Calculating Response!\n");
+    fprintf(log,"Writing to file!\n");
+    fclose(log);
+
+    if (non->cluster!=-1){
+      printf("Of %d samples %d belonged to cluster %d.\n",samples,Ncl,non->cluster);
+      if (samples==0){ // Avoid dividing by zero
+        samples=1;
+      }
+    }
+
+    for (k=0;k<d.n;k++){
+      /* Save time domain response */
+      outone=fopen(multi_tdnames[d.id[k]],"w");
+      for (t1=0;t1<non->tmax1;t1+=non->dt1){
+        fprintf(outone,"%f %e %e\n",t1*non->deltat,d.re_S_1[k][t1]/samples,d.im_S_1[k][t1]/samples);
+      }
+      fclose(outone);
+
+      /* Do Forier transform and save */
+      do_1DFFT(non,multi_fftnames[d.id[k]],d.re_S_1[k],d.im_S_1[k],samples);
+    }
+
+    printf("----------------------------------------------\n");
+    printf(" %s calculation succesfully completed\n",non->technique);
+    printf("----------------------------------------------\n\n");
+  }
+
+  for (k=0;k<d.n;k++) free(d.re_S_1[k]),free(d.im_S_1[k]);
+  return;
+}
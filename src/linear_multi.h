@@ -0,0 +1,6 @@
+#ifndef _LINEAR_MULTI_
+#define _LINEAR_MULTI_
+#include <mpi.h>
+void linear_multi(t_non *non,int parentRank,int parentSize,int subRank,int subSize,MPI_Comm subComm,MPI_Comm rootComm);
+
+#endif // _LINEAR_MULTI_
@@ -4,21 +4,42 @@
 #include <string.h>
 #include <time.h>
 #include <fftw3.h>
+#include <mpi.h>
 #include "omp.h"
 #include "types.h"
 #include "NISE_subs.h"
+#include "trajectory.h"
+#include "linear.h"
 #include "absorption.h"
 #include "luminescence.h"
 #include "1DFFT.h"
 
-void luminescence(t_non *non){
+// Frame data for the luminescence: the initial vectors are the transition
+// dipoles and the final vectors the Boltzmann weighted transition dipoles
+void luminescence_frame(t_non *non,void *data,int frame,float *Hamil_i_e,float *L,float *X0){
+  FILE *mu_traj=data;
+  int x,N=non->singles;
+  for (x=0;x<3;x++){
+    if (read_mue(non,X0+x*N,mu_traj,frame,x)!=1){
+      printf("Dipole trajectory file to short, could not fill buffer!!!\n");
+      printf("JTIME %d %d\n",frame,x);
+      exit(1);
+    }
+    copyvec(X0+x*N,L+x*N,N);
+    // Do projection on selected sites if asked
+    if (non->Npsites>0){
+      projection(L+x*N,non);
+    }
+    // Add Boltzman weight
+    bltz_weight(L+x*N,Hamil_i_e,non);
+  }
+}
+
+void luminescence(t_non *non,int parentRank,int parentSize,int subRank,int subSize,MPI_Comm subComm,MPI_Comm rootComm){
   // Initialize variables
   float *re_S_1,*im_S_1; // The first-order response function
-  float *mu_eg,*Hamil_i_e;
-
-  // Aid arrays
-  float *vecr,*veci;
-  //,*vecr_old,*veci_old;
+  t_lintech tech;
+  float *Hamil_i_e;
 
   /* Floats */
   float shift1;
@@ -34,9 +55,7 @@ void luminescence(t_non *non){
   int nn2;
   int itime,N_samples;
   int samples;
-  int x,ti,tj,i;
   int t1,fft;
-  int elements;
 
   /* Time parameters */
   time_t time_now,time_old,time_0;
@@ -45,9 +64,9 @@ void luminescence(t_non *non){
   time(&time_now);
   time(&time_0);
   shift1=(non->max1+non->min1)/2;
-  printf("Frequency shift %f.\n",shift1);
+  if (parentRank==0) printf("Frequency shift %f.\n",shift1);
   non->shifte=shift1;
-  printf("Temperature %f.\n",non->temperature);
+  if (parentRank==0) printf("Temperature %f.\n",non->temperature);
 
   // Allocate memory
   re_S_1=(float *)calloc(non->tmax,sizeof(float));
@@ -74,7 +93,7 @@ void luminescence(t_non *non){
   // Do calculation
   N_samples=(non->length-non->tmax1-1)/non->sample+1;
   if (N_samples>0) {
-    printf("Making %d samples!\n",N_samples);
+    if (parentRank==0) printf("Making %d samples!\n",N_samples);
   } else {
     printf("Insufficient data to calculate spectrum.\n");
     printf("Please, lower max times or provide longer\n");
@@ -84,105 +103,37 @@ void luminescence(t_non *non){
 
   if (non->end==0) non->end=N_samples;
 
-  log=fopen("NISE.log","a");
-  fprintf(log,"Begin sample: %d, End sample: %d.\n",non->begin,non->end);
-  fclose(log);
-
-  vecr=(float *)calloc(non->singles,sizeof(float));	
-  veci=(float *)calloc(non->singles,sizeof(float));
-//  vecr_old=(float *)calloc(non->singles,sizeof(float));
-//  veci_old=(float *)calloc(non->singles,sizeof(float));
-  mu_eg=(float *)calloc(non->singles,sizeof(float));
-
-  // Loop over samples
-  for (samples=non->begin;samples<non->end;samples++){
-
-    // Calculate linear response    
-    ti=samples*non->sample;
-    for (x=0;x<3;x++){
-      // Read mu(ti)
-      if (read_mue(non,vecr,mu_traj,ti,x)!=1){
-	printf("Dipole trajectory file to short, could not fill buffer!!!\n");
-	printf("ITIME %d %d\n",ti,x);
-	exit(1);
-      }
-      clearvec(veci,non->singles);
-//      copyvec(vecr,vecr_old,non->singles);
-      copyvec(vecr,mu_eg,non->singles);
-
-      // Add Boltzman weight
-      bltz_weight(mu_eg,Hamil_i_e,non);
-
-      // Loop over delay
-      for (t1=0;t1<non->tmax;t1++){
-	tj=ti+t1;
-	// Read Hamiltonian
-	if (read_He(non,Hamil_i_e,H_traj,tj)!=1){
-	  printf("Hamiltonian trajectory file to short, could not fill buffer!!!\n");
-	  exit(1);
-	}
-	
-	// Read mu(tj)
-	if (read_mue(non,mu_eg,mu_traj,tj,x)!=1){
-	  printf("Dipole trajectory file to short, could not fill buffer!!!\n");
-	  printf("JTIME %d %d\n",tj,x);
-	  exit(1);
-	}
-
-	// Do projection on selected sites if asked
-	if (non->Npsites>0){
-	  projection(mu_eg,non);
-	}
-
-	// Add Boltzman weight
-	bltz_weight(mu_eg,Hamil_i_e,non);
-	
-	// Find response
-	calc_S1(re_S_1,im_S_1,t1,non,vecr,veci,mu_eg);
-
-	// Probagate vector
-	if (non->propagation==1) propagate_vec_coupling_S(non,Hamil_i_e,vecr,veci,non->ts,1);
-	if (non->propagation==0){
-	  if (non->thres==0 || non->thres>1){
-	    propagate_vec_DIA(non,Hamil_i_e,vecr,veci,1);
-	  } else {
-	    elements=propagate_vec_DIA_S(non,Hamil_i_e,vecr,veci,1);
-	    if (samples==non->begin){
-	      if (t1==0){
-		if (x==0){
-		  printf("Sparce matrix efficiency: %f pct.\n",(1-(1.0*elements/(non->singles*non->singles)))*100);
-		  printf("Pressent tuncation %f.\n",non->thres/((non->deltat*icm2ifs*twoPi/non->ts)*(non->deltat*icm2ifs*twoPi/non->ts)));
-		  printf("Suggested truncation %f.\n",0.001);
-		}
-	      }
-	    }
-	  }
-	}
-      }
-    }
-  
-    // Log time
+  if (parentRank==0){
     log=fopen("NISE.log","a");
-    fprintf(log,"Finished sample %d\n",samples);
-    time_now=log_time(time_now,log);
+    fprintf(log,"Begin sample: %d, End sample: %d.\n",non->begin,non->end);
     fclose(log);
   }
 
-  free(vecr);
-  free(veci);
-//  free(vecr_old);
-//  free(veci_old);
-  free(mu_eg);
+  // Propagate all samples in one pass over the trajectory
+  tech.nv=3;
+  tech.exponential=0;
+  tech.frame=luminescence_frame;
+  tech.response=NULL;
+  tech.data=mu_traj;
+  linear_response(non,Hamil_i_e,H_traj,mu_traj,NULL,NULL,&tech,re_S_1,im_S_1,
+                  parentRank,parentSize,subRank,subComm,rootComm);
+  samples=non->end;
   free(Hamil_i_e);
 
+  traj_fclose(mu_traj),traj_fclose(H_traj);
+
+  // Only the master writes the results
+  if (parentRank!=0){
+    free(re_S_1),free(im_S_1);
+    return;
+  }
+
   // The calculation is finished, lets write output
   log=fopen("NISE.log","a");
   fprintf(log,"Finished Calculating Response!\n");
   fprintf(log,"Writing to file!\n");  
   fclose(log);
 
-  fclose(mu_traj),fclose(H_traj);
-
   outone=fopen("RLum.dat","w");
   for (t1=0;t1<non->tmax1;t1+=non->dt1){
     fprintf(outone,"%f %e %e\n",t1*non->deltat,re_S_1[t1]/samples,im_S_1[t1]/samples);
@@ -224,7 +175,7 @@ void bltz_weight(float *mu_eg,float *Hamiltonian_i,t_non *non){
   crr=(float *)calloc(N*N,sizeof(float));
   int a,b,c;
   float kBT=non->temperature*0.695; // Kelvin to cm-1
-  float Q,iQ;
+  float Q=0,iQ;
 
   // Build Hamiltonian
   for (a=0;a<N;a++){
@@ -1,6 +1,8 @@
 #ifndef _LUMINESCENCE_
 #define _LUMINESCENCE_
-void luminescence(t_non *non);
+#include <mpi.h>
+void luminescence(t_non *non,int parentRank,int parentSize,int subRank,int subSize,MPI_Comm subComm,MPI_Comm rootComm);
+void luminescence_frame(t_non *non,void *data,int frame,float *Hamil_i_e,float *L,float *X0);
 void calc_LUM(float *re_S_1,float *im_S_1,int t1,t_non *non,float *cr,float *ci,float *mu);
 void bltz_weight(float *mu_eg,float *Hamil_i_e,t_non *non);
 #endif // _LUMINESCENCE_
@@ -4,24 +4,84 @@
 #include <string.h>
 #include <time.h>
 #include <fftw3.h>
+#include <mpi.h>
 #include "omp.h"
 #include "types.h"
 #include "NISE_subs.h"
+#include "trajectory.h"
+#include "workspace.h"
+#include "linear.h"
 #include "population.h"
 
-void population(t_non *non){
+typedef struct {
+  float *H,*e; // Eigen basis of the present frame or of the average Hamiltonian
+  float *Pop,*PopF;
+} t_popdata;
+
+// Every sample starts from the unit propagator. The adiabatic basis is found
+// once per frame for all samples
+static void population_frame(t_non *non,void *data,int frame,float *Hamil_i_e,float *L,float *X0){
+  t_popdata *d=data;
+  int a,N=non->singles;
+  clearvec(X0,N*N);
+  for (a=0;a<N;a++) X0[a+a*N]=1.0;
+  if (!strcmp(non->basis,"Adiabatic")){
+    build_diag_H(Hamil_i_e,d->H,d->e,N);
+  }
+}
+
+/* Calculate population evolution from the propagator (vecr,veci) at delay t1 */
+static void population_response(t_non *non,void *data,int t1,float *vecr,float *veci){
+  t_popdata *d=data;
+  float *H=d->H,*Pop=d->Pop,*PopF=d->PopF;
+  float *Tr,*Ti,*Pr,*Pi;
+  float one=1,zero=0;
+  int a,b,N=non->singles;
+  t_wsmark mark;
+  if (!strcmp(non->basis,"Local")){ /* Local basis */
+    for (a=0;a<non->singles;a++){
+      Pop[t1]+=vecr[a+a*non->singles]*vecr[a+a*non->singles];
+      Pop[t1]+=veci[a+a*non->singles]*veci[a+a*non->singles];
+    }           
+    for (a=0;a<non->singles;a++){
+      for (b=0;b<non->singles;b++){
+        PopF[t1+(non->singles*b+a)*non->tmax]+=vecr[a+b*non->singles]*vecr[a+b*non->singles];
+        PopF[t1+(non->singles*b+a)*non->tmax]+=veci[a+b*non->singles]*veci[a+b*non->singles];
+      }
+    }
+  } else { /* Adiabatic or average eigen basis */
+    /* Transform the propagator to the eigen basis, P=H^T U H */
+    mark=ws_mark();
+    Tr=ws_alloc(N*N,sizeof(float));
+    Ti=ws_alloc(N*N,sizeof(float));
+    Pr=ws_alloc(N*N,sizeof(float));
+    Pi=ws_alloc(N*N,sizeof(float));
+    sgemm_("N","N",&N,&N,&N,&one,vecr,&N,H,&N,&zero,Tr,&N);
+    sgemm_("T","N",&N,&N,&N,&one,H,&N,Tr,&N,&zero,Pr,&N);
+    sgemm_("N","N",&N,&N,&N,&one,veci,&N,H,&N,&zero,Ti,&N);
+    sgemm_("T","N",&N,&N,&N,&one,H,&N,Ti,&N,&zero,Pi,&N);
+    /* Loop over final and initial states */
+    for (a=0;a<non->singles;a++){
+      Pop[t1]+=Pr[a+a*N]*Pr[a+a*N]+Pi[a+a*N]*Pi[a+a*N];
+      for (b=0;b<non->singles;b++){
+        PopF[t1+(non->singles*b+a)*non->tmax]+=Pr[a+b*N]*Pr[a+b*N]+Pi[a+b*N]*Pi[a+b*N];
+      }
+    }
+    ws_release(mark);
+  }
+}
+
+void population(t_non *non,int parentRank,int parentSize,int subRank,int subSize,MPI_Comm subComm,MPI_Comm rootComm){
   // Initialize variables
   float avall,flucall;
   float *Hamil_i_e,*H,*e,*Hamil_av;
 
-  // Aid arrays
-  float *vecr,*veci,*vecr_old,*veci_old;
   float *Pop,*PopF;
+  t_popdata data;
+  t_lintech tech;
 
   /* Floats */
   float shift1;
-  float x;
-  float pr,pi;
 
   /* File handles */
   FILE *H_traj;
@@ -31,12 +91,10 @@ void population(t_non *non){
   int nn2,N;
   int itime,N_samples;
   int samples;
-  int ti,tj,i,j;
-  int t1,fft;
-  int elements;
+  int ti;
+  int t1;
   int Nsam;
-  int counts;
-  int a,b,c,d;
+  int a,b;
 
   /* Time parameters */
   time_t time_now,time_old,time_0;
@@ -44,7 +102,7 @@ void population(t_non *non){
   time(&time_now);
   time(&time_0);
   shift1=(non->max1+non->min1)/2;
-  printf("Frequency shift %f.\n",shift1);
+  if (parentRank==0) printf("Frequency shift %f.\n",shift1);
   non->shifte=shift1;
 
   // Allocate memory
@@ -68,7 +126,7 @@ void population(t_non *non){
   // Do calculation
   N_samples=(non->length-non->tmax1-1)/non->sample+1;
   if (N_samples>0) {
-    printf("Making %d samples!\n",N_samples);
+    if (parentRank==0) printf("Making %d samples!\n",N_samples);
   } else {
     printf("Insufficient data to calculate spectrum.\n");
     printf("Please, lower max times or provide longer\n");
@@ -79,19 +137,21 @@ void population(t_non *non){
   if (non->end==0) non->end=N_samples;
   Nsam=non->end-non->begin;
 
-  log=fopen("NISE.log","a");
-  fprintf(log,"Begin sample: %d, End sample: %d.\n",non->begin,non->end);
-  fclose(log);
-
-  if (!strcmp(non->basis,"Local")){
-    printf("Using the local (site) basis for population transfer.\n");
-    printf("The transfer rates are between sites.\n");
-  } else if (!strcmp(non->basis,"Adiabatic")) {
-    printf("Using the adiabatic eigen basis for population transfer.\n");
-    printf("The transfer rates are between eigenstates.\n");
-  } else if (!strcmp(non->basis,"Average")) {
-    printf("Using the average eigen basis for population transfer.\n");
-    printf("The transfer rates are between eigenstates.\n");
+  if (parentRank==0){
+    log=fopen("NISE.log","a");
+    fprintf(log,"Begin sample: %d, End sample: %d.\n",non->begin,non->end);
+    fclose(log);
+
+    if (!strcmp(non->basis,"Local")){
+      printf("Using the local (site) basis for population transfer.\n");
+      printf("The transfer rates are between sites.\n");
+    } else if (!strcmp(non->basis,"Adiabatic")) {
+      printf("Using the adiabatic eigen basis for population transfer.\n");
+      printf("The transfer rates are between eigenstates.\n");
+    } else if (!strcmp(non->basis,"Average")) {
+      printf("Using the average eigen basis for population transfer.\n");
+      printf("The transfer rates are between eigenstates.\n");
+    }
   }
 
   // Find average basis
@@ -114,128 +174,38 @@ void population(t_non *non){
     build_diag_H(Hamil_av,H,e,non->singles);
   }
 
-  /* Loop over samples */
-  for (samples=non->begin;samples<non->end;samples++){
-    vecr=(float *)calloc(non->singles*non->singles,sizeof(float));
-    veci=(float *)calloc(non->singles*non->singles,sizeof(float));
-    /* Initialize */
-      for (a=0;a<non->singles;a++) vecr[a+a*non->singles]=1.0;
-
-    ti=samples*non->sample;      
-    for (t1=0;t1<non->tmax;t1++){
-      tj=ti+t1;
-      /* Read Hamiltonian */
-      if (read_He(non,Hamil_i_e,H_traj,tj)!=1){
-        printf("Hamiltonian trajectory file to short, could not fill buffer!!!\n");
-        exit(1);
-      }
-      /* Calculate population evolution */
-      if (!strcmp(non->basis,"Local")){ /* Local basis */
-        for (a=0;a<non->singles;a++){
-          Pop[t1]+=vecr[a+a*non->singles]*vecr[a+a*non->singles];
-          Pop[t1]+=veci[a+a*non->singles]*veci[a+a*non->singles];
-        }           
-        for (a=0;a<non->singles;a++){
-          for (b=0;b<non->singles;b++){
-            PopF[t1+(non->singles*b+a)*non->tmax]+=vecr[a+b*non->singles]*vecr[a+b*non->singles];
-            PopF[t1+(non->singles*b+a)*non->tmax]+=veci[a+b*non->singles]*veci[a+b*non->singles];
-          }
-        }
-      } else if (!strcmp(non->basis,"Adiabatic")) { /* Adiabatic eigen basis */
-        /* Read Hamiltonian */
-        if (read_He(non,Hamil_i_e,H_traj,ti+t1)!=1){
-          printf("Hamiltonian trajectory file to short, could not fill buffer!!!\n");
-          exit(1);
-        }
-        build_diag_H(Hamil_i_e,H,e,non->singles);
-        /* Loop over final/initial adabatic states */
-        for (a=0;a<non->singles;a++){
-          pr=0;
-          pi=0;
-          /* Loop over sites */
-          for (b=0;b<non->singles;b++){
-            /* Loop over sites */
-            for (c=0;c<non->singles;c++){
-              pr+=H[b+a*non->singles]*vecr[b+c*non->singles]*H[c+a*non->singles];
-              pi+=H[b+a*non->singles]*veci[b+c*non->singles]*H[c+a*non->singles];
-            }
-          }
-          Pop[t1]+=pr*pr+pi*pi;
-        }
-        /* Loop over final and initial states */
-        for (a=0;a<non->singles;a++){
-          for (d=0;d<non->singles;d++){
-            pr=0;
-            pi=0;
-            for (c=0;c<non->singles;c++){
-            /* Loop over sites */
-              for (b=0;b<non->singles;b++){
-                pr+=H[b+a*non->singles]*vecr[b+c*non->singles]*H[c+d*non->singles];
-                pi+=H[b+a*non->singles]*veci[b+c*non->singles]*H[c+d*non->singles];
-              }
-            }
-            PopF[t1+(non->singles*d+a)*non->tmax]+=pr*pr+pi*pi;
-          }
-        }
-      } else if (!strcmp(non->basis,"Average")) { /* Average eigen basis */
-      /* Loop over final/initial adabatic states */
-        for (a=0;a<non->singles;a++){
-          pr=0;
-          pi=0;
-          /* Loop over sites */
-          for (b=0;b<non->singles;b++){
-            /* Loop over sites */
-            for (c=0;c<non->singles;c++){
-              pr+=H[b+a*non->singles]*vecr[b+c*non->singles]*H[c+a*non->singles];
-              pi+=H[b+a*non->singles]*veci[b+c*non->singles]*H[c+a*non->singles];
-            }
-          }
-          Pop[t1]+=pr*pr+pi*pi;
-        }
-        /* Loop over final and initial states */
-        for (a=0;a<non->singles;a++){
-          for (d=0;d<non->singles;d++){
-            pr=0;
-            pi=0;
-            for (c=0;c<non->singles;c++){
-            /* Loop over sites */
-              for (b=0;b<non->singles;b++){
-                pr+=H[b+a*non->singles]*vecr[b+c*non->singles]*H[c+d*non->singles];
-                pi+=H[b+a*non->singles]*veci[b+c*non->singles]*H[c+d*non->singles];
-              }
-            }
-            PopF[t1+(non->singles*d+a)*non->tmax]+=pr*pr+pi*pi;
-          }
-        }
-
-
-      }
-      for (a=0;a<non->singles;a++){
-        /* Probagate vector */
-        if (non->thres==0 || non->thres>1){
-          propagate_vec_DIA(non,Hamil_i_e,vecr+a*non->singles,veci+a*non->singles,1);
-        } else {
-          elements=propagate_vec_DIA_S(non,Hamil_i_e,vecr+a*non->singles,veci+a*non->singles,1);
-          if (samples==non->begin && a==0){
-            if (t1==0){
-              printf("\n");
-              printf("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n");
-              printf("WARNING!!! You are propagating the population with the Coupling scheme!\n");
-              printf("This may lead to large errors and carefull testing to the Trotter setting\n");
-              printf("must be performed. The Coupling scheme is often only reliable for short times.\n");
-              printf("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n\n");
-              printf("Sparce matrix efficiency: %f pct.\n",(1-(1.0*elements/(non->singles*non->singles)))*100);
-              printf("Pressent tuncation %f.\n",non->thres/(non->deltat*icm2ifs*twoPi/non->ts)*(non->deltat*icm2ifs*twoPi/non->ts));
-              printf("Suggested truncation %f.\n",0.001);
-            }
-          }
-        }
-      }
-    }
+  if (parentRank==0 && non->thres!=0 && non->thres<=1){
+    printf("\n");
+    printf("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n");
+    printf("WARNING!!! You are propagating the population with the Coupling scheme!\n");
+    printf("This may lead to large errors and carefull testing to the Trotter setting\n");
+    printf("must be performed. The Coupling scheme is often only reliable for short times.\n");
+    printf("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n\n");
+  }
 
+  /* Propagate the full propagator of all samples in one pass over the trajectory */
+  data.H=H;
+  data.e=e;
+  data.Pop=Pop;
+  data.PopF=PopF;
+  tech.nv=N;
+  tech.exponential=1;
+  tech.frame=population_frame;
+  tech.response=population_response;
+  tech.data=&data;
+  linear_response(non,Hamil_i_e,H_traj,NULL,NULL,NULL,&tech,NULL,NULL,
+                  parentRank,parentSize,subRank,subComm,rootComm);
+  linear_reduce(Pop,non->tmax,parentRank,subRank,subComm,rootComm);
+  linear_reduce(PopF,non->tmax*N*N,parentRank,subRank,subComm,rootComm);
+  traj_fclose(H_traj);
+
+  // Only the master writes the results
+  if (parentRank!=0){
+    free(Hamil_i_e),free(Hamil_av),free(H),free(e),free(Pop),free(PopF);
+    return;
   }
-  /* Correct for when not starting at sample zero */
-  samples=samples-non->begin;
+
+  samples=Nsam;
   /* Write populations */
   outone=fopen("Pop.dat","w");
   if (outone==NULL){
@@ -276,9 +246,6 @@ void population(t_non *non){
   fprintf(log,"Writing to file!\n");  
   fclose(log);
 
-  fclose(H_traj);
- 
-
   printf("----------------------------------------------\n");
   printf(" Population calculation succesfully completed\n");
   printf("----------------------------------------------\n\n");
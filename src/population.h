@@ -1,4 +1,5 @@
 #ifndef _POPULATION_
 #define _POPULATION_
-void population(t_non *non);
+#include <mpi.h>
+void population(t_non *non,int parentRank,int parentSize,int subRank,int subSize,MPI_Comm subComm,MPI_Comm rootComm);
 #endif // _POPULATION_
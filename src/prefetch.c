@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+    #include <pthread.h>
+#endif
+#include "types.h"
+#include "NISE_subs.h"
+#include "trajectory.h"
+#include "prefetch.h"
+
+/* Frame prefetching for the trajectory readers.                               */
+/* A reader thread reads the Hamiltonian, with the center frequency removed,   */
+/* and the three dipole components of the frames of the present sample window  */
+/* into a ring of non->prefetch slots. The ring also keeps the latest frame    */
+/* used, whose dipoles are read after its Hamiltonian, so the reader stays at  */
+/* most one frame less than the number of slots ahead of it. read_He and       */
+/* read_mue take frames from the ring and read the file themselves when a      */
+/* frame is not there, so the results do not depend on the prefetching. The   */
+/* reader uses its own file handles.                                           */
+
+#ifndef _WIN32
+
+struct t_prefetch {
+  t_non *non;
+  FILE *H_traj,*mu_traj; // Handles used by the propagation
+  FILE *H_own,*mu_own; // Handles used by the reader thread
+  int depth; // Number of slots
+  int nH,nmu; // Size of the Hamiltonian and dipoles of one frame
+  float *He,*mu; // Decoded frames for all slots
+  int *slot; // Frame stored in each slot, -1 if empty
+  int first,count; // Present window of frames
+  int next; // Next frame to read
+  int head; // Latest frame used
+  int busy; // Frame being read, -1 if none
+  int gen; // Incremented when the window changes
+  int stop;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+};
+
+// The prefetcher used by read_He and read_mue
+static t_prefetch* active = NULL;
+
+static void* prefetch_reader(void* arg) {
+    t_prefetch* pf = arg;
+    int f, s, g, x, ok;
+
+    pthread_mutex_lock(&pf->lock);
+    while (!pf->stop) {
+        // The slot of frame head+depth is that of the frame in use
+        if (pf->next >= pf->first + pf->count || pf->next >= pf->head + pf->depth) {
+            pthread_cond_wait(&pf->cond, &pf->lock);
+            continue;
+        }
+        f = pf->next++;
+        s = (f - pf->first) % pf->depth;
+        g = pf->gen;
+        pf->slot[s] = -1;
+        pf->busy = f;
+        pthread_mutex_unlock(&pf->lock);
+
+        ok = read_He(pf->non, pf->He + s * pf->nH, pf->H_own, f) == 1;
+        for (x = 0; x < 3 && ok && pf->mu_own != NULL; x++) {
+            ok = read_mue(pf->non, pf->mu + s * pf->nmu + x * pf->non->singles, pf->mu_own, f, x) == 1;
+        }
+
+        pthread_mutex_lock(&pf->lock);
+        pf->busy = -1;
+        if (g == pf->gen) {
+            if (ok) pf->slot[s] = f;
+            else pf->next = pf->first + pf->count;
+        }
+        pthread_cond_broadcast(&pf->cond);
+    }
+    pthread_mutex_unlock(&pf->lock);
+    return NULL;
+}
+
+// Start the reader thread, returns NULL when prefetching is not used
+t_prefetch* prefetch_init(t_non* non, FILE* H_traj, FILE* mu_traj) {
+    t_prefetch* pf;
+    int i;
+
+    if (non->prefetch <= 0 || !strcmp(non->hamiltonian, "Coupling")) return NULL;
+    if (active != NULL) return NULL;
+
+    pf = calloc(1, sizeof(t_prefetch));
+    pf->non = non;
+    pf->H_traj = H_traj;
+    pf->mu_traj = mu_traj;
+    pf->H_own = fopen(non->energyFName, "rb");
+    if (pf->H_own == NULL) {
+        free(pf);
+        return NULL;
+    }
+    if (mu_traj != NULL) pf->mu_own = fopen(non->dipoleFName, "rb");
+    if (mu_traj != NULL && pf->mu_own == NULL) {
+        traj_fclose(pf->H_own);
+        free(pf);
+        return NULL;
+    }
+    pf->depth = non->prefetch;
+    pf->nH = non->singles * (non->singles + 1) / 2;
+    pf->nmu = 3 * non->singles;
+    pf->He = calloc((size_t)pf->depth * pf->nH, sizeof(float));
+    pf->mu = calloc((size_t)pf->depth * pf->nmu, sizeof(float));
+    pf->slot = calloc(pf->depth, sizeof(int));
+    for (i = 0; i < pf->depth; i++) pf->slot[i] = -1;
+    pf->busy = -1;
+    pthread_mutex_init(&pf->lock, NULL);
+    pthread_cond_init(&pf->cond, NULL);
+    if (pthread_create(&pf->thread, NULL, prefetch_reader, pf) != 0) {
+        printf("Could not start prefetch thread, reading frames directly.\n");
+        pthread_mutex_destroy(&pf->lock);
+        pthread_cond_destroy(&pf->cond);
+        free(pf->He), free(pf->mu), free(pf->slot);
+        if (pf->mu_own != NULL) traj_fclose(pf->mu_own);
+        traj_fclose(pf->H_own);
+        free(pf);
+        return NULL;
+    }
+    active = pf;
+    return pf;
+}
+
+// Start reading the frames first to first+count-1
+void prefetch_window(t_prefetch* pf, int first, int count) {
+    int i;
+    if (pf == NULL) return;
+    if (first < 0) {
+        count += first;
+        first = 0;
+    }
+    pthread_mutex_lock(&pf->lock);
+    pf->first = first;
+    pf->count = count;
+    pf->next = first;
+    pf->head = first - 1;
+    pf->gen++;
+    for (i = 0; i < pf->depth; i++) pf->slot[i] = -1;
+    pthread_cond_broadcast(&pf->cond);
+    pthread_mutex_unlock(&pf->lock);
+}
+
+// Stop the reader thread
+void prefetch_free(t_prefetch* pf) {
+    if (pf == NULL) return;
+    pthread_mutex_lock(&pf->lock);
+    pf->stop = 1;
+    pthread_cond_broadcast(&pf->cond);
+    pthread_mutex_unlock(&pf->lock);
+    pthread_join(pf->thread, NULL);
+    active = NULL;
+    pthread_mutex_destroy(&pf->lock);
+    pthread_cond_destroy(&pf->cond);
+    free(pf->He), free(pf->mu), free(pf->slot);
+    if (pf->mu_own != NULL) traj_fclose(pf->mu_own);
+    traj_fclose(pf->H_own);
+    free(pf);
+}
+
+// Find frame pos in the ring, waiting if it is being read or is the next to
+// be read. Returns the slot or -1 with the lock held.
+static int prefetch_find(t_prefetch* pf, int pos) {
+    int s;
+    pthread_mutex_lock(&pf->lock);
+    if (pos < pf->first || pos >= pf->first + pf->count) return -1;
+    if (pos > pf->head) {
+        pf->head = pos;
+        pthread_cond_broadcast(&pf->cond);
+    }
+    while (pf->busy == pos || pf->next == pos) pthread_cond_wait(&pf->cond, &pf->lock);
+    s = (pos - pf->first) % pf->depth;
+    if (pf->slot[s] != pos) return -1;
+    return s;
+}
+
+// Copy the Hamiltonian of frame pos if it was read ahead
+int prefetch_He(FILE* FH, int pos, float* He) {
+    t_prefetch* pf = active;
+    int s;
+    if (pf == NULL || FH != pf->H_traj) return 0;
+    s = prefetch_find(pf, pos);
+    if (s >= 0) copyvec(pf->He + s * pf->nH, He, pf->nH);
+    pthread_mutex_unlock(&pf->lock);
+    return s >= 0;
+}
+
+// Copy dipole component x of frame pos if it was read ahead
+int prefetch_mue(FILE* FH, int pos, int x, float* mue) {
+    t_prefetch* pf = active;
+    int s;
+    if (pf == NULL || FH != pf->mu_traj || x < 0 || x > 2) return 0;
+    s = prefetch_find(pf, pos);
+    if (s >= 0) copyvec(pf->mu + s * pf->nmu + x * pf->non->singles, mue, pf->non->singles);
+    pthread_mutex_unlock(&pf->lock);
+    return s >= 0;
+}
+
+#else
+
+// No reader thread on Windows, frames are always read directly
+t_prefetch* prefetch_init(t_non* non, FILE* H_traj, FILE* mu_traj) { return NULL; }
+void prefetch_window(t_prefetch* pf, int first, int count) { }
+void prefetch_free(t_prefetch* pf) { }
+int prefetch_He(FILE* FH, int pos, float* He) { return 0; }
+int prefetch_mue(FILE* FH, int pos, int x, float* mue) { return 0; }
+
+#endif
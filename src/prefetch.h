@@ -0,0 +1,17 @@
+#ifndef _PREFETCH_
+#define _PREFETCH_
+
+#include <stdio.h>
+#include "types.h"
+
+// Background reader filling a ring buffer with the decoded frames of the
+// present sample ahead of the propagation
+typedef struct t_prefetch t_prefetch;
+
+t_prefetch* prefetch_init(t_non *non,FILE *H_traj,FILE *mu_traj);
+void prefetch_window(t_prefetch *pf,int first,int count);
+void prefetch_free(t_prefetch *pf);
+int prefetch_He(FILE *FH,int pos,float *He);
+int prefetch_mue(FILE *FH,int pos,int x,float *mue);
+
+#endif // _PREFETCH_
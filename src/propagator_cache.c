@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "types.h"
+#include "NISE_subs.h"
+#include "propagator_cache.h"
+#include "mpi.h"
+
+/* Cache of the one exciton propagators exp(-iH dt/hbar) of the trajectory frames.  */
+/* The same frames are propagated over many times in the 2D techniques: for all t1 */
+/* vectors, for both bra and ket side, for all polarization directions and for     */
+/* overlapping samples. The size of the cache is set in MB with PropagatorCache.   */
+
+// Create the cache, returns NULL when caching is switched off
+t_propcache* propcache_init(t_non* non) {
+    t_propcache* cache;
+    size_t N2 = non->singles * non->singles;
+    long capacity;
+
+    if (non->propcache <= 0) return NULL;
+    capacity = (long) non->propcache * 1024 * 1024 / (2 * N2 * sizeof(float));
+    // Never store more than the full trajectory
+    if (capacity > non->length) capacity = non->length;
+    if (capacity < 1) return NULL;
+
+    cache = (t_propcache *)calloc(1, sizeof(t_propcache));
+    cache->N = non->singles;
+    cache->capacity = capacity;
+    cache->frames = non->length;
+    cache->slot = (int *)malloc(non->length * sizeof(int));
+    for (int i = 0; i < non->length; i++) cache->slot[i] = -1;
+    cache->frame = (int *)calloc(capacity, sizeof(int));
+    cache->prev = (int *)calloc(capacity, sizeof(int));
+    cache->next = (int *)calloc(capacity, sizeof(int));
+    cache->Ur = (float *)calloc(capacity * N2, sizeof(float));
+    cache->Ui = (float *)calloc(capacity * N2, sizeof(float));
+    if (cache->Ur == NULL || cache->Ui == NULL) {
+        printf("Could not allocate %d MB for the propagator cache!\n", non->propcache);
+        exit(1);
+    }
+    cache->head = -1, cache->tail = -1;
+    return cache;
+}
+
+void propcache_free(t_propcache* cache) {
+    if (cache == NULL) return;
+    free(cache->slot), free(cache->frame), free(cache->prev), free(cache->next);
+    free(cache->Ur), free(cache->Ui);
+    free(cache);
+}
+
+// Remove slot from the usage list
+static void propcache_unlink(t_propcache* cache, int s) {
+    if (cache->prev[s] != -1) cache->next[cache->prev[s]] = cache->next[s];
+    else cache->head = cache->next[s];
+    if (cache->next[s] != -1) cache->prev[cache->next[s]] = cache->prev[s];
+    else cache->tail = cache->prev[s];
+}
+
+// Insert slot as the most recently used
+static void propcache_push(t_propcache* cache, int s) {
+    cache->prev[s] = -1;
+    cache->next[s] = cache->head;
+    if (cache->head != -1) cache->prev[cache->head] = s;
+    cache->head = s;
+    if (cache->tail == -1) cache->tail = s;
+}
+
+// Find the forward propagator of a frame. On a miss the Hamiltonian of the frame
+// is read into Hamiltonian_i and the propagator is constructed, replacing the
+// least recently used one if the cache is full
+void propcache_get(t_non* non, t_propcache* cache, float* Hamiltonian_i, FILE* H_traj, int frame, float** Ur,
+                   float** Ui) {
+    size_t N2 = cache->N * cache->N;
+    int s = cache->slot[frame];
+
+    if (s != -1) {
+        cache->hits++;
+        propcache_unlink(cache, s);
+    } else {
+        cache->misses++;
+        if (cache->count < cache->capacity) {
+            s = cache->count++;
+        } else {
+            s = cache->tail;
+            propcache_unlink(cache, s);
+            cache->slot[cache->frame[s]] = -1;
+        }
+        if (read_He(non, Hamiltonian_i, H_traj, frame) != 1) {
+            printf("Hamiltonian trajectory file to short, could not fill buffer!!!\n");
+            exit(1);
+        }
+        propagator_DIA_S(non, Hamiltonian_i, cache->Ur + s * N2, cache->Ui + s * N2, 1);
+        cache->frame[s] = frame;
+        cache->slot[frame] = s;
+    }
+    propcache_push(cache, s);
+    *Ur = cache->Ur + s * N2;
+    *Ui = cache->Ui + s * N2;
+}
+
+// Propagate n vectors one step with the Hamiltonian of the given frame. Backward
+// propagation (sign=-1) uses the complex conjugate of the cached propagator.
+// Without cache the propagator is constructed directly
+void propagate_vecs_cache(t_non* non, t_propcache* cache, float* Hamiltonian_i, FILE* H_traj, int frame, float** vr,
+                          float** vi, int n, int sign) {
+    float *Ur, *Ui;
+
+    if (cache == NULL) {
+        if (read_He(non, Hamiltonian_i, H_traj, frame) != 1) {
+            printf("Hamiltonian trajectory file to short, could not fill buffer!!!\n");
+            exit(1);
+        }
+        propagate_vecs_DIA_S(non, Hamiltonian_i, vr, vi, n, sign);
+        return;
+    }
+    propcache_get(non, cache, Hamiltonian_i, H_traj, frame, &Ur, &Ui);
+    propagate_vecs_U(non, Ur, Ui, vr, vi, n, sign);
+}
+
+// Write the cache statistics of all processes to the log file
+void propcache_log(t_propcache* cache, char* name) {
+    long stat[2] = {0, 0}, total[2] = {0, 0};
+    int rank;
+
+    if (cache != NULL) stat[0] = cache->hits, stat[1] = cache->misses;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Reduce(stat, total, 2, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    if (rank == 0 && cache != NULL) {
+        log_item("Propagator cache in %s: %d frames per process, %ld hits, %ld misses (%.1f pct. hits).\n",
+                 name, cache->capacity, total[0], total[1],
+                 total[0] + total[1] > 0 ? 100.0 * total[0] / (total[0] + total[1]) : 0.0);
+    }
+}
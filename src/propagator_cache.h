@@ -0,0 +1,26 @@
+#ifndef _PROPAGATOR_CACHE_
+#define _PROPAGATOR_CACHE_
+
+#include "types.h"
+
+// Least recently used cache of one exciton propagators, indexed by frame
+typedef struct {
+  int N; // Number of singles
+  int capacity; // Maximum number of stored propagators
+  int count; // Number of stored propagators
+  int frames; // Number of frames in the trajectory
+  int *slot; // Slot of each frame, -1 if not stored
+  int *frame; // Frame stored in each slot
+  int *prev,*next; // Doubly linked list of slots, head is the most recently used
+  int head,tail;
+  float *Ur,*Ui; // Propagators for all slots
+  long hits,misses;
+} t_propcache;
+
+t_propcache* propcache_init(t_non *non);
+void propcache_free(t_propcache *cache);
+void propcache_get(t_non *non,t_propcache *cache,float *Hamiltonian_i,FILE *H_traj,int frame,float **Ur,float **Ui);
+void propagate_vecs_cache(t_non *non,t_propcache *cache,float *Hamiltonian_i,FILE *H_traj,int frame,float **vr,float **vi,int n,int sign);
+void propcache_log(t_propcache *cache,char *name);
+
+#endif // _PROPAGATOR_CACHE_
@@ -18,6 +18,8 @@ void readInput(int argc, char* argv[], t_non* non) {
     char* pValue;
     int control;
     char prop[256];
+    char orient[256];
+    char sched[256];
 
     // Defaults
     non->interpol = 1;
@@ -30,7 +32,19 @@ void readInput(int argc, char* argv[], t_non* non) {
     non->cluster = -1; // Average over all snapshots no clusters
     non->fft = 0;
     non->printLevel = 0; // Set to standard print level
+    non->propcache = 64; // Propagator cache size in MB
+    non->prefetch = 0; // No prefetch thread
+    non->sharedtraj = 0; // Every process reads the trajectory files
+    non->checkpoint = 0; // No checkpoints
+    non->restart = 0;
+    non->intermediate = 0; // No intermediate spectra
+    non->convergence = 0; // No early stopping
+    non->krylovtol = 1e-5; // Relative error of the Krylov propagator
+    non->chebytol = 1e-5; // Truncation of the Chebyshev expansion
+    non->dt1 = 1, non->dt2 = 1, non->dt3 = 1; // Every time step of t1 and t3 is calculated
     sprintf(non->basis, "Local");
+    sprintf(orient, "Individual");
+    sprintf(sched, "Static");
     //  non->hamiltonian="Full";
 
     if (argc < 2) {
@@ -65,6 +79,23 @@ void readInput(int argc, char* argv[], t_non* non) {
         // Propagation keyword
         if (keyWordS("Propagation", Buffer, prop, LabelLength) == 1) continue;
 
+        // Orientation keyword
+        if (keyWordS("Orientation", Buffer, orient, LabelLength) == 1) continue;
+
+        // Work item scheduling keyword
+        if (keyWordS("Scheduling", Buffer, sched, LabelLength) == 1) continue;
+
+        // Propagator cache size keyword
+        if (keyWordI("PropagatorCache", Buffer, &non->propcache, LabelLength) == 1) continue;
+        if (keyWordI("Prefetch", Buffer, &non->prefetch, LabelLength) == 1) continue;
+        if (keyWordI("SharedTrajectory", Buffer, &non->sharedtraj, LabelLength) == 1) continue;
+        if (keyWordI("Checkpoint", Buffer, &non->checkpoint, LabelLength) == 1) continue;
+        if (keyWordI("Restart", Buffer, &non->restart, LabelLength) == 1) continue;
+        if (keyWordI("Intermediate", Buffer, &non->intermediate, LabelLength) == 1) continue;
+        if (keyWordF("Convergence", Buffer, &non->convergence, LabelLength) == 1) continue;
+        if (keyWordF("KrylovTolerance", Buffer, &non->krylovtol, LabelLength) == 1) continue;
+        if (keyWordF("ChebyshevTolerance", Buffer, &non->chebytol, LabelLength) == 1) continue;
+
         // Hamiltonian file keyword
         if (keyWordS("Hamiltonianfile", Buffer, non->energyFName, LabelLength) == 1) continue;
 
@@ -130,6 +161,12 @@ void readInput(int argc, char* argv[], t_non* non) {
         // Read maxtimes
         if (keyWord3I("RunTimes", Buffer, &non->tmax1, &non->tmax2, &non->tmax3, LabelLength) == 1) continue;
 
+        // Read the strides of the t1 and t3 times calculated
+        if (keyWord3I("TimeIncrement", Buffer, &non->dt1, &non->dt2, &non->dt3, LabelLength) == 1) continue;
+
+        // Read waiting times for a t2 series
+        if (keyWordList("WaitingTimes", Buffer, &non->nt2, &non->t2list, LabelLength) == 1) continue;
+
         // Read integration steps
         if (keyWordI("Integrationsteps", Buffer, &non->is, LabelLength) == 1) continue;
 
@@ -178,7 +215,28 @@ void readInput(int argc, char* argv[], t_non* non) {
     while (1 == 1);
     fclose(inputFile);
 
-    non->dt1 = 1, non->dt2 = 1, non->dt3 = 1;
+    // The longest waiting time of a series replaces the t2 of RunTimes
+    if (non->nt2 > 0) {
+        for (int i = 0; i < non->nt2; i++) {
+            if (non->t2list[i] < 0 || (i > 0 && non->t2list[i] <= non->t2list[i - 1])) {
+                printf("The WaitingTimes must be increasing and not negative!\n");
+                exit(0);
+            }
+        }
+        non->tmax2 = non->t2list[non->nt2 - 1];
+    }
+
+    if (non->dt1 < 1 || non->dt2 < 1 || non->dt3 < 1) {
+        printf("The TimeIncrement must be at least one time step!\n");
+        exit(0);
+    }
+
+    // The pump probe signal only needs the response at t1=0
+    if (!strcmp(non->technique, "PumpProbe")) {
+        printf("Calculating the pump probe signal at t1=0 only.\n");
+        non->tmax1 = 1, non->dt1 = 1;
+    }
+
     // Set length of linear response function
     non->tmax = non->tmax1;
     /* Is the length large enough? */
@@ -203,6 +261,16 @@ void readInput(int argc, char* argv[], t_non* non) {
         printf("Coupling cutoff %f effective during t1 and t3.\n\n",
                non->couplingcut);
     }
+    if (!strcmp(prop, "Krylov")) {
+        non->propagation = 3;
+        printf("\nUsing Krylov subspace propagation!\n");
+        printf("Relative error tolerance %g per time step.\n\n", non->krylovtol);
+    }
+    if (!strcmp(prop, "Chebyshev")) {
+        non->propagation = 4;
+        printf("\nUsing Chebyshev expansion propagation!\n");
+        printf("Expansion truncated at coefficients below %g.\n\n", non->chebytol);
+    }
     if (!strcmp(prop, "Diagonal")) {
         non->propagation = 2;
         printf("\nUsing propagation with full diagonalization!\n\n");
@@ -210,6 +278,30 @@ void readInput(int argc, char* argv[], t_non* non) {
         exit(0);
     }
 
+    // Decide how the orientational average is performed
+    non->orientation = 0;
+    if (!strcmp(orient, "Batched")) {
+        non->orientation = 1;
+        printf("\nPropagating the Cartesian dipole components together for\n");
+        printf("all polarization directions of each sample.\n\n");
+    }
+
+    // Decide how the work items are distributed over the processes
+    non->scheduling = 0;
+    if (!strcmp(sched, "Dynamic")) {
+        non->scheduling = 1;
+        printf("\nHanding out the work items dynamically.\n\n");
+    }
+    else if (strcmp(sched, "Static")) {
+        printf("Unknown Scheduling %s, use Static or Dynamic!\n", sched);
+        exit(0);
+    }
+    // Only work items handed out dynamically can be stopped early
+    if (non->convergence > 0 && non->scheduling == 0) {
+        printf("Convergence requires Scheduling Dynamic!\n");
+        exit(0);
+    }
+
     if (non->propagation == 0) {
         printf("Rescaling threshold with factor %g. (dt/hbar)**2\n",
                (non->deltat * icm2ifs * twoPi / non->ts) * (non->deltat * icm2ifs * twoPi / non->ts));
@@ -324,6 +416,27 @@ int keyWord3F(char* keyWord, char* Buffer, float* f1, float* f2, float* f3, size
     return 0;
 }
 
+// Read a list of integers on the line of the keyword
+int keyWordList(char* keyWord, char* Buffer, int* n, int** list, size_t LabelLength) {
+    char* pValue;
+    char* pEnd;
+    int value;
+    if (!strncmp(&Buffer[0], &keyWord[0], LabelLength)) {
+        printf("%s:", keyWord);
+        pValue = &Buffer[LabelLength];
+        *n = 0;
+        *list = (int *)calloc(strlen(pValue) / 2 + 1, sizeof(int));
+        for (value = strtol(pValue, &pEnd, 10); pEnd != pValue; value = strtol(pValue, &pEnd, 10)) {
+            (*list)[(*n)++] = value;
+            printf(" %d", value);
+            pValue = pEnd;
+        }
+        printf("\n");
+        return 1;
+    }
+    return 0;
+}
+
 // Read projection input
 int keyWordProject(char* keyWord, char* Buffer, size_t LabelLength, int* singles, FILE* inputFile, int N, t_non* non) {
     char* pValue;
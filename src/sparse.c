@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "types.h"
+#include "NISE_subs.h"
+#include "workspace.h"
+#include "sparse.h"
+
+/* Sparse storage of the one exciton Hamiltonian.                              */
+/* The triangular Hamiltonian of a frame is scanned once and the couplings     */
+/* above Couplingcut are stored in compressed sparse rows. The propagators     */
+/* that only need products with the Hamiltonian then scale with the number of  */
+/* significant couplings instead of N^2. The arrays grow when a frame has more */
+/* couplings than any frame before and are reused for the following frames.   */
+
+t_csr* csr_init(int N) {
+    t_csr* H = (t_csr *)calloc(1, sizeof(t_csr));
+    H->N = N;
+    H->diag = (float *)calloc(N, sizeof(float));
+    H->first = (int *)calloc(N + 1, sizeof(int));
+    H->upper = (int *)calloc(N, sizeof(int));
+    H->capacity = 4 * N;
+    H->col = (int *)malloc(H->capacity * sizeof(int));
+    H->val = (float *)malloc(H->capacity * sizeof(float));
+    return H;
+}
+
+void csr_free(t_csr* H) {
+    if (H == NULL) return;
+    free(H->diag), free(H->first), free(H->upper), free(H->col), free(H->val);
+    free(H);
+}
+
+// Store the Hamiltonian of the present frame. Returns the number of couplings.
+int csr_build(t_non* non, float* Hamiltonian_i, t_csr* H) {
+    int N = H->N;
+    int a, b, k = 0;
+    float J;
+
+    for (a = 0; a < N; a++) {
+        H->first[a] = k;
+        H->diag[a] = Hamiltonian_i[Sindex(a, a, N)];
+        for (b = 0; b < N; b++) {
+            if (b == a) {
+                H->upper[a] = k;
+                continue;
+            }
+            J = Hamiltonian_i[Sindex(a, b, N)];
+            if (fabs(J) <= non->couplingcut) continue;
+            if (k == H->capacity) {
+                H->capacity *= 2;
+                H->col = (int *)realloc(H->col, H->capacity * sizeof(int));
+                H->val = (float *)realloc(H->val, H->capacity * sizeof(float));
+                if (H->col == NULL || H->val == NULL) {
+                    printf("Could not allocate the sparse Hamiltonian with %d couplings!\n", H->capacity);
+                    exit(1);
+                }
+            }
+            H->col[k] = b;
+            H->val[k] = J;
+            k++;
+        }
+    }
+    H->first[N] = k;
+    H->nnz = k;
+    return k;
+}
+
+// Y=H X for the columns of the N x n matrix X
+void csr_spmm(t_csr* H, float* X, float* Y, int n) {
+    int N = H->N;
+    int a, k, v;
+    float y;
+
+    for (v = 0; v < n; v++) {
+        float* x = X + v * N;
+        for (a = 0; a < N; a++) {
+            y = H->diag[a] * x[a];
+            for (k = H->first[a]; k < H->first[a + 1]; k++) y += H->val[k] * x[H->col[k]];
+            Y[a + v * N] = y;
+        }
+    }
+}
+
+// Propagate with the Trotter splitting of the diagonal and the couplings as in
+// propagate_vec_coupling_S, with the couplings taken from the sparse storage
+void propagate_vec_coupling_csr(t_non* non, t_csr* H, float* cr, float* ci, int m, int sign) {
+    int N = H->N;
+    int a, b, i, k;
+    float f, J, co, si;
+    float cr1, cr2, ci1, ci2;
+    float *re_U, *im_U, *ocr, *oci;
+    t_wsmark mark = ws_mark();
+
+    f = non->deltat * icm2ifs * twoPi * sign / m;
+    re_U = ws_alloc(N, sizeof(float));
+    im_U = ws_alloc(N, sizeof(float));
+    ocr = ws_alloc(N, sizeof(float));
+    oci = ws_alloc(N, sizeof(float));
+
+    // Exponentiate diagonal [U=exp(-i/2h H0 dt)]
+    for (a = 0; a < N; a++) {
+        re_U[a] = cos(0.5 * H->diag[a] * f);
+        im_U[a] = -sin(0.5 * H->diag[a] * f);
+    }
+
+    for (i = 0; i < m; i++) {
+        // Multiply on vector first time
+        for (a = 0; a < N; a++) {
+            ocr[a] = cr[a] * re_U[a] - ci[a] * im_U[a];
+            oci[a] = ci[a] * re_U[a] + cr[a] * im_U[a];
+        }
+
+        // Account for couplings
+        for (a = 0; a < N; a++) {
+            for (k = H->upper[a]; k < H->first[a + 1]; k++) {
+                b = H->col[k];
+                J = H->val[k] * f;
+                si = -sin(J);
+                co = sqrt(1 - si * si);
+                cr1 = co * ocr[a] - si * oci[b];
+                ci1 = co * oci[a] + si * ocr[b];
+                cr2 = co * ocr[b] - si * oci[a];
+                ci2 = co * oci[b] + si * ocr[a];
+                ocr[a] = cr1, oci[a] = ci1, ocr[b] = cr2, oci[b] = ci2;
+            }
+        }
+
+        // Multiply on vector second time
+        for (a = 0; a < N; a++) {
+            cr[a] = ocr[a] * re_U[a] - oci[a] * im_U[a];
+            ci[a] = oci[a] * re_U[a] + ocr[a] * im_U[a];
+        }
+    }
+    ws_release(mark);
+}
+
+// Whether the two exciton states are propagated with the dense one exciton
+// propagator in the Krylov and Chebyshev schemes. For large systems with few
+// couplings, where 2N^(3/2) exceeds the number of nonzero elements as for the
+// dense propagator of the Sparse scheme, the Trotter scheme over the couplings
+// is cheaper than the N^3 matrix products.
+int csr_dense_doubles(t_csr* H) {
+    return H->N <= CSR_DENSE_DOUBLES || H->nnz + H->N > 2 * H->N * sqrt(H->N);
+}
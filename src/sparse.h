@@ -0,0 +1,31 @@
+#ifndef _SPARSE_
+#define _SPARSE_
+
+#include "types.h"
+
+// Largest number of sites for which the two exciton states are always
+// propagated with the dense propagator in the Krylov and Chebyshev schemes
+#define CSR_DENSE_DOUBLES 100
+
+// One exciton Hamiltonian of a frame in compressed sparse row storage. The
+// diagonal is kept apart and only couplings larger than Couplingcut are stored,
+// in both triangles with increasing column number in each row.
+typedef struct {
+  int N;
+  int nnz; // Number of stored couplings
+  int capacity; // Allocated length of col and val
+  float *diag;
+  int *first; // Start of each row in col and val, N+1 entries
+  int *upper; // First coupling of each row with a column above the diagonal
+  int *col;
+  float *val;
+} t_csr;
+
+t_csr* csr_init(int N);
+void csr_free(t_csr *H);
+int csr_build(t_non *non,float *Hamiltonian_i,t_csr *H);
+void csr_spmm(t_csr *H,float *X,float *Y,int n);
+void propagate_vec_coupling_csr(t_non *non,t_csr *H,float *cr,float *ci,int m,int sign);
+int csr_dense_doubles(t_csr *H);
+
+#endif // _SPARSE_
@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+    #include <sys/mman.h>
+    #include <unistd.h>
+#endif
+#include "trajectory.h"
+
+/* Memory mapped access to the binary trajectory files.                        */
+/* A file is mapped read only the first time one of its frames is requested    */
+/* and stays mapped until it is closed with traj_fclose. Frames are then      */
+/* returned as pointers into the mapping, which needs no system calls and is   */
+/* safe to use from several threads. Files that cannot be mapped are read with */
+/* fseek and fread as before. A frame range held in memory elsewhere, like a  */
+/* node shared window, can be attached to a file with traj_attach instead.     */
+
+#define TRAJ_MAX_MAPS 32
+
+typedef struct {
+  FILE *FH;
+  int fd;
+  char *base;
+  size_t start; // File offset of base
+  size_t size;
+  int owned; // The whole file is mapped by us
+} t_trajmap;
+
+static t_trajmap maps[TRAJ_MAX_MAPS];
+static int nmaps = 0;
+
+// Add an empty entry for FH
+static t_trajmap* traj_entry(FILE* FH) {
+    t_trajmap* m;
+    if (nmaps == TRAJ_MAX_MAPS) return NULL;
+    m = &maps[nmaps++];
+    m->FH = FH;
+    m->fd = fileno(FH);
+    m->base = NULL;
+    m->start = 0;
+    m->size = 0;
+    m->owned = 0;
+    return m;
+}
+
+// Map the file behind FH, a failed mapping is kept with base NULL
+static t_trajmap* traj_map(FILE* FH) {
+    t_trajmap* m = traj_entry(FH);
+#ifndef _WIN32
+    struct stat st;
+    void* p;
+
+    if (m == NULL) return NULL;
+    if (fstat(m->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, m->fd, 0);
+        if (p != MAP_FAILED) {
+            m->base = p;
+            m->size = st.st_size;
+            m->owned = 1;
+        }
+    }
+#endif
+    return m;
+}
+
+// Find the mapping of FH, mapping the file on first use
+static t_trajmap* traj_find(FILE* FH) {
+    t_trajmap* m = NULL;
+    int i;
+#pragma omp critical(trajmap)
+    {
+        for (i = 0; i < nmaps; i++) {
+            if (maps[i].FH == FH && maps[i].fd == fileno(FH)) {
+                m = &maps[i];
+                break;
+            }
+        }
+        if (m == NULL) m = traj_map(FH);
+    }
+    return m;
+}
+
+// Pointer to len bytes at offset in the file, NULL if the file is not
+// mapped or too short
+const void* traj_frame(FILE* FH, size_t offset, size_t len) {
+    t_trajmap* m = traj_find(FH);
+    if (m == NULL || m->base == NULL) return NULL;
+    if (offset < m->start || offset + len > m->start + m->size) return NULL;
+    return m->base + offset - m->start;
+}
+
+// Read the time stamp at offset followed by count elements of the given
+// size. Returns the number of time stamps read (0 or 1) like fread.
+size_t traj_read(FILE* FH, size_t offset, int* t, void* buf, size_t size, size_t count) {
+    t_trajmap* m = traj_find(FH);
+    size_t control, avail;
+
+    if (m != NULL && m->base != NULL && !m->owned && offset >= m->start &&
+        offset + sizeof(int) + size * count <= m->start + m->size) {
+        memcpy(t, m->base + offset - m->start, sizeof(int));
+        memcpy(buf, m->base + offset - m->start + sizeof(int), size * count);
+        return 1;
+    }
+    if (m == NULL || m->base == NULL || !m->owned) {
+        fseek(FH, offset, SEEK_SET);
+        control = fread(t, sizeof(int), 1, FH);
+        fread(buf, size, count, FH);
+        return control;
+    }
+    if (offset + sizeof(int) > m->size) return 0;
+    memcpy(t, m->base + offset, sizeof(int));
+    offset += sizeof(int);
+    avail = (m->size - offset) / size;
+    if (avail > count) avail = count;
+    memcpy(buf, m->base + offset, avail * size);
+    return 1;
+}
+
+// Hint that the given range of the file will be read soon
+void traj_advise(FILE* FH, size_t offset, size_t len) {
+#ifndef _WIN32
+    t_trajmap* m = traj_find(FH);
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t start;
+
+    if (m == NULL || m->base == NULL || !m->owned || offset >= m->size) return;
+    if (offset + len > m->size) len = m->size - offset;
+    start = offset / page * page;
+    madvise(m->base + start, len + offset - start, MADV_WILLNEED);
+#endif
+}
+
+// Remove the mapping of FH
+void traj_unmap(FILE* FH) {
+    int i;
+#pragma omp critical(trajmap)
+    {
+        for (i = 0; i < nmaps; i++) {
+            if (maps[i].FH == FH) {
+#ifndef _WIN32
+                if (maps[i].owned) munmap(maps[i].base, maps[i].size);
+#endif
+                maps[i] = maps[--nmaps];
+                break;
+            }
+        }
+    }
+}
+
+// Read the bytes from offset to offset+size-1 of FH from base instead of the
+// file. Offsets outside this range are read from the file.
+void traj_attach(FILE* FH, const void* base, size_t offset, size_t size) {
+    t_trajmap* m;
+    traj_unmap(FH);
+#pragma omp critical(trajmap)
+    {
+        m = traj_entry(FH);
+        if (m != NULL) {
+            m->base = (char*)base;
+            m->start = offset;
+            m->size = size;
+        }
+    }
+}
+
+// Close a trajectory file opened with fopen and drop its mapping
+int traj_fclose(FILE* FH) {
+    traj_unmap(FH);
+    return fclose(FH);
+}
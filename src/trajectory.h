@@ -0,0 +1,14 @@
+#ifndef _TRAJECTORY_
+#define _TRAJECTORY_
+
+#include <stdio.h>
+#include <stddef.h>
+
+const void* traj_frame(FILE *FH,size_t offset,size_t len);
+size_t traj_read(FILE *FH,size_t offset,int *t,void *buf,size_t size,size_t count);
+void traj_advise(FILE *FH,size_t offset,size_t len);
+void traj_attach(FILE *FH,const void *base,size_t offset,size_t size);
+void traj_unmap(FILE *FH);
+int traj_fclose(FILE *FH);
+
+#endif // _TRAJECTORY_
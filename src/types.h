@@ -78,7 +78,20 @@ typedef struct {
   float anharmonicity;
   int Npsites;
   int printLevel;
+  int orientation;
+  int propcache; // Size of the propagator cache in MB
+  int prefetch; // Number of frames read ahead by the prefetch thread
+  int sharedtraj; // Keep the trajectory frames in node shared memory
+  int scheduling; // Distribution of work items, 0 static and 1 dynamic
+  int checkpoint; // Minutes between checkpoints of the 2D response, 0 for none
+  int restart; // Continue from the checkpoint files
+  int intermediate; // Minutes between intermediate 2D spectra, 0 for none
+  float convergence; // Relative statistical error at which sampling stops, 0 for none
+  float krylovtol; // Error tolerance of the Krylov propagator per time step
+  float chebytol; // Smallest coefficient kept in the Chebyshev propagator
+  int nt2; // Number of waiting times in a t2 series, 0 for the single tmax2
   int *psites;
+  int *t2list; // Waiting times of the t2 series in time steps
 } t_non;
 
 #endif // _TYPES_
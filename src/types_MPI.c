@@ -1,7 +1,7 @@
 #include "types_MPI.h"
 
 const t_non_datatype T_NON_TYPE = {
-    60,
+    72,
     {
         1, 1, 1,
         1, 1, 1,
@@ -24,6 +24,18 @@ const t_non_datatype T_NON_TYPE = {
         1,
         1, 1, 1, 1,
         1,
+        1,
+        1,
+        1,
+        1,
+        1,
+        1,
+        1,
+        1,
+        1,
+        1,
+        1,
+        1,
         1
     },
 {
@@ -48,6 +60,18 @@ const t_non_datatype T_NON_TYPE = {
         MPI_INT,
         MPI_FLOAT, MPI_FLOAT, MPI_FLOAT, MPI_FLOAT,
         MPI_INT,
+        MPI_INT,
+        MPI_INT,
+        MPI_INT,
+        MPI_INT,
+        MPI_INT,
+        MPI_INT,
+        MPI_INT,
+        MPI_INT,
+        MPI_INT,
+        MPI_FLOAT,
+        MPI_FLOAT,
+        MPI_FLOAT,
         MPI_INT
     },
 {
@@ -76,6 +100,15 @@ const t_non_datatype T_NON_TYPE = {
         offsetof(t_non, statsteps),
         offsetof(t_non, thres), offsetof(t_non, couplingcut), offsetof(t_non, temperature), offsetof(t_non, anharmonicity),
         offsetof(t_non, Npsites),
-        offsetof(t_non, printLevel)
+        offsetof(t_non, printLevel),
+        offsetof(t_non, orientation),
+        offsetof(t_non, propcache),
+        offsetof(t_non, prefetch),
+        offsetof(t_non, sharedtraj),
+        offsetof(t_non, scheduling),
+        offsetof(t_non, checkpoint), offsetof(t_non, restart),
+        offsetof(t_non, intermediate), offsetof(t_non, convergence),
+        offsetof(t_non, krylovtol), offsetof(t_non, chebytol),
+        offsetof(t_non, nt2)
     }
 };
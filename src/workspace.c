@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+    #include <malloc.h>
+#endif
+#include "omp.h"
+#include "types.h"
+#include "workspace.h"
+
+/* Per-thread workspace for the temporary arrays of the propagation routines.   */
+/* Each thread owns one 64-byte aligned block, sized once from the system size, */
+/* from which arrays are taken in stack order: a routine marks the workspace on */
+/* entry and releases everything it took on exit. Requests that do not fit are */
+/* served from the heap and freed again on release.                            */
+
+#define WS_ALIGN 64
+#define WS_MAX_OVERFLOW 64
+
+typedef struct {
+  char *base;
+  size_t size;
+  size_t used;
+  int overflow;
+  void *heap[WS_MAX_OVERFLOW];
+} t_ws;
+
+static size_t ws_size = 0;
+static t_ws ws;
+#pragma omp threadprivate(ws)
+
+static void* ws_aligned_malloc(size_t bytes) {
+    void* p;
+#ifdef _WIN32
+    p = _aligned_malloc(bytes, WS_ALIGN);
+#else
+    if (posix_memalign(&p, WS_ALIGN, bytes) != 0) p = NULL;
+#endif
+    if (p == NULL) {
+        printf("Could not allocate workspace of %zu bytes!\n", bytes);
+        exit(1);
+    }
+    return p;
+}
+
+static void ws_aligned_free(void* p) {
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+// Set the workspace size from the largest arrays needed by the propagators:
+// the one exciton propagators, the blocks of t1 vectors, the two exciton
+// vectors and the LAPACK work space. The techniques with excited state
+// absorption also need the blocks of two exciton matrices of propagate_doubles_U.
+void ws_init(t_non* non) {
+    size_t N = non->singles;
+    size_t nn2 = N * (N + 1) / 2;
+    size_t nvec = 3 * (non->tmax1 + 1);
+    size_t block = 0;
+    if (nvec < N) nvec = N;
+    if (!strcmp(non->technique, "2DIR") || !strcmp(non->technique, "EAIR") || !strcmp(non->technique, "PumpProbe") ||
+        !strcmp(non->technique, "2DUVvis") || !strcmp(non->technique, "EAUVvis")) {
+        // At most nine two exciton vectors for every t1 point in a block
+        block = WS_DOUBLES_BLOCK / (2 * N * N);
+        if (block > 9 * (size_t) (non->tmax1 + 1)) block = 9 * (size_t) (non->tmax1 + 1);
+        if (block < 1) block = 1;
+        block = 3 * block * 2 * N * N + 2 * N;
+    }
+    ws_size = (8 * N * N + 4 * nvec * N + 6 * nn2 + 128 * N + block) * sizeof(float) + 32 * WS_ALIGN;
+}
+
+t_wsmark ws_mark(void) {
+    t_wsmark mark;
+    mark.used = ws.used;
+    mark.overflow = ws.overflow;
+    return mark;
+}
+
+// Take n elements of the given size from the workspace of this thread
+void* ws_alloc(size_t n, size_t size) {
+    size_t bytes = (n * size + WS_ALIGN - 1) / WS_ALIGN * WS_ALIGN;
+    void* p;
+
+    if (ws.base == NULL && ws_size > 0) {
+        ws.base = ws_aligned_malloc(ws_size);
+        ws.size = ws_size;
+    }
+    if (ws.used + bytes <= ws.size) {
+        p = ws.base + ws.used;
+        ws.used += bytes;
+        return p;
+    }
+    if (ws.overflow == WS_MAX_OVERFLOW) {
+        printf("Workspace overflow, too many nested allocations!\n");
+        exit(1);
+    }
+    p = ws_aligned_malloc(bytes > 0 ? bytes : WS_ALIGN);
+    ws.heap[ws.overflow++] = p;
+    return p;
+}
+
+// Take n zeroed elements of the given size from the workspace of this thread
+void* ws_calloc(size_t n, size_t size) {
+    void* p = ws_alloc(n, size);
+    memset(p, 0, n * size);
+    return p;
+}
+
+// Release everything taken from the workspace since the mark
+void ws_release(t_wsmark mark) {
+    while (ws.overflow > mark.overflow) {
+        ws_aligned_free(ws.heap[--ws.overflow]);
+    }
+    ws.used = mark.used;
+}
@@ -0,0 +1,24 @@
+#ifndef _WORKSPACE_
+#define _WORKSPACE_
+
+#include <stddef.h>
+#include "types.h"
+
+// Position in the workspace, returned by ws_mark and used to release
+// everything allocated after it with ws_release
+typedef struct {
+  size_t used;
+  int overflow;
+} t_wsmark;
+
+// Largest block of two exciton vectors in floats, for each of the three
+// temporary arrays of propagate_doubles_U
+#define WS_DOUBLES_BLOCK (1 << 20)
+
+void ws_init(t_non *non);
+t_wsmark ws_mark(void);
+void* ws_alloc(size_t n,size_t size);
+void* ws_calloc(size_t n,size_t size);
+void ws_release(t_wsmark mark);
+
+#endif // _WORKSPACE_